@@ -0,0 +1,158 @@
+// Copyright 2023 Northern.tech AS
+//
+//    Licensed under the Apache License, Version 2.0 (the "License");
+//    you may not use this file except in compliance with the License.
+//    You may obtain a copy of the License at
+//
+//        http://www.apache.org/licenses/LICENSE-2.0
+//
+//    Unless required by applicable law or agreed to in writing, software
+//    distributed under the License is distributed on an "AS IS" BASIS,
+//    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//    See the License for the specific language governing permissions and
+//    limitations under the License.
+package app
+
+import (
+	"fmt"
+	"io"
+	"sync"
+	"time"
+
+	"github.com/sirupsen/logrus"
+)
+
+// Defaults for buffering deployment log entries.
+const (
+	// Entries which do not fit in the buffer are dropped.
+	defaultLogBufferSize = 256 * 1024
+	// The buffer is flushed in the background once it holds this much...
+	defaultLogFlushSize = 16 * 1024
+	// ...or, at the latest, after this long.
+	defaultLogFlushInterval = time.Second
+)
+
+// bufferedLogWriter queues log entries in a bounded buffer, which a
+// background goroutine writes out in batches. Writing never blocks on the
+// file; if the buffer is full, the entry is dropped, and the number of dropped
+// entries is logged with the next flush.
+type bufferedLogWriter struct {
+	out io.Writer
+
+	lock    sync.Mutex
+	pending []byte
+	dropped int
+	limit   int
+
+	// Held while writing out, so that flushes keep the order of entries.
+	flushLock sync.Mutex
+	spare     []byte
+	err       error
+
+	flushSize int
+	kick      chan struct{}
+	stop      chan struct{}
+	done      chan struct{}
+}
+
+func newBufferedLogWriter(
+	out io.Writer,
+	limit, flushSize int,
+	interval time.Duration,
+) *bufferedLogWriter {
+	w := &bufferedLogWriter{
+		out:       out,
+		pending:   make([]byte, 0, flushSize),
+		limit:     limit,
+		flushSize: flushSize,
+		kick:      make(chan struct{}, 1),
+		stop:      make(chan struct{}),
+		done:      make(chan struct{}),
+	}
+	go w.run(interval)
+	return w
+}
+
+func (w *bufferedLogWriter) run(interval time.Duration) {
+	defer close(w.done)
+	ticker := time.NewTicker(interval)
+	defer ticker.Stop()
+	for {
+		select {
+		case <-w.kick:
+		case <-ticker.C:
+		case <-w.stop:
+			return
+		}
+		_ = w.Flush()
+	}
+}
+
+// Write queues 'entry', which must be a whole entry, and never fails.
+func (w *bufferedLogWriter) Write(entry []byte) (int, error) {
+	w.lock.Lock()
+	if len(w.pending)+len(entry) > w.limit {
+		w.dropped++
+		w.lock.Unlock()
+		w.wake()
+		return len(entry), nil
+	}
+	w.pending = append(w.pending, entry...)
+	full := len(w.pending) >= w.flushSize
+	w.lock.Unlock()
+	if full {
+		w.wake()
+	}
+	return len(entry), nil
+}
+
+func (w *bufferedLogWriter) wake() {
+	select {
+	case w.kick <- struct{}{}:
+	default:
+	}
+}
+
+// Flush writes out all the queued entries, and returns the first error
+// writing out entries so far.
+func (w *bufferedLogWriter) Flush() error {
+	w.flushLock.Lock()
+	defer w.flushLock.Unlock()
+
+	w.lock.Lock()
+	w.pending, w.spare = w.spare[:0], w.pending
+	dropped := w.dropped
+	w.dropped = 0
+	w.lock.Unlock()
+
+	if dropped > 0 {
+		// The entries were dropped after the ones queued.
+		w.spare = append(w.spare, droppedLogEntry(dropped)...)
+	}
+	if len(w.spare) > 0 {
+		if _, err := w.out.Write(w.spare); err != nil && w.err == nil {
+			w.err = err
+		}
+	}
+	return w.err
+}
+
+// Close stops the background flushes, and flushes the remaining entries.
+func (w *bufferedLogWriter) Close() error {
+	close(w.stop)
+	<-w.done
+	return w.Flush()
+}
+
+func droppedLogEntry(dropped int) []byte {
+	entry := logrus.NewEntry(logrus.StandardLogger())
+	entry.Message = fmt.Sprintf("Deployment log buffer full: dropped %d entries", dropped)
+	entry.Level = logrus.WarnLevel
+	entry.Time = time.Now()
+	formatter := DeploymentJSONFormatter{}
+	message, err := formatter.Format(entry)
+	if err != nil {
+		return nil
+	}
+	return message
+}
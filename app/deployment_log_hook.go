@@ -70,7 +70,7 @@ func (dh DeploymentHook) Levels() []logrus.Level {
 }
 
 func (dh DeploymentHook) Fire(entry *logrus.Entry) error {
-	if !dh.logManager.loggingEnabled {
+	if !dh.logManager.enabled() {
 		return nil
 	}
 
@@ -86,5 +86,9 @@ func (dh DeploymentHook) Fire(entry *logrus.Entry) error {
 	}
 
 	err = dh.logManager.WriteLog(message)
+	if err == ErrLoggerNotInitialized {
+		// Disabled meanwhile.
+		return nil
+	}
 	return err
 }
@@ -15,16 +15,20 @@ package app
 
 import (
 	"bufio"
+	"bytes"
 	"encoding/json"
 	"errors"
 	"fmt"
 	"io"
+	"io/ioutil"
 	"os"
 	"path/filepath"
 	"sort"
 	"strconv"
 	"strings"
+	"sync"
 	"syscall"
+	"time"
 
 	log "github.com/sirupsen/logrus"
 
@@ -74,10 +78,20 @@ type DeploymentLogManager struct {
 	logLocation  string
 	deploymentID string
 	logger       *FileLogger
+	// entries are queued here, and written to 'logger' in the background
+	buffer *bufferedLogWriter
+	// guards 'logger', 'buffer' and 'loggingEnabled', since the log hook
+	// writes entries from any goroutine
+	lock sync.Mutex
 	// how many log files we are keeping in log directory before rotating
 	maxLogFiles int
 
 	minLogSizeBytes uint64
+
+	// how much is buffered, and how often it is written out
+	logBufferSize    int
+	logFlushSize     int
+	logFlushInterval time.Duration
 	// it is easy to add logging hook, but not so much remove it;
 	// we need a mechanism for emabling and disabling logging
 	loggingEnabled bool
@@ -93,19 +107,46 @@ func NewDeploymentLogManager(logDirLocation string) *DeploymentLogManager {
 		//logger:
 		// for now we can hardcode this
 		maxLogFiles:     5,
-		minLogSizeBytes: 1024 * 100, //100kb
-		loggingEnabled:  false,
+		minLogSizeBytes:  1024 * 100, //100kb
+		logBufferSize:    defaultLogBufferSize,
+		logFlushSize:     defaultLogFlushSize,
+		logFlushInterval: defaultLogFlushInterval,
+		loggingEnabled:   false,
 	}
 }
 
-func (dlm DeploymentLogManager) WriteLog(log []byte) error {
-	if dlm.logger == nil {
+// WriteLog queues a log entry, which is written to the log file in the
+// background, or by Flush.
+func (dlm *DeploymentLogManager) WriteLog(log []byte) error {
+	dlm.lock.Lock()
+	defer dlm.lock.Unlock()
+	if dlm.buffer == nil {
 		return ErrLoggerNotInitialized
 	}
-	_, err := dlm.logger.Write(log)
+	_, err := dlm.buffer.Write(log)
 	return err
 }
 
+// Flush writes all the queued log entries to the log file.
+func (dlm *DeploymentLogManager) Flush() error {
+	if dlm == nil {
+		return nil
+	}
+	dlm.lock.Lock()
+	defer dlm.lock.Unlock()
+	if dlm.buffer == nil {
+		return nil
+	}
+	return dlm.buffer.Flush()
+}
+
+// enabled reports whether logging is enabled.
+func (dlm *DeploymentLogManager) enabled() bool {
+	dlm.lock.Lock()
+	defer dlm.lock.Unlock()
+	return dlm.loggingEnabled
+}
+
 // check if there is enough space to store the logs
 func (dlm *DeploymentLogManager) haveEnoughSpaceForStoringLogs() bool {
 	var stat syscall.Statfs_t
@@ -117,10 +158,26 @@ func (dlm *DeploymentLogManager) haveEnoughSpaceForStoringLogs() bool {
 }
 
 func (dlm *DeploymentLogManager) Enable(deploymentID string) error {
+	dlm.lock.Lock()
 	if dlm.loggingEnabled {
+		dlm.lock.Unlock()
 		return nil
 	}
+	err := dlm.enable(deploymentID)
+	dlm.lock.Unlock()
+	if err != nil {
+		return err
+	}
 
+	// Useful for updates where client is upgraded.
+	log.Infof("Running Mender client version: %s", conf.VersionString())
+
+	return nil
+}
+
+// enable opens the log file of 'deploymentID'. The lock must be held, so
+// nothing may be logged meanwhile.
+func (dlm *DeploymentLogManager) enable(deploymentID string) error {
 	if !dlm.haveEnoughSpaceForStoringLogs() {
 		return ErrNotEnoughSpaceForLogs
 	}
@@ -137,29 +194,37 @@ func (dlm *DeploymentLogManager) Enable(deploymentID string) error {
 	if dlm.logger == nil {
 		return ErrLoggerNotInitialized
 	}
+	dlm.buffer = newBufferedLogWriter(dlm.logger,
+		dlm.logBufferSize, dlm.logFlushSize, dlm.logFlushInterval)
 
 	dlm.loggingEnabled = true
-
-	// Useful for updates where client is upgraded.
-	log.Infof("Running Mender client version: %s", conf.VersionString())
-
 	return nil
 }
 
 func (dlm *DeploymentLogManager) Disable() error {
-	if dlm == nil || !dlm.loggingEnabled {
+	if dlm == nil {
 		return nil
 	}
-
-	if err := dlm.logger.Deinit(); err != nil {
-		return err
+	dlm.lock.Lock()
+	defer dlm.lock.Unlock()
+	if !dlm.loggingEnabled {
+		return nil
 	}
 
+	// Disabled even if this fails, so that the next deployment may be
+	// logged again.
+	flushErr := dlm.buffer.Close()
+	err := dlm.logger.Deinit()
+	dlm.buffer = nil
+	dlm.logger = nil
 	dlm.loggingEnabled = false
-	return nil
+	if err != nil {
+		return err
+	}
+	return flushErr
 }
 
-func (dlm DeploymentLogManager) getSortedLogFiles() ([]string, error) {
+func (dlm *DeploymentLogManager) getSortedLogFiles() ([]string, error) {
 
 	// list all the log files in log directory
 	logFiles, err :=
@@ -173,7 +238,7 @@ func (dlm DeploymentLogManager) getSortedLogFiles() ([]string, error) {
 }
 
 //log naming convention: <base_name>.%04d.<deployment_id>.log
-func (dlm DeploymentLogManager) rotateLogFileName(name string) string {
+func (dlm *DeploymentLogManager) rotateLogFileName(name string) string {
 	logFileName := filepath.Base(name)
 	nameChunks := strings.Split(logFileName, ".")
 
@@ -191,7 +256,7 @@ func (dlm DeploymentLogManager) rotateLogFileName(name string) string {
 	return name
 }
 
-func (dlm DeploymentLogManager) Rotate() {
+func (dlm *DeploymentLogManager) Rotate() {
 	logFiles, err := dlm.getSortedLogFiles()
 	if err != nil {
 		// can not rotate
@@ -227,7 +292,7 @@ func (dlm DeploymentLogManager) Rotate() {
 	}
 }
 
-func (dlm DeploymentLogManager) findLogsForSpecificID(deploymentID string) (string, error) {
+func (dlm *DeploymentLogManager) findLogsForSpecificID(deploymentID string) (string, error) {
 	logFiles, err := dlm.getSortedLogFiles()
 	if err != nil {
 		return "", err
@@ -244,55 +309,99 @@ func (dlm DeploymentLogManager) findLogsForSpecificID(deploymentID string) (stri
 
 // GetLogs is returns logs as a JSON []byte string. Function is having the same
 // signature as json.Marshal() ([]byte, error)
-func (dlm DeploymentLogManager) GetLogs(deploymentID string) ([]byte, error) {
-	// opaque individual raw JSON entries into `{"messages:" [...]}` format
-	type formattedDeploymentLogs struct {
-		Messages []json.RawMessage `json:"messages"`
+func (dlm *DeploymentLogManager) GetLogs(deploymentID string) ([]byte, error) {
+	logs, err := dlm.OpenLogs(deploymentID)
+	if err != nil {
+		return nil, err
 	}
-	// must be initialized as below
-	// if we will use `var logsList []json.RawMessage` instead, while marshalling
-	// to JSON we will end up with `{"messages":null}` instead of `{"messages":[]}`
-	logsList := make([]json.RawMessage, 0)
+	defer logs.Close()
+	return ioutil.ReadAll(logs)
+}
+
+// OpenLogs returns a reader of the same JSON document as GetLogs, which reads
+// the log file as it goes, instead of all at once.
+func (dlm *DeploymentLogManager) OpenLogs(deploymentID string) (io.ReadCloser, error) {
+	// make sure everything logged so far is in the file
+	if err := dlm.Flush(); err != nil {
+		log.Debugf("Failed to flush deployment logs: %v", err)
+	}
+
+	r := &deploymentLogReader{}
+	// opaque individual raw JSON entries into `{"messages:" [...]}` format
+	r.pending.WriteString(`{"messages":[`)
 
 	logFileName, err := dlm.findLogsForSpecificID(deploymentID)
 	// log file for specific deployment id does not exist
 	if err == os.ErrNotExist {
-		logs := formattedDeploymentLogs{logsList}
-		return json.Marshal(logs)
+		return r, nil
 	}
-
 	if err != nil {
 		return nil, err
 	}
 
-	logF, err := os.Open(logFileName)
+	r.file, err = os.Open(logFileName)
 	if err != nil {
 		return nil, err
 	}
+	r.lines = bufio.NewScanner(r.file)
+	return r, nil
+}
 
-	defer logF.Close()
-
-	// read log file line by line
-	scanner := bufio.NewScanner(logF)
+// deploymentLogReader encodes the lines of a log file as they are read.
+type deploymentLogReader struct {
+	file  *os.File
+	lines *bufio.Scanner
+	// encoded, and not yet read
+	pending bytes.Buffer
+	line    bytes.Buffer
+	entries int
+	done    bool
+	// the HTTP client may close the request body while it is being read
+	closeOnce sync.Once
+	closeErr  error
+}
 
-	// read log file line by line
-	for scanner.Scan() {
-		var logLine json.RawMessage
-		// check if the log is valid JSON
-		err = json.Unmarshal([]byte(scanner.Text()), &logLine)
-		if err != nil {
-			// we have broken JSON log; just skip it for now
-			continue
+func (r *deploymentLogReader) Read(b []byte) (int, error) {
+	for r.pending.Len() == 0 && !r.done {
+		if err := r.encodeLine(); err != nil {
+			return 0, err
 		}
-		// here we should have a list of verified JSON logs
-		logsList = append(logsList, logLine)
 	}
+	return r.pending.Read(b)
+}
 
-	if err = scanner.Err(); err != nil {
-		return nil, err
+func (r *deploymentLogReader) encodeLine() error {
+	if r.lines == nil || !r.lines.Scan() {
+		if r.lines != nil {
+			if err := r.lines.Err(); err != nil {
+				return err
+			}
+		}
+		r.pending.WriteString("]}")
+		r.done = true
+		return nil
 	}
 
-	logs := formattedDeploymentLogs{logsList}
+	r.line.Reset()
+	if err := json.Compact(&r.line, r.lines.Bytes()); err != nil {
+		// we have broken JSON log; just skip it for now
+		return nil
+	}
+	if r.entries > 0 {
+		r.pending.WriteByte(',')
+	}
+	// escape the way json.Marshal() would
+	json.HTMLEscape(&r.pending, r.line.Bytes())
+	r.entries++
+	return nil
+}
 
-	return json.Marshal(logs)
+func (r *deploymentLogReader) Close() error {
+	if r.file == nil {
+		return nil
+	}
+	r.closeOnce.Do(func() {
+		r.closeErr = r.file.Close()
+	})
+	return r.closeErr
 }
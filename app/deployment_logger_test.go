@@ -14,17 +14,24 @@
 package app
 
 import (
+	"bytes"
 	"errors"
 	"fmt"
+	"io"
 	"io/ioutil"
 	"math"
 	"os"
 	"path"
 	"strings"
+	"sync"
+	"sync/atomic"
 	"testing"
+	"testing/iotest"
+	"time"
 
 	log "github.com/sirupsen/logrus"
 	"github.com/stretchr/testify/assert"
+	"github.com/stretchr/testify/require"
 )
 
 func openLogFileWithContent(file, data string) error {
@@ -129,6 +136,31 @@ func TestLogManagerCheckEnableDisable(t *testing.T) {
 	}
 }
 
+func TestLogManagerDisableFlushError(t *testing.T) {
+	tempDir, _ := ioutil.TempDir("", "logs")
+	defer os.RemoveAll(tempDir)
+
+	logManager := NewDeploymentLogManager(tempDir)
+	require.NoError(t, logManager.Enable("1234-5678"))
+
+	// As if the disk ran full.
+	require.NoError(t, logManager.buffer.Close())
+	logManager.buffer = newBufferedLogWriter(failingWriter{}, 1024, 1024, time.Hour)
+	require.NoError(t, logManager.WriteLog([]byte(`{"msg":"lost"}`+"\n")))
+	assert.Error(t, logManager.Disable())
+	assert.False(t, logManager.loggingEnabled)
+
+	// The next deployment is logged again.
+	require.NoError(t, logManager.Enable("8765-4321"))
+	assert.True(t, logManager.loggingEnabled)
+	require.NoError(t, logManager.WriteLog([]byte(`{"msg":"logged"}`+"\n")))
+	require.NoError(t, logManager.Disable())
+
+	logs, err := logManager.GetLogs("8765-4321")
+	require.NoError(t, err)
+	assert.Contains(t, string(logs), "logged")
+}
+
 func TestLogManagerCheckLogging(t *testing.T) {
 	tempDir, _ := ioutil.TempDir("", "logs")
 	defer os.RemoveAll(tempDir)
@@ -149,6 +181,10 @@ func TestLogManagerCheckLogging(t *testing.T) {
 	if err := logManager.WriteLog([]byte(toWriteLog)); err != nil {
 		t.FailNow()
 	}
+	// entries are written in the background, or when flushed
+	if err := logManager.Flush(); err != nil {
+		t.FailNow()
+	}
 	if !logFileContains(logFile, toWriteLog) {
 		t.FailNow()
 	}
@@ -338,3 +374,244 @@ func TestFindLogFiles(t *testing.T) {
 	assert.Empty(t, logs)
 
 }
+
+type lockedBuffer struct {
+	sync.Mutex
+	bytes.Buffer
+	writes int
+}
+
+func (b *lockedBuffer) Write(p []byte) (int, error) {
+	b.Lock()
+	defer b.Unlock()
+	b.writes++
+	return b.Buffer.Write(p)
+}
+
+func (b *lockedBuffer) String() string {
+	b.Lock()
+	defer b.Unlock()
+	return b.Buffer.String()
+}
+
+func TestBufferedLogWriter(t *testing.T) {
+	out := &lockedBuffer{}
+	w := newBufferedLogWriter(out, 1024, 1024, time.Hour)
+
+	_, err := w.Write([]byte(`{"msg":"1"}` + "\n"))
+	assert.NoError(t, err)
+	_, err = w.Write([]byte(`{"msg":"2"}` + "\n"))
+	assert.NoError(t, err)
+	assert.Empty(t, out.String())
+
+	assert.NoError(t, w.Flush())
+	assert.Equal(t, `{"msg":"1"}`+"\n"+`{"msg":"2"}`+"\n", out.String())
+	assert.Equal(t, 1, out.writes)
+
+	// Nothing to write.
+	assert.NoError(t, w.Flush())
+	assert.Equal(t, 1, out.writes)
+	assert.NoError(t, w.Close())
+
+	// Entries which do not fit are dropped, and reported after the
+	// others.
+	out = &lockedBuffer{}
+	w = newBufferedLogWriter(out, 20, 1024, time.Hour)
+	for i := 0; i < 3; i++ {
+		_, err = w.Write([]byte(fmt.Sprintf(`{"msg":"%d"}`+"\n", i)))
+		assert.NoError(t, err)
+	}
+	assert.NoError(t, w.Close())
+	lines := strings.Split(strings.TrimSpace(out.String()), "\n")
+	require.Len(t, lines, 2)
+	assert.Equal(t, `{"msg":"0"}`, lines[0])
+	assert.Contains(t, lines[1], `"level":"warning"`)
+	assert.Contains(t, lines[1], "dropped 2 entries")
+
+	// Flushed in the background once enough is queued...
+	out = &lockedBuffer{}
+	w = newBufferedLogWriter(out, 1024, 10, time.Hour)
+	_, _ = w.Write([]byte(`{"msg":"size"}` + "\n"))
+	assert.Eventually(t, func() bool {
+		return out.String() == `{"msg":"size"}`+"\n"
+	}, 5*time.Second, 10*time.Millisecond)
+	assert.NoError(t, w.Close())
+
+	// ...or after a while.
+	out = &lockedBuffer{}
+	w = newBufferedLogWriter(out, 1024, 1024, 10*time.Millisecond)
+	_, _ = w.Write([]byte(`{"msg":"time"}` + "\n"))
+	assert.Eventually(t, func() bool {
+		return out.String() == `{"msg":"time"}`+"\n"
+	}, 5*time.Second, 10*time.Millisecond)
+	assert.NoError(t, w.Close())
+
+	// Write errors are returned by Flush and Close.
+	w = newBufferedLogWriter(failingWriter{}, 1024, 1024, time.Hour)
+	_, err = w.Write([]byte(`{"msg":"lost"}` + "\n"))
+	assert.NoError(t, err)
+	assert.Error(t, w.Flush())
+	assert.Error(t, w.Close())
+}
+
+type failingWriter struct{}
+
+func (failingWriter) Write(p []byte) (int, error) {
+	return 0, errors.New("disk full")
+}
+
+func TestOpenLogs(t *testing.T) {
+	tempDir, _ := ioutil.TempDir("", "logs")
+	defer os.RemoveAll(tempDir)
+
+	deploymentLogger := NewDeploymentLogManager(tempDir)
+
+	logFileWithContent := path.Join(tempDir, fmt.Sprintf(logFileNameScheme, 1, "1111-2222"))
+	logContent := `{"msg": "test", "n": 1}
+{"msg": "broken
+
+{"msg":"<b>&</b>"}`
+	err := openLogFileWithContent(logFileWithContent, logContent)
+	require.NoError(t, err)
+
+	// Same as what GetLogs() did with json.Marshal().
+	expected := `{"messages":[{"msg":"test","n":1},{"msg":"\u003cb\u003e\u0026\u003c/b\u003e"}]}`
+
+	logs, err := deploymentLogger.OpenLogs("1111-2222")
+	require.NoError(t, err)
+	data, err := ioutil.ReadAll(iotest.OneByteReader(logs))
+	assert.NoError(t, err)
+	assert.Equal(t, expected, string(data))
+	assert.NoError(t, logs.Close())
+	assert.NoError(t, logs.Close())
+
+	data, err = deploymentLogger.GetLogs("1111-2222")
+	assert.NoError(t, err)
+	assert.Equal(t, expected, string(data))
+
+	// Entries which are still queued are read as well.
+	require.NoError(t, deploymentLogger.Enable("1111-3333"))
+	defer deploymentLogger.Disable()
+	require.NoError(t, deploymentLogger.WriteLog([]byte(`{"msg":"queued"}`+"\n")))
+	data, err = deploymentLogger.GetLogs("1111-3333")
+	assert.NoError(t, err)
+	assert.Equal(t, `{"messages":[{"msg":"queued"}]}`, string(data))
+}
+
+// countingWriteCloser counts the writes to the log file.
+type countingWriteCloser struct {
+	io.WriteCloser
+	writes int64
+}
+
+func (w *countingWriteCloser) Write(p []byte) (int, error) {
+	atomic.AddInt64(&w.writes, 1)
+	return w.WriteCloser.Write(p)
+}
+
+// unbufferedLogHook writes each entry to the log file as it comes, the way
+// the deployment log hook did before entries were buffered.
+type unbufferedLogHook struct {
+	DeploymentHook
+}
+
+func (h unbufferedLogHook) Fire(entry *log.Entry) error {
+	message, err := h.formater.Format(entry)
+	if err != nil {
+		return err
+	}
+	_, err = h.logManager.logger.Write(message)
+	return err
+}
+
+// BenchmarkDeploymentLog logs verbose update module output through the
+// deployment log hook. Reports the number of writes to the log file, each of
+// which is a synchronous write system call.
+func BenchmarkDeploymentLog(b *testing.B) {
+	line := strings.Repeat("module output ", 8)
+
+	level := log.GetLevel()
+	log.SetLevel(log.WarnLevel)
+	defer log.SetLevel(level)
+
+	for _, buffered := range []bool{false, true} {
+		name := "unbuffered"
+		if buffered {
+			name = "buffered"
+		}
+		b.Run(name, func(b *testing.B) {
+			tempDir, err := ioutil.TempDir("", "logs")
+			require.NoError(b, err)
+			defer os.RemoveAll(tempDir)
+
+			logManager := NewDeploymentLogManager(tempDir)
+			require.NoError(b, logManager.Enable("1111-2222"))
+			file := &countingWriteCloser{WriteCloser: logManager.logger.logFile}
+			logManager.logger.logFile = file
+
+			logger := log.New()
+			logger.SetOutput(ioutil.Discard)
+			hook := NewDeploymentLogHook(logManager)
+			if buffered {
+				logger.AddHook(hook)
+			} else {
+				logger.AddHook(unbufferedLogHook{*hook})
+			}
+
+			b.ReportAllocs()
+			b.ResetTimer()
+			for i := 0; i < b.N; i++ {
+				logger.Info(line)
+			}
+			require.NoError(b, logManager.Flush())
+			b.StopTimer()
+
+			b.ReportMetric(float64(atomic.LoadInt64(&file.writes))/float64(b.N),
+				"writes/op")
+			require.NoError(b, logManager.Disable())
+		})
+	}
+}
+
+// BenchmarkUploadLogs reads a large deployment log for upload, all at once, or
+// streaming it. Compare the B/op, which for GetLogs grows with the log file.
+func BenchmarkUploadLogs(b *testing.B) {
+	tempDir, err := ioutil.TempDir("", "logs")
+	require.NoError(b, err)
+	defer os.RemoveAll(tempDir)
+
+	logFile, err := os.Create(path.Join(tempDir, fmt.Sprintf(logFileNameScheme, 1, "1111-2222")))
+	require.NoError(b, err)
+	var size int64
+	for i := 0; i < 50000; i++ {
+		n, err := fmt.Fprintf(logFile,
+			`{"level":"info","message":"module output line %d","timestamp":"2023-01-01T00:00:00Z"}`+"\n", i)
+		require.NoError(b, err)
+		size += int64(n)
+	}
+	require.NoError(b, logFile.Close())
+
+	deploymentLogger := NewDeploymentLogManager(tempDir)
+
+	b.Run("GetLogs", func(b *testing.B) {
+		b.SetBytes(size)
+		b.ReportAllocs()
+		for i := 0; i < b.N; i++ {
+			logs, err := deploymentLogger.GetLogs("1111-2222")
+			require.NoError(b, err)
+			_, _ = ioutil.Discard.Write(logs)
+		}
+	})
+
+	b.Run("OpenLogs", func(b *testing.B) {
+		b.SetBytes(size)
+		b.ReportAllocs()
+		for i := 0; i < b.N; i++ {
+			logs, err := deploymentLogger.OpenLogs("1111-2222")
+			require.NoError(b, err)
+			_, err = io.Copy(ioutil.Discard, logs)
+			require.NoError(b, err)
+			logs.Close()
+		}
+	})
+}
@@ -14,10 +14,15 @@
 package app
 
 import (
+	"crypto/sha256"
+	"encoding/base64"
+	"encoding/hex"
+	"encoding/json"
 	"fmt"
 	"io"
 	"os"
 	"path"
+	"strings"
 	"time"
 
 	log "github.com/sirupsen/logrus"
@@ -59,7 +64,7 @@ type Controller interface {
 	NewStatusReportWrapper(updateId string,
 		stateId datastore.MenderState) *client.StatusReportWrapper
 	ReportUpdateStatus(update *datastore.UpdateInfo, status string) menderError
-	UploadLog(update *datastore.UpdateInfo, logs []byte) menderError
+	UploadLog(update *datastore.UpdateInfo, logs func() (io.ReadCloser, error)) menderError
 	InventoryRefresh() error
 
 	CheckScriptsCompatibility() error
@@ -106,6 +111,10 @@ const (
 	authManagerChannelName = "mender"
 )
 
+// The whole inventory is submitted at least this often, even if it did not
+// change.
+const inventoryResubmitInterval = 24 * time.Hour
+
 func StateStatus(m datastore.MenderState) string {
 	status, ok := stateStatus[m]
 	if ok {
@@ -129,6 +138,15 @@ type Mender struct {
 	download client.ApiRequester
 
 	controlMapPool *ControlMapPool
+
+	// The server and the device the current auth token was issued by, and
+	// for. The inventory is only known to be on the server if it was
+	// submitted to, and for, the same.
+	authServerURL string
+	authDeviceID  string
+	// Number of inventory submits skipped since the last one, because
+	// nothing changed.
+	inventorySkipped int
 }
 
 type MenderPieces struct {
@@ -148,7 +166,7 @@ func NewMender(config *conf.MenderConfig, pieces MenderPieces) (*Mender, error)
 
 	m := &Mender{
 		DeviceManager:       dev.NewDeviceManager(pieces.DualRootfsDevice, config, pieces.Store),
-		updater:             client.NewUpdate(),
+		updater:             client.NewUpdateWithDownloadConfig(config.Download),
 		state:               States.Init,
 		stateScriptExecutor: stateScrExec,
 		authManager:         pieces.AuthManager,
@@ -208,9 +226,37 @@ func (m *Mender) Authorize() (client.AuthToken, client.ServerURL, error) {
 		)
 	}
 
+	// The server, or the device, may have changed, and the device may
+	// have been accepted again after being decommissioned, in which case
+	// the server does not have its inventory.
+	if err := m.Store.Remove(datastore.SubmittedInventoryKey); err != nil &&
+		!os.IsNotExist(err) {
+		log.Warnf("Failed to remove the submitted inventory: %v", err)
+	}
+	m.authServerURL = string(resp.ServerURL)
+	m.authDeviceID = authTokenDeviceID(resp.AuthToken)
+
 	return resp.AuthToken, resp.ServerURL, nil
 }
 
+// authTokenDeviceID returns the ID of the device which 'token' was issued for:
+// the subject of the JWT, or, if it cannot be parsed, the digest of the
+// token itself.
+func authTokenDeviceID(token client.AuthToken) string {
+	parts := strings.Split(string(token), ".")
+	if len(parts) == 3 {
+		payload, err := base64.RawURLEncoding.DecodeString(parts[1])
+		var claims struct {
+			Subject string `json:"sub"`
+		}
+		if err == nil && json.Unmarshal(payload, &claims) == nil && claims.Subject != "" {
+			return claims.Subject
+		}
+	}
+	sum := sha256.Sum256([]byte(token))
+	return hex.EncodeToString(sum[:])
+}
+
 func (m *Mender) ClearAuthorization() {
 	m.api.ClearAuthorization()
 }
@@ -417,14 +463,17 @@ func (m *Mender) ReportUpdateStatus(update *datastore.UpdateInfo, status string)
 	return nil
 }
 
-func (m *Mender) UploadLog(update *datastore.UpdateInfo, logs []byte) menderError {
+func (m *Mender) UploadLog(
+	update *datastore.UpdateInfo,
+	logs func() (io.ReadCloser, error),
+) menderError {
 	s := client.NewLog()
 	err := s.Upload(
 		m.api,
 		m.Config.Servers[0].ServerURL,
 		client.LogData{
 			DeploymentID: update.ID,
-			Messages:     logs,
+			Open:         logs,
 		},
 	)
 	if err != nil {
@@ -506,6 +555,8 @@ func transitionState(to State, ctx *StateContext, c Controller) (State, bool) {
 	log.Infof("State transition: %s [%s] -> %s [%s]",
 		from.Id(), from.Transition().String(),
 		to.Id(), to.Transition().String())
+	// Write out the deployment log of the state we are leaving.
+	_ = DeploymentLogger.Flush()
 
 	var report *client.StatusReportWrapper
 	if shouldReportUpdateStatus(to.Id()) {
@@ -586,7 +637,11 @@ func transitionState(to State, ctx *StateContext, c Controller) (State, bool) {
 
 func (m *Mender) InventoryRefresh() error {
 	ic := client.NewInventory()
-	idg := inv.NewInventoryDataRunner(path.Join(conf.GetDataDirPath(), "inventory"))
+	idg := inv.NewInventoryDataRunner(
+		path.Join(conf.GetDataDirPath(), "inventory"),
+		m.Config.InventoryScriptConcurrency,
+		time.Duration(m.Config.InventoryScriptTimeoutSeconds)*time.Second,
+	)
 
 	artifactName, err := m.GetCurrentArtifactName()
 	if err != nil || artifactName == "" {
@@ -631,14 +686,76 @@ func (m *Mender) InventoryRefresh() error {
 		return nil
 	}
 
-	err = ic.Submit(m.api, m.Config.Servers[0].ServerURL, idata)
+	return m.submitInventory(ic, idata)
+}
+
+// submitInventory submits the attributes of 'idata' which changed since the
+// last successful submit, if any. The whole inventory is submitted when
+// attributes were removed, when the server does not support partial
+// updates, when the device was authorized with another server, or as
+// another device, since, and at least every inventoryResubmitInterval, in
+// case the server lost track of it.
+func (m *Mender) submitInventory(ic client.InventorySubmitter, idata client.InventoryData) error {
+	submitted := inv.NewSubmittedInventory(idata)
+	last := inv.LoadSubmittedInventory(m.Store)
+	if last != nil && time.Since(last.Submitted) < inventoryResubmitInterval &&
+		last.SubmittedTo(m.authServerURL, m.authDeviceID) {
+		changes, complete := last.Changes(idata)
+		if len(changes) == 0 && complete {
+			m.inventorySkipped++
+			log.Infof("Inventory unchanged, not submitting it "+
+				"(%d submits skipped since the last one, %s ago)",
+				m.inventorySkipped, time.Since(last.Submitted).Round(time.Second))
+			return nil
+		}
+
+		if complete {
+			serverURL, deviceID := m.authServerURL, m.authDeviceID
+			err := ic.SubmitPartial(m.api, m.Config.Servers[0].ServerURL, changes)
+			if err == nil && (m.authServerURL != serverURL || m.authDeviceID != deviceID) {
+				// Authorized again while submitting, so the
+				// rest of the inventory may be missing.
+				err = errors.New("authorized with another server or device")
+			}
+			if err == nil {
+				log.Infof("Submitted %d changed out of %d inventory attributes",
+					len(changes), len(idata))
+				submitted.Submitted = last.Submitted
+				m.storeSubmittedInventory(submitted)
+				return nil
+			}
+			log.Infof("Partial inventory submit failed, submitting all attributes: %v", err)
+		}
+	}
+
+	if last != nil {
+		// Until the submit succeeds, the inventory on the server is
+		// unknown.
+		if err := m.Store.Remove(datastore.SubmittedInventoryKey); err != nil {
+			log.Warnf("Failed to remove the submitted inventory: %v", err)
+		}
+	}
+	err := ic.Submit(m.api, m.Config.Servers[0].ServerURL, idata)
 	if err != nil {
 		return errors.Wrapf(err, "failed to submit inventory data")
 	}
+	submitted.Submitted = time.Now()
+	m.storeSubmittedInventory(submitted)
 
 	return nil
 }
 
+// storeSubmittedInventory records 'submitted', which was just submitted to the
+// server which the device is authorized with.
+func (m *Mender) storeSubmittedInventory(submitted *inv.SubmittedInventory) {
+	m.inventorySkipped = 0
+	submitted.ServerURL = m.authServerURL
+	submitted.DeviceID = m.authDeviceID
+	if err := submitted.Store(m.Store); err != nil {
+		log.Warnf("Failed to store the submitted inventory: %v", err)
+	}
+}
+
 func (m *Mender) CheckScriptsCompatibility() error {
 	return m.stateScriptExecutor.CheckRootfsScriptsVersion()
 }
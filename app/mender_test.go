@@ -18,10 +18,12 @@ import (
 	"crypto/rand"
 	"crypto/tls"
 	"crypto/x509"
+	"encoding/base64"
 	"encoding/json"
 	"fmt"
 	"io"
 	"io/ioutil"
+	"net/http"
 	"os"
 	"path"
 	"syscall"
@@ -43,6 +45,7 @@ import (
 	"github.com/mendersoftware/mender/conf"
 	"github.com/mendersoftware/mender/datastore"
 	dev "github.com/mendersoftware/mender/device"
+	inv "github.com/mendersoftware/mender/inventory"
 	"github.com/mendersoftware/mender/store"
 	stest "github.com/mendersoftware/mender/system/testing"
 	"github.com/mendersoftware/mender/tests"
@@ -414,6 +417,12 @@ func TestMenderReportStatus(t *testing.T) {
 	assert.True(t, err.IsFatal())
 }
 
+func openTestLogs(logs []byte) func() (io.ReadCloser, error) {
+	return func() (io.ReadCloser, error) {
+		return ioutil.NopCloser(bytes.NewReader(logs)), nil
+	}
+}
+
 func TestMenderLogUpload(t *testing.T) {
 	srv := cltest.NewClientTestServer()
 	defer srv.Close()
@@ -445,7 +454,7 @@ func TestMenderLogUpload(t *testing.T) {
 		&datastore.UpdateInfo{
 			ID: "foobar",
 		},
-		logs,
+		openTestLogs(logs),
 	)
 	assert.Nil(t, err)
 	assert.JSONEq(t, `{
@@ -469,7 +478,7 @@ func TestMenderLogUpload(t *testing.T) {
 		&datastore.UpdateInfo{
 			ID: "foobar",
 		},
-		logs,
+		openTestLogs(logs),
 	)
 	assert.NotNil(t, err)
 }
@@ -607,6 +616,167 @@ echo foo=bar`),
 	assert.NotNil(t, err)
 }
 
+func TestMenderInventoryRefreshChanges(t *testing.T) {
+	td, _ := ioutil.TempDir("", "mender-inventory-")
+	defer os.RemoveAll(td)
+	deviceType := path.Join(td, "device_type")
+	ioutil.WriteFile(deviceType, []byte("device_type=foo-bar"), 0600)
+	invpath := path.Join(td, "inventory")
+	require.NoError(t, os.MkdirAll(invpath, os.FileMode(syscall.S_IRWXU)))
+
+	oldDefaultPathDataDir := conf.DefaultPathDataDir
+	conf.DefaultPathDataDir = td
+	defer func() {
+		conf.DefaultPathDataDir = oldDefaultPathDataDir
+	}()
+
+	srv := cltest.NewClientTestServer()
+	defer srv.Close()
+	srv.Auth.Authorize = true
+	srv.Auth.Verify = true
+	srv.Auth.Token = []byte("tokendata")
+	srv.Inventory.PatchSupport = true
+
+	ms := store.NewMemStore()
+	mender := newTestMender(conf.MenderConfig{
+		MenderConfigFromFile: conf.MenderConfigFromFile{
+			Servers: []client.MenderServer{{ServerURL: srv.URL}},
+		},
+	},
+		testMenderPieces{
+			MenderPieces: MenderPieces{
+				Store: ms,
+			},
+		},
+	)
+	mender.DeviceTypeFile = deviceType
+	mender.Store.WriteAll(datastore.ArtifactNameKey, []byte("fake-id"))
+
+	writeScript := func(name, value string) {
+		err := ioutil.WriteFile(path.Join(invpath, "mender-inventory-"+name),
+			[]byte("#!/bin/sh\necho "+name+"="+value+"\n"),
+			os.FileMode(syscall.S_IRWXU))
+		require.NoError(t, err)
+	}
+	refresh := func() {
+		srv.Inventory.Called = false
+		srv.Inventory.Method = ""
+		require.NoError(t, mender.InventoryRefresh())
+	}
+
+	writeScript("foo", "bar")
+	writeScript("baz", "1")
+	refresh()
+	assert.Equal(t, http.MethodPut, srv.Inventory.Method)
+	assert.Len(t, srv.Inventory.Attrs, 5)
+
+	// Unchanged, not submitted.
+	refresh()
+	assert.False(t, srv.Inventory.Called)
+	refresh()
+	assert.False(t, srv.Inventory.Called)
+	assert.Equal(t, 2, mender.inventorySkipped)
+
+	// Only the changed attribute is submitted.
+	writeScript("baz", "2")
+	refresh()
+	assert.Equal(t, http.MethodPatch, srv.Inventory.Method)
+	assert.Len(t, srv.Inventory.Attrs, 5)
+	assert.Contains(t, srv.Inventory.Attrs, client.InventoryAttribute{Name: "baz", Value: "2"})
+	assert.Equal(t, 0, mender.inventorySkipped)
+
+	// A removed attribute requires a complete submit.
+	require.NoError(t, os.Remove(path.Join(invpath, "mender-inventory-foo")))
+	refresh()
+	assert.Equal(t, http.MethodPut, srv.Inventory.Method)
+	assert.Len(t, srv.Inventory.Attrs, 4)
+
+	// So does an old one.
+	last := inv.LoadSubmittedInventory(ms)
+	last.Submitted = last.Submitted.Add(-inventoryResubmitInterval)
+	require.NoError(t, last.Store(ms))
+	refresh()
+	assert.Equal(t, http.MethodPut, srv.Inventory.Method)
+
+	// As does one submitted to another server.
+	refresh()
+	assert.False(t, srv.Inventory.Called)
+	last = inv.LoadSubmittedInventory(ms)
+	last.ServerURL = "https://other.mender.io"
+	require.NoError(t, last.Store(ms))
+	refresh()
+	assert.Equal(t, http.MethodPut, srv.Inventory.Method)
+
+	// Or for another device, after it was decommissioned and accepted
+	// again.
+	refresh()
+	assert.False(t, srv.Inventory.Called)
+	srv.Auth.Token = []byte("header." +
+		base64.RawURLEncoding.EncodeToString([]byte(`{"sub":"new-device-id"}`)) +
+		".signature")
+	_, _, err := mender.Authorize()
+	require.NoError(t, err)
+	assert.Nil(t, inv.LoadSubmittedInventory(ms))
+	assert.Equal(t, "new-device-id", mender.authDeviceID)
+	refresh()
+	assert.Equal(t, http.MethodPut, srv.Inventory.Method)
+	assert.Equal(t, "new-device-id", inv.LoadSubmittedInventory(ms).DeviceID)
+
+	// As does a failed partial submit.
+	writeScript("baz", "3")
+	srv.Inventory.PatchSupport = false
+	refresh()
+	assert.Equal(t, http.MethodPut, srv.Inventory.Method)
+	assert.Contains(t, srv.Inventory.Attrs, client.InventoryAttribute{Name: "baz", Value: "3"})
+
+	// As does a partial submit during which the device was authorized
+	// again, as another device.
+	idata := append(client.InventoryData(nil), srv.Inventory.Attrs...)
+	for i := range idata {
+		if idata[i].Name == "baz" {
+			idata[i].Value = "4"
+		}
+	}
+	submitter := &reauthorizingSubmitter{mender: mender}
+	require.NoError(t, mender.submitInventory(submitter, idata))
+	assert.Equal(t, []string{http.MethodPatch, http.MethodPut}, submitter.methods)
+	assert.Equal(t, "reauthorized-device-id", inv.LoadSubmittedInventory(ms).DeviceID)
+}
+
+// reauthorizingSubmitter authorizes the device again, as another device, while
+// submitting the inventory partially.
+type reauthorizingSubmitter struct {
+	mender  *Mender
+	methods []string
+}
+
+func (s *reauthorizingSubmitter) Submit(api client.ApiRequester, server string, data interface{}) error {
+	s.methods = append(s.methods, http.MethodPut)
+	return nil
+}
+
+func (s *reauthorizingSubmitter) SubmitPartial(
+	api client.ApiRequester,
+	server string,
+	data interface{},
+) error {
+	s.methods = append(s.methods, http.MethodPatch)
+	s.mender.authDeviceID = "reauthorized-device-id"
+	return nil
+}
+
+func TestAuthTokenDeviceID(t *testing.T) {
+	claims := base64.RawURLEncoding.EncodeToString([]byte(`{"sub":"1234","iss":"Mender"}`))
+	assert.Equal(t, "1234", authTokenDeviceID(client.AuthToken("eyJhbGciOiJIUzI1NiJ9."+
+		claims+".c2lnbmF0dXJl")))
+
+	// Not a JWT; still unique to the token.
+	id := authTokenDeviceID("tokendata")
+	assert.Len(t, id, 64)
+	assert.NotEqual(t, id, authTokenDeviceID("othertoken"))
+	assert.Len(t, authTokenDeviceID("header.!!!.signature"), 64)
+}
+
 func MakeFakeUpdate(data string) (string, error) {
 	f, err := ioutil.TempFile("", "test_update")
 	if err != nil {
@@ -1128,7 +1298,7 @@ func TestMutualTLSClientConnection(t *testing.T) {
 					&datastore.UpdateInfo{
 						ID: "foobar",
 					},
-					logs,
+					openTestLogs(logs),
 				)
 				t2.failed = false
 				test.assertFunc(t2, &storeErrorLog, err, srv.Log.Logs)
@@ -40,6 +40,10 @@ var (
 	ErrorManualRebootRequired = errors.New("Manual reboot required")
 )
 
+// StandaloneMetricsID is the deployment ID of the update metrics of a
+// standalone install.
+const StandaloneMetricsID = "standalone"
+
 type standaloneData struct {
 	artifactName             string
 	artifactGroup            string
@@ -60,6 +64,9 @@ func DoStandaloneInstall(device *dev.DeviceManager, updateURI string,
 
 	log.Debug("Starting device update.")
 
+	utils.Metrics.Begin(StandaloneMetricsID)
+	defer finishUpdateMetrics()
+
 	if strings.HasPrefix(updateURI, "http:") ||
 		strings.HasPrefix(updateURI, "https:") {
 		log.Infof("Performing remote update from: [%s].", updateURI)
@@ -70,7 +77,7 @@ func DoStandaloneInstall(device *dev.DeviceManager, updateURI string,
 		if err != nil {
 			return errors.New("Can not initialize client for performing network update.")
 		}
-		upclient = client.NewUpdate()
+		upclient = client.NewUpdateWithDownloadConfig(device.Config.Download)
 
 		log.Debug("Client initialized. Start downloading image.")
 
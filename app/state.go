@@ -28,6 +28,7 @@ import (
 	"github.com/mendersoftware/mender/datastore"
 	"github.com/mendersoftware/mender/installer"
 	"github.com/mendersoftware/mender/store"
+	"github.com/mendersoftware/mender/utils"
 )
 
 const (
@@ -710,6 +711,7 @@ func (u *updateFetchState) Handle(ctx *StateContext, c Controller) (State, bool)
 	if err := DeploymentLogger.Enable(u.update.ID); err != nil {
 		return NewUpdateStatusReportState(&u.update, client.StatusFailure), false
 	}
+	utils.Metrics.Begin(u.update.ID)
 
 	log.Debugf("Handling update fetch state")
 
@@ -1429,7 +1431,6 @@ type updateStatusReportState struct {
 	status             string
 	triesSendingReport int
 	triesSendingLogs   int
-	logs               []byte
 }
 
 func NewUpdateStatusReportState(update *datastore.UpdateInfo, status string) State {
@@ -1441,21 +1442,23 @@ func NewUpdateStatusReportState(update *datastore.UpdateInfo, status string) Sta
 }
 
 func sendDeploymentLogs(update *datastore.UpdateInfo, sentTries *int,
-	logs []byte, c Controller) menderError {
-	if logs == nil {
-		var err error
-		logs, err = DeploymentLogger.GetLogs(update.ID)
-		if err != nil {
-			log.Errorf("Failed to get deployment logs for deployment [%v]: %v",
-				update.ID, err)
-			// there is nothing more we can do here
-			return NewFatalError(errors.New("can not get deployment logs from file"))
-		}
+	c Controller) menderError {
+	// make sure the logs can be read before trying to send them
+	logs, err := DeploymentLogger.OpenLogs(update.ID)
+	if err != nil {
+		log.Errorf("Failed to get deployment logs for deployment [%v]: %v",
+			update.ID, err)
+		// there is nothing more we can do here
+		return NewFatalError(errors.New("can not get deployment logs from file"))
 	}
+	logs.Close()
 
 	*sentTries++
 
-	if err := c.UploadLog(update, logs); err != nil {
+	openLogs := func() (io.ReadCloser, error) {
+		return DeploymentLogger.OpenLogs(update.ID)
+	}
+	if err := c.UploadLog(update, openLogs); err != nil {
 		// we got error while sending deployment logs to server;
 		log.Errorf("Failed to report deployment logs: %v", err)
 		return NewTransientError(errors.Wrapf(err, "failed to send deployment logs"))
@@ -1481,6 +1484,10 @@ func (usr *updateStatusReportState) Handle(ctx *StateContext, c Controller) (Sta
 
 	log.Debug("Handling update status report state")
 
+	if usr.triesSendingReport == 0 {
+		finishUpdateMetrics()
+	}
+
 	if err := sendDeploymentStatus(usr.Update(), usr.status,
 		&usr.triesSendingReport, c); err != nil {
 
@@ -1497,7 +1504,7 @@ func (usr *updateStatusReportState) Handle(ctx *StateContext, c Controller) (Sta
 	if usr.status == client.StatusFailure {
 		log.Debugf("Attempting to upload deployment logs for failed update")
 		if err := sendDeploymentLogs(usr.Update(),
-			&usr.triesSendingLogs, usr.logs, c); err != nil {
+			&usr.triesSendingLogs, c); err != nil {
 
 			log.Errorf("Failed to send deployment logs to server: %v", err)
 			if err.IsFatal() {
@@ -1675,6 +1682,10 @@ func (e *updateRebootState) Handle(ctx *StateContext, c Controller) (State, bool
 
 	if systemRebootRequested {
 		// Final system reboot after reboot scripts have run.
+		_ = DeploymentLogger.Flush()
+		if err := SaveUpdateMetrics(); err != nil {
+			log.Errorf("Failed to save the update metrics: %v", err)
+		}
 		err := ctx.Rebooter.Reboot()
 		// Should never return from Reboot().
 		return e.HandleError(ctx, c, NewTransientError(errors.Wrap(err, "Could not reboot host")))
@@ -1884,6 +1895,10 @@ func (rs *updateRollbackRebootState) Handle(ctx *StateContext, c Controller) (St
 
 	if systemRebootRequested {
 		// Final system reboot after reboot scripts have run.
+		_ = DeploymentLogger.Flush()
+		if err := SaveUpdateMetrics(); err != nil {
+			log.Errorf("Failed to save the update metrics: %v", err)
+		}
 		err := ctx.Rebooter.Reboot()
 		// Should never return from Reboot().
 		return rs.HandleError(ctx, c, NewTransientError(errors.Wrap(err, "Could not reboot host")))
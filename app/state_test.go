@@ -147,9 +147,20 @@ func (s *stateTestController) ReportUpdateStatus(
 	return s.reportError
 }
 
-func (s *stateTestController) UploadLog(update *datastore.UpdateInfo, logs []byte) menderError {
+func (s *stateTestController) UploadLog(
+	update *datastore.UpdateInfo,
+	logs func() (io.ReadCloser, error),
+) menderError {
 	s.logUpdate = *update
-	s.logs = logs
+	r, err := logs()
+	if err != nil {
+		return NewFatalError(err)
+	}
+	defer r.Close()
+	s.logs, err = ioutil.ReadAll(r)
+	if err != nil {
+		return NewFatalError(err)
+	}
 	return s.logSendingError
 }
 
@@ -1064,7 +1075,9 @@ func TestStateData(t *testing.T) {
 	// test if data marshalling works fine
 	data, err := ms.ReadAll(datastore.StateDataKey)
 	assert.NoError(t, err)
-	assert.Contains(t, string(data), `"Name":"init"`)
+	decoded, err := datastore.DecodeStateData(data)
+	assert.NoError(t, err)
+	assert.Equal(t, datastore.MenderStateInit, decoded.Name)
 
 	sd.Version = 999
 	err = datastore.StoreStateData(ms, sd, true)
@@ -1138,7 +1151,10 @@ func (m *menderWithCustomUpdater) FetchUpdate(url string) (io.ReadCloser, int64,
 	return m.updater.FetchUpdate(nil, url)
 }
 
-func (m *menderWithCustomUpdater) UploadLog(update *datastore.UpdateInfo, logs []byte) menderError {
+func (m *menderWithCustomUpdater) UploadLog(
+	update *datastore.UpdateInfo,
+	logs func() (io.ReadCloser, error),
+) menderError {
 	return nil
 }
 
@@ -5204,7 +5220,7 @@ func TestDBSchemaUpdate(t *testing.T) {
 	// Check manually for both.
 	data, err := db.ReadAll(datastore.StateDataKeyUncommitted)
 	require.NoError(t, err)
-	err = json.Unmarshal(data, &sd)
+	sd, err = datastore.DecodeStateData(data)
 	require.NoError(t, err)
 
 	assert.Equal(t, "abc", sd.UpdateInfo.ID)
@@ -5214,7 +5230,7 @@ func TestDBSchemaUpdate(t *testing.T) {
 
 	data, err = db.ReadAll(datastore.StateDataKey)
 	require.NoError(t, err)
-	err = json.Unmarshal(data, &sd)
+	sd, err = datastore.DecodeStateData(data)
 	require.NoError(t, err)
 
 	assert.Equal(t, "abc", sd.UpdateInfo.ID)
@@ -5246,7 +5262,7 @@ func TestDBSchemaUpdate(t *testing.T) {
 
 	data, err = db.ReadAll(datastore.StateDataKeyUncommitted)
 	require.NoError(t, err)
-	err = json.Unmarshal(data, &sd)
+	sd, err = datastore.DecodeStateData(data)
 	require.NoError(t, err)
 
 	assert.Equal(t, "def", sd.UpdateInfo.ID)
@@ -5256,7 +5272,7 @@ func TestDBSchemaUpdate(t *testing.T) {
 
 	data, err = db.ReadAll(datastore.StateDataKey)
 	require.NoError(t, err)
-	err = json.Unmarshal(data, &sd)
+	sd, err = datastore.DecodeStateData(data)
 	require.NoError(t, err)
 
 	assert.Equal(t, "abc", sd.UpdateInfo.ID)
@@ -5289,7 +5305,7 @@ func TestDBSchemaUpdate(t *testing.T) {
 
 	data, err = db.ReadAll(datastore.StateDataKey)
 	require.NoError(t, err)
-	err = json.Unmarshal(data, &sd)
+	sd, err = datastore.DecodeStateData(data)
 	require.NoError(t, err)
 
 	assert.Equal(t, "abc", sd.UpdateInfo.ID)
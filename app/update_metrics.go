@@ -0,0 +1,96 @@
+// Copyright 2023 Northern.tech AS
+//
+//    Licensed under the Apache License, Version 2.0 (the "License");
+//    you may not use this file except in compliance with the License.
+//    You may obtain a copy of the License at
+//
+//        http://www.apache.org/licenses/LICENSE-2.0
+//
+//    Unless required by applicable law or agreed to in writing, software
+//    distributed under the License is distributed on an "AS IS" BASIS,
+//    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//    See the License for the specific language governing permissions and
+//    limitations under the License.
+package app
+
+import (
+	"encoding/json"
+	"io/ioutil"
+	"os"
+
+	log "github.com/sirupsen/logrus"
+
+	"github.com/mendersoftware/mender/utils"
+)
+
+// UpdateMetricsFileName is the name of the file, in the data store
+// directory, which holds the JSON report of the update metrics of the current,
+// or last, deployment.
+const UpdateMetricsFileName = "update-metrics.json"
+
+// Global update metrics file; no metrics are saved if it is empty.
+var UpdateMetricsFile string
+
+// SaveUpdateMetrics writes the report of utils.Metrics to UpdateMetricsFile,
+// so that it is kept across reboots, and after the deployment.
+func SaveUpdateMetrics() error {
+	if UpdateMetricsFile == "" {
+		return nil
+	}
+	data, err := json.Marshal(utils.Metrics)
+	if err != nil {
+		return err
+	}
+	tmp := UpdateMetricsFile + ".tmp"
+	f, err := os.OpenFile(tmp, os.O_WRONLY|os.O_CREATE|os.O_TRUNC, 0600)
+	if err != nil {
+		return err
+	}
+	_, err = f.Write(data)
+	if err == nil {
+		// So that the rename never leaves an empty file behind after
+		// a power loss.
+		err = f.Sync()
+	}
+	if closeErr := f.Close(); err == nil {
+		err = closeErr
+	}
+	if err != nil {
+		return err
+	}
+	return os.Rename(tmp, UpdateMetricsFile)
+}
+
+// RestoreUpdateMetrics continues counting the update metrics from
+// UpdateMetricsFile, if there is one.
+func RestoreUpdateMetrics() {
+	if UpdateMetricsFile == "" {
+		return
+	}
+	data, err := ioutil.ReadFile(UpdateMetricsFile)
+	if os.IsNotExist(err) {
+		return
+	} else if err != nil {
+		log.Warnf("Failed to read the update metrics: %v", err)
+		return
+	}
+	var report utils.UpdateMetricsReport
+	if err = json.Unmarshal(data, &report); err != nil {
+		log.Warnf("Failed to parse the update metrics: %v", err)
+		return
+	}
+	utils.Metrics.Restore(&report)
+}
+
+// finishUpdateMetrics stops counting, and logs and saves the update metrics at
+// the end of a deployment.
+func finishUpdateMetrics() {
+	utils.Metrics.End()
+	data, err := json.Marshal(utils.Metrics)
+	if err == nil {
+		log.Infof("Update metrics: %s", data)
+	}
+	if err = SaveUpdateMetrics(); err != nil {
+		log.Errorf("Failed to save the update metrics: %v", err)
+	}
+}
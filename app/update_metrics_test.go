@@ -0,0 +1,60 @@
+// Copyright 2023 Northern.tech AS
+//
+//    Licensed under the Apache License, Version 2.0 (the "License");
+//    you may not use this file except in compliance with the License.
+//    You may obtain a copy of the License at
+//
+//        http://www.apache.org/licenses/LICENSE-2.0
+//
+//    Unless required by applicable law or agreed to in writing, software
+//    distributed under the License is distributed on an "AS IS" BASIS,
+//    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//    See the License for the specific language governing permissions and
+//    limitations under the License.
+package app
+
+import (
+	"io/ioutil"
+	"os"
+	"path"
+	"testing"
+	"time"
+
+	"github.com/stretchr/testify/assert"
+	"github.com/stretchr/testify/require"
+
+	"github.com/mendersoftware/mender/utils"
+)
+
+func TestSaveRestoreUpdateMetrics(t *testing.T) {
+	td, err := ioutil.TempDir("", "mender-update-metrics")
+	require.NoError(t, err)
+	defer os.RemoveAll(td)
+
+	oldFile := UpdateMetricsFile
+	defer func() { UpdateMetricsFile = oldFile }()
+
+	// Nothing is saved without a file.
+	UpdateMetricsFile = ""
+	assert.NoError(t, SaveUpdateMetrics())
+
+	UpdateMetricsFile = path.Join(td, UpdateMetricsFileName)
+	utils.Metrics.Begin("metrics-deployment")
+	utils.Metrics.Add(utils.StageWrite, 1024, time.Second)
+	require.NoError(t, SaveUpdateMetrics())
+	_, err = os.Stat(UpdateMetricsFile + ".tmp")
+	assert.True(t, os.IsNotExist(err))
+
+	// As after a reboot.
+	utils.Metrics.Begin("other-deployment")
+	RestoreUpdateMetrics()
+	report := utils.Metrics.Report()
+	assert.Equal(t, "metrics-deployment", report.DeploymentID)
+	assert.Equal(t, int64(1024), report.Stages["write"].Bytes)
+
+	// A broken file is ignored.
+	require.NoError(t, ioutil.WriteFile(UpdateMetricsFile, []byte("{"), 0600))
+	utils.Metrics.Begin("other-deployment")
+	RestoreUpdateMetrics()
+	assert.Equal(t, "other-deployment", utils.Metrics.Report().DeploymentID)
+}
@@ -31,10 +31,12 @@ import (
 	"github.com/mendersoftware/mender/datastore"
 	"github.com/mendersoftware/mender/dbus"
 	"github.com/mendersoftware/mender/store"
+	"github.com/mendersoftware/mender/utils"
 )
 
 const (
 	updateManagerSetUpdateControlMap = "SetUpdateControlMap"
+	updateManagerGetUpdateMetrics    = "GetUpdateMetrics"
 	UpdateManagerDBusPath            = "/io/mender/UpdateManager"
 	UpdateManagerDBusObjectName      = "io.mender.UpdateManager"
 	UpdateManagerDBusInterfaceName   = "io.mender.Update1"
@@ -45,6 +47,9 @@ const (
 		  <arg type="s" name="update_control_map" direction="in"/>
 		  <arg type="i" name="refresh_timeout" direction="out"/>
 		</method>
+		<method name="GetUpdateMetrics">
+		  <arg type="s" name="update_metrics" direction="out"/>
+		</method>
 	      </interface>
 	    </node>`
 )
@@ -147,6 +152,22 @@ func (u *UpdateManager) run(ctx context.Context) error {
 		UpdateManagerDBusPath,
 		UpdateManagerDBusInterfaceName,
 		updateManagerSetUpdateControlMap)
+
+	u.dbus.RegisterMethodCallCallback(
+		UpdateManagerDBusPath,
+		UpdateManagerDBusInterfaceName,
+		updateManagerGetUpdateMetrics,
+		func(_ string, _ string, _ string, _ string) (interface{}, error) {
+			data, err := json.Marshal(utils.Metrics)
+			if err != nil {
+				return "", err
+			}
+			return string(data), nil
+		})
+	defer u.dbus.UnregisterMethodCallCallback(
+		UpdateManagerDBusPath,
+		UpdateManagerDBusInterfaceName,
+		updateManagerGetUpdateMetrics)
 	<-ctx.Done()
 	return nil
 }
@@ -329,7 +350,9 @@ func (c *ControlMapPool) saveToStore() {
 	)
 
 	if len(active) == 0 && len(expired) == 0 {
-		err := c.store.Remove(datastore.UpdateControlMaps)
+		// Control maps are refreshed from the server, so losing
+		// the latest change on power loss is harmless.
+		err := store.RemoveDeferred(c.store, datastore.UpdateControlMaps)
 		if err != nil {
 			log.Errorf("Could not save Update Control Maps to database: %s", err.Error())
 			// There isn't much we can do if it fails.
@@ -353,7 +376,7 @@ func (c *ControlMapPool) saveToStore() {
 
 	log.Debugf("Saving Update Control Maps to disk: %q", string(data))
 
-	err = c.store.WriteAll(datastore.UpdateControlMaps, data)
+	err = store.WriteAllDeferred(c.store, datastore.UpdateControlMaps, data)
 	if err != nil {
 		log.Errorf("Could not save Update Control Maps to database: %s", err.Error())
 		// There isn't much we can do if it fails.
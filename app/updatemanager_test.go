@@ -97,6 +97,19 @@ func setupTestUpdateManager() dbus.DBusAPI {
 		updateManagerSetUpdateControlMap,
 	)
 
+	dbusAPI.On("RegisterMethodCallCallback",
+		UpdateManagerDBusPath,
+		UpdateManagerDBusInterfaceName,
+		updateManagerGetUpdateMetrics,
+		mock.Anything,
+	)
+
+	dbusAPI.On("UnregisterMethodCallCallback",
+		UpdateManagerDBusPath,
+		UpdateManagerDBusInterfaceName,
+		updateManagerGetUpdateMetrics,
+	)
+
 	dbusAPI.On("BusUnregisterInterface",
 		dbusConn,
 		uint(2),
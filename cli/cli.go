@@ -343,9 +343,20 @@ func SetupCLI(args []string) error {
 							Name:    "compression",
 							Aliases: []string{"C"},
 							Usage: "Compression type to use on the" +
-								"rootfs snapshot {none,gzip}",
+								"rootfs snapshot {none,gzip,zstd}",
 							Value: "none",
 						},
+						&cli.BoolFlag{
+							Name: "sparse",
+							Usage: "Skip the free " +
+								"blocks of ext2/3/4 " +
+								"filesystems, and " +
+								"holes in files, " +
+								"and write them as " +
+								"zeros, or as holes " +
+								"if the output is a " +
+								"file",
+						},
 					},
 				},
 			},
@@ -501,6 +512,8 @@ func (runOptions *runOptionsType) handleCLIOptions(ctx *cli.Context) error {
 	}
 
 	app.DeploymentLogger = app.NewDeploymentLogManager(runOptions.dataStore)
+	app.UpdateMetricsFile = path.Join(runOptions.dataStore, app.UpdateMetricsFileName)
+	app.RestoreUpdateMetrics()
 
 	// Handle possible bootstrap Artifact for CLI commands that need the artifact name or
 	// provides. "commit" and "rollback" are omitted - by design, they assume "install" have
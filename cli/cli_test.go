@@ -113,7 +113,7 @@ func TestRunDaemon(t *testing.T) {
 	pieces := app.MenderPieces{
 		Store: store.NewMemStore(),
 		DualRootfsDevice: installer.NewDualRootfsDevice(
-			nil, nil, conf.DualRootfsDeviceConfig{}),
+			nil, nil, conf.DualRootfsDeviceConfig{}, nil),
 	}
 
 	pieces.AuthManager = app.NewAuthManager(app.AuthManagerConfig{
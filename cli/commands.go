@@ -67,12 +67,15 @@ var (
 	)
 )
 
-func initDualRootfsDevice(config *conf.MenderConfig) installer.DualRootfsDevice {
+func initDualRootfsDevice(
+	config *conf.MenderConfig,
+	dbstore store.Store,
+) installer.DualRootfsDevice {
 	env := installer.NewEnvironment(new(system.OsCalls), config.BootUtilitiesSetActivePart,
 		config.BootUtilitiesGetNextActivePart)
 
 	dualRootfsDevice := installer.NewDualRootfsDevice(
-		env, new(system.OsCalls), config.GetDeviceConfig())
+		env, new(system.OsCalls), config.GetDeviceConfig(), dbstore)
 	if dualRootfsDevice == nil {
 		log.Info("No dual rootfs configuration present")
 	} else {
@@ -143,6 +146,11 @@ func commonInit(
 	if dbstore == nil {
 		return nil, nil, errors.New("failed to initialize DB store")
 	}
+	if err := dbstore.EnableGroupCommit(config.GetDBGroupCommitDelay()); err != nil {
+		// close DB store explicitly
+		dbstore.Close()
+		return nil, nil, errors.Wrap(err, "failed to configure DB group commit")
+	}
 
 	authmgr := app.NewAuthManager(app.AuthManagerConfig{
 		AuthDataStore:  dbstore,
@@ -172,7 +180,7 @@ func commonInit(
 		AuthManager: authmgr,
 	}
 
-	mp.DualRootfsDevice = initDualRootfsDevice(config)
+	mp.DualRootfsDevice = initDualRootfsDevice(config, dbstore)
 
 	m, err := app.NewMender(config, mp)
 	if err != nil {
@@ -246,7 +254,7 @@ func handleArtifactOperations(ctx *cli.Context, runOptions runOptionsType,
 		return errors.New("failed to initialize DB store")
 	}
 
-	dualRootfsDevice := initDualRootfsDevice(config)
+	dualRootfsDevice := initDualRootfsDevice(config, dbstore)
 
 	stateExec := dev.NewStateScriptExecutor(config)
 	deviceManager := dev.NewDeviceManager(dualRootfsDevice, config, dbstore)
@@ -14,7 +14,6 @@
 package cli
 
 import (
-	"compress/gzip"
 	"fmt"
 	"io"
 	"os"
@@ -56,12 +55,21 @@ const (
 	wdtIntervalSec = 30
 
 	// bufferSize for the Copy function
-	bufferSize = 32 * 1024
+	bufferSize = 1024 * 1024
 )
 
 type snapshot struct {
 	src io.ReadCloser
 	dst io.WriteCloser
+	// Set if dst compresses its input, which must be flushed by closing
+	// it, before the snapshot is complete.
+	compressor io.WriteCloser
+	// If set, regions which the filesystem on the source reports as free,
+	// or which are holes in a source file, are not read, but written as
+	// zeros, or as holes if the output is an uncompressed regular file.
+	sparse bool
+	// Number of compression workers. Defaults to the number of CPUs.
+	workers int
 	// The FIFREEZE ioctl requires that the file descriptor points to a
 	// directory
 	freezeDir *os.File
@@ -101,7 +109,7 @@ func (runOpts *runOptionsType) DumpSnapshot(ctx *cli.Context) error {
 func CopySnapshot(ctx *cli.Context, dst io.WriteCloser) error {
 	var err error
 	srcPath := ctx.String("source")
-	ss := &snapshot{dst: dst}
+	ss := &snapshot{dst: dst, sparse: ctx.Bool("sparse")}
 	defer ss.cleanup()
 
 	// Ensure we don't write logs to the filesystem
@@ -149,6 +157,11 @@ func CopySnapshot(ctx *cli.Context, dst io.WriteCloser) error {
 			log.Warnf("Failed to freeze filesystem on %s: %s",
 				srcDev.MountSource, err.Error())
 			log.Warn("The snapshot might become invalid.")
+			if ss.sparse {
+				// The free blocks may change while copying.
+				log.Warn("Ignoring --sparse on a filesystem which is not frozen.")
+				ss.sparse = false
+			}
 		}
 	}
 
@@ -197,11 +210,19 @@ func (ss *snapshot) init(
 func (ss *snapshot) assignCompression(compression string) error {
 	var err error
 
+	workers := ss.workers
+	if workers <= 0 {
+		workers = defaultCompressionWorkers()
+	}
+
 	switch compression {
 	case "none":
 
 	case "gzip":
-		ss.dst = gzip.NewWriter(ss.dst)
+		ss.compressor = newGzipCompressor(ss.dst, workers)
+
+	case "zstd":
+		ss.compressor, err = newZstdCompressor(ss.dst, workers)
 
 	case "lzma":
 		err = errors.New("lzma compression is not implemented for " +
@@ -211,6 +232,9 @@ func (ss *snapshot) assignCompression(compression string) error {
 		err = errors.Errorf("Unknown compression '%s'", compression)
 
 	}
+	if ss.compressor != nil {
+		ss.dst = ss.compressor
+	}
 	return err
 }
 
@@ -403,8 +427,26 @@ func (ss *snapshot) Do() (retErr error) {
 	}()
 
 	buf := make([]byte, bufferSize)
+	var err error
+	if src, ok := ss.src.(*os.File); ok && ss.sparse {
+		err = ss.copySparse(buf, src)
+	} else {
+		err = ss.copy(buf, ss.src)
+	}
+	if err != nil {
+		return err
+	}
+	if ss.compressor != nil {
+		// Flush the last blocks while the watchdog is still running.
+		return ss.compressor.Close()
+	}
+	return nil
+}
+
+// copy copies src to dst, until src returns EOF.
+func (ss *snapshot) copy(buf []byte, src io.Reader) error {
 	for {
-		n, err := copyChunk(buf, ss.src, ss.dst)
+		n, err := copyChunk(buf, src, ss.dst)
 		if err == io.EOF {
 			break
 		} else if n < 0 {
@@ -412,15 +454,170 @@ func (ss *snapshot) Do() (retErr error) {
 		} else if err != nil {
 			return err
 		}
-		if ss.wdt != nil {
-			ss.wdt.request <- wdtPing
-			err = <-ss.wdt.response
+		if err = ss.tick(n); err != nil {
+			return err
 		}
+	}
+	return nil
+}
+
+// tick pings the watchdog and updates the progressbar after 'n' bytes have
+// been copied.
+func (ss *snapshot) tick(n int) error {
+	if ss.wdt != nil {
+		ss.wdt.request <- wdtPing
+		if err := <-ss.wdt.response; err != nil {
+			return err
+		}
+	}
+	if ss.pb != nil {
+		ss.pb.Tick(uint64(n))
+	}
+	return nil
+}
+
+// allocationMap reports which regions of a snapshot source hold data.
+type allocationMap interface {
+	// nextData returns the first region of data at or after 'offset', or
+	// 'data' equal to the size of the source if there is none.
+	nextData(offset int64) (data int64, end int64, err error)
+}
+
+// seekDataMap reports the regions of a file which are not holes, through
+// SEEK_DATA/SEEK_HOLE.
+type seekDataMap struct {
+	fd   int
+	size int64
+}
+
+func (m *seekDataMap) nextData(offset int64) (int64, int64, error) {
+	data, err := unix.Seek(m.fd, offset, unix.SEEK_DATA)
+	if err == unix.ENXIO {
+		// Only a hole remains.
+		return m.size, m.size, nil
+	} else if err != nil {
+		return 0, 0, err
+	}
+	hole, err := unix.Seek(m.fd, data, unix.SEEK_HOLE)
+	if err != nil {
+		hole = m.size
+	}
+	return data, hole, nil
+}
+
+// allocationMap returns the allocation map of src, of 'size' bytes: the block
+// bitmaps of the filesystem on it, if it holds an ext2/3/4 filesystem, and
+// the holes otherwise. Block-devices do not report holes, so unless the
+// filesystem is supported they are copied in full.
+func (ss *snapshot) allocationMap(src *os.File, size int64) (allocationMap, error) {
+	m, err := readExt4BlockMap(src, size)
+	if err == nil {
+		return m, nil
+	}
+	log.Debugf("Not reading the filesystem allocation map: %s", err.Error())
+
+	info, err := src.Stat()
+	if err != nil {
+		return nil, err
+	}
+	if !info.Mode().IsRegular() {
+		return nil, errors.New("no supported filesystem on the source")
+	}
+	return &seekDataMap{fd: int(src.Fd()), size: size}, nil
+}
+
+// copySparse copies src to dst, without reading the regions which
+// allocationMap reports as unused. If it reports nothing, src is copied in
+// full.
+func (ss *snapshot) copySparse(buf []byte, src *os.File) error {
+	size, err := src.Seek(0, io.SeekEnd)
+	if err != nil {
+		return errors.Wrap(err, "unable to get source size")
+	}
+	if _, err = src.Seek(0, io.SeekStart); err != nil {
+		return err
+	}
+
+	// Holes are preserved in uncompressed regular files, anything else
+	// gets zeros.
+	var dstFile *os.File
+	var dstStart int64
+	if f, ok := ss.dst.(*os.File); ok && ss.compressor == nil {
+		if info, err := f.Stat(); err == nil && info.Mode().IsRegular() {
+			if dstStart, err = f.Seek(0, io.SeekCurrent); err == nil {
+				dstFile = f
+			}
+		}
+	}
+	holes := false
+
+	amap, err := ss.allocationMap(src, size)
+	if err != nil {
+		log.Infof("Copying the whole source: %s", err.Error())
+		return ss.copy(buf, src)
+	}
+
+	var offset int64
+	for offset < size {
+		data, end, err := amap.nextData(offset)
 		if err != nil {
+			log.Debugf("Source does not report unused regions: %s", err.Error())
+			if _, err = src.Seek(offset, io.SeekStart); err != nil {
+				return err
+			}
+			return ss.copy(buf, src)
+		}
+		if data > offset {
+			if err = ss.skipHole(buf, dstFile, data-offset); err != nil {
+				return err
+			}
+			holes = dstFile != nil
+		}
+		if data >= size {
+			break
+		}
+
+		if _, err = src.Seek(data, io.SeekStart); err != nil {
+			return err
+		}
+		if err = ss.copy(buf, io.LimitReader(src, end-data)); err != nil {
+			return err
+		}
+		offset = end
+	}
+
+	if holes {
+		// Extend the output in case it ends in a hole.
+		return dstFile.Truncate(dstStart + size)
+	}
+	return nil
+}
+
+// skipHole emits 'length' bytes of zeros to dst, as a hole if dstFile is
+// set.
+func (ss *snapshot) skipHole(buf []byte, dstFile *os.File, length int64) error {
+	if dstFile != nil {
+		if _, err := dstFile.Seek(length, io.SeekCurrent); err != nil {
+			return err
+		}
+		return ss.tick(int(length))
+	}
+
+	zeros := buf[:cap(buf)]
+	for i := range zeros {
+		zeros[i] = 0
+	}
+	for length > 0 {
+		chunk := zeros
+		if length < int64(len(chunk)) {
+			chunk = chunk[:length]
+		}
+		if _, err := ss.dst.Write(chunk); err != nil {
 			return err
 		}
-		if ss.pb != nil {
-			ss.pb.Tick(uint64(n))
+		length -= int64(len(chunk))
+		if err := ss.tick(len(chunk)); err != nil {
+			return err
 		}
 	}
 	return nil
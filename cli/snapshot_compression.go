@@ -0,0 +1,245 @@
+// Copyright 2023 Northern.tech AS
+//
+//    Licensed under the Apache License, Version 2.0 (the "License");
+//    you may not use this file except in compliance with the License.
+//    You may obtain a copy of the License at
+//
+//        http://www.apache.org/licenses/LICENSE-2.0
+//
+//    Unless required by applicable law or agreed to in writing, software
+//    distributed under the License is distributed on an "AS IS" BASIS,
+//    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//    See the License for the specific language governing permissions and
+//    limitations under the License.
+package cli
+
+import (
+	"compress/gzip"
+	"io"
+	"runtime"
+	"sync"
+
+	"github.com/klauspost/compress/zstd"
+	"github.com/pkg/errors"
+)
+
+const (
+	// compressionBlockSize is the amount of input compressed
+	// independently by each worker.
+	compressionBlockSize = 1024 * 1024
+	// Number of blocks in flight per worker.
+	compressionBlocksPerWorker = 2
+)
+
+// blockEncoder compresses 'src' into a self-contained stream, appended to
+// 'dst'. Each worker has its own blockEncoder.
+type blockEncoder func(dst, src []byte) ([]byte, error)
+
+// compressionBlock is one block of input, and its compressed output.
+type compressionBlock struct {
+	in   []byte
+	out  []byte
+	err  error
+	done chan struct{}
+}
+
+// parallelCompressor is a WriteCloser which splits its input into blocks,
+// compresses them on all cores, and writes the compressed blocks to 'dst' in
+// order. Both gzip members and zstd frames can be concatenated, so the output
+// decompresses as one stream.
+type parallelCompressor struct {
+	dst io.Writer
+
+	// Blocks handed to the workers, and the same blocks in input order,
+	// for the writer.
+	work  chan *compressionBlock
+	order chan *compressionBlock
+	free  chan *compressionBlock
+
+	current *compressionBlock
+
+	workers sync.WaitGroup
+	writer  sync.WaitGroup
+	// First error of the writer goroutine. Only read after 'writer' is
+	// done, or through failed().
+	errLock sync.Mutex
+	err     error
+
+	closeEncoders func() error
+	submitted     bool
+	closed        bool
+}
+
+func newParallelCompressor(
+	dst io.Writer,
+	workers int,
+	blockSize int,
+	newEncoder func() blockEncoder,
+	closeEncoders func() error,
+) *parallelCompressor {
+	if workers < 1 {
+		workers = 1
+	}
+	blocks := workers * compressionBlocksPerWorker
+	pc := &parallelCompressor{
+		dst:           dst,
+		work:          make(chan *compressionBlock, blocks),
+		order:         make(chan *compressionBlock, blocks),
+		free:          make(chan *compressionBlock, blocks),
+		closeEncoders: closeEncoders,
+	}
+	for i := 0; i < blocks; i++ {
+		pc.free <- &compressionBlock{
+			in:   make([]byte, 0, blockSize),
+			done: make(chan struct{}, 1),
+		}
+	}
+
+	pc.workers.Add(workers)
+	for i := 0; i < workers; i++ {
+		go pc.compress(newEncoder())
+	}
+	pc.writer.Add(1)
+	go pc.write()
+	return pc
+}
+
+// newZstdCompressor returns a compressor writing concatenated zstd frames.
+func newZstdCompressor(dst io.Writer, workers int) (*parallelCompressor, error) {
+	enc, err := zstd.NewWriter(nil, zstd.WithEncoderConcurrency(workers))
+	if err != nil {
+		return nil, errors.Wrap(err, "failed to create zstd encoder")
+	}
+	return newParallelCompressor(dst, workers, compressionBlockSize,
+		func() blockEncoder {
+			return func(dst, src []byte) ([]byte, error) {
+				return enc.EncodeAll(src, dst), nil
+			}
+		},
+		enc.Close), nil
+}
+
+// appendWriter is a Writer appending to a reusable slice.
+type appendWriter struct {
+	buf []byte
+}
+
+func (w *appendWriter) Write(p []byte) (int, error) {
+	w.buf = append(w.buf, p...)
+	return len(p), nil
+}
+
+// newGzipCompressor returns a compressor writing concatenated gzip members.
+func newGzipCompressor(dst io.Writer, workers int) *parallelCompressor {
+	return newParallelCompressor(dst, workers, compressionBlockSize,
+		func() blockEncoder {
+			aw := &appendWriter{}
+			gw := gzip.NewWriter(aw)
+			return func(dst, src []byte) ([]byte, error) {
+				aw.buf = dst
+				gw.Reset(aw)
+				if _, err := gw.Write(src); err != nil {
+					return dst, err
+				}
+				err := gw.Close()
+				return aw.buf, err
+			}
+		},
+		nil)
+}
+
+func defaultCompressionWorkers() int {
+	return runtime.GOMAXPROCS(0)
+}
+
+func (pc *parallelCompressor) compress(encode blockEncoder) {
+	defer pc.workers.Done()
+	for block := range pc.work {
+		block.out, block.err = encode(block.out[:0], block.in)
+		block.done <- struct{}{}
+	}
+}
+
+func (pc *parallelCompressor) write() {
+	defer pc.writer.Done()
+	for block := range pc.order {
+		<-block.done
+		err := block.err
+		if err == nil && pc.failed() == nil {
+			_, err = pc.dst.Write(block.out)
+		}
+		if err != nil {
+			pc.errLock.Lock()
+			if pc.err == nil {
+				pc.err = err
+			}
+			pc.errLock.Unlock()
+		}
+		block.in = block.in[:0]
+		pc.free <- block
+	}
+}
+
+func (pc *parallelCompressor) failed() error {
+	pc.errLock.Lock()
+	defer pc.errLock.Unlock()
+	return pc.err
+}
+
+// submit hands the current block to the workers.
+func (pc *parallelCompressor) submit() {
+	pc.order <- pc.current
+	pc.work <- pc.current
+	pc.current = nil
+	pc.submitted = true
+}
+
+func (pc *parallelCompressor) Write(p []byte) (int, error) {
+	if pc.closed {
+		return 0, errors.New("write to closed compressor")
+	}
+	written := 0
+	for len(p) > 0 {
+		if err := pc.failed(); err != nil {
+			return written, err
+		}
+		if pc.current == nil {
+			pc.current = <-pc.free
+		}
+		block := pc.current
+		n := copy(block.in[len(block.in):cap(block.in)], p)
+		block.in = block.in[:len(block.in)+n]
+		p = p[n:]
+		written += n
+		if len(block.in) == cap(block.in) {
+			pc.submit()
+		}
+	}
+	return written, nil
+}
+
+// Close compresses the remaining input, and waits for all of it to be
+// written. It does not close 'dst'.
+func (pc *parallelCompressor) Close() error {
+	if pc.closed {
+		return pc.err
+	}
+	pc.closed = true
+	if !pc.submitted && pc.current == nil {
+		// Even empty input must result in a valid stream.
+		pc.current = <-pc.free
+	}
+	if pc.current != nil && (len(pc.current.in) > 0 || !pc.submitted) {
+		pc.submit()
+	}
+	close(pc.work)
+	close(pc.order)
+	pc.workers.Wait()
+	pc.writer.Wait()
+	if pc.closeEncoders != nil {
+		if err := pc.closeEncoders(); err != nil && pc.err == nil {
+			pc.err = err
+		}
+	}
+	return pc.err
+}
@@ -0,0 +1,194 @@
+// Copyright 2023 Northern.tech AS
+//
+//    Licensed under the Apache License, Version 2.0 (the "License");
+//    you may not use this file except in compliance with the License.
+//    You may obtain a copy of the License at
+//
+//        http://www.apache.org/licenses/LICENSE-2.0
+//
+//    Unless required by applicable law or agreed to in writing, software
+//    distributed under the License is distributed on an "AS IS" BASIS,
+//    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//    See the License for the specific language governing permissions and
+//    limitations under the License.
+package cli
+
+import (
+	"encoding/binary"
+	"io"
+
+	"github.com/pkg/errors"
+)
+
+// On-disk layout of the ext2/3/4 superblock and group descriptors, from
+// the kernel's fs/ext4/ext4.h.
+const (
+	ext4SuperblockOffset = 1024
+	ext4SuperblockSize   = 1024
+	ext4Magic            = 0xEF53
+
+	ext4FeatureIncompatRecover  = 0x0004
+	ext4FeatureIncompatMetaBG   = 0x0010
+	ext4FeatureIncompat64Bit    = 0x0080
+	ext4FeatureRoCompatBigalloc = 0x0200
+
+	ext4BlockGroupBlockUninit = 0x0002
+
+	ext4MinDescSize   = 32
+	ext4MinDescSize64 = 64
+)
+
+// ext4BlockMap is the block allocation map of an ext2, ext3 or ext4
+// filesystem, read from the block bitmaps of its groups.
+type ext4BlockMap struct {
+	// Bytes before the first group, and after the last one, are always
+	// copied.
+	start int64
+	end   int64
+	// A cluster is a block, unless the filesystem uses bigalloc.
+	clusterSize      int64
+	clustersPerGroup int64
+	// The block bitmap of each group; nil if the group has no bitmap on
+	// disk yet, in which case it is copied in full.
+	bitmaps [][]byte
+	// Size of the source.
+	size int64
+}
+
+// readExt4BlockMap reads the block bitmaps of the filesystem on 'dev', of
+// 'size' bytes. The filesystem must not change meanwhile, so it must either be
+// frozen, or not mounted.
+func readExt4BlockMap(dev io.ReaderAt, size int64) (*ext4BlockMap, error) {
+	sb := make([]byte, ext4SuperblockSize)
+	if _, err := dev.ReadAt(sb, ext4SuperblockOffset); err != nil {
+		return nil, errors.Wrap(err, "unable to read the superblock")
+	}
+	le := binary.LittleEndian
+	if le.Uint16(sb[0x38:]) != ext4Magic {
+		return nil, errors.New("not an ext2/3/4 filesystem")
+	}
+
+	incompat := le.Uint32(sb[0x60:])
+	roCompat := le.Uint32(sb[0x64:])
+	if incompat&ext4FeatureIncompatRecover != 0 {
+		// The journal holds changes which are not in the bitmaps yet.
+		return nil, errors.New("the filesystem journal needs recovery")
+	}
+	if incompat&ext4FeatureIncompatMetaBG != 0 {
+		return nil, errors.New("meta_bg filesystems are not supported")
+	}
+
+	logBlockSize := le.Uint32(sb[0x18:])
+	logClusterSize := logBlockSize
+	if roCompat&ext4FeatureRoCompatBigalloc != 0 {
+		logClusterSize = le.Uint32(sb[0x1C:])
+	}
+	if logBlockSize > 6 || logClusterSize < logBlockSize || logClusterSize > 20 {
+		return nil, errors.New("invalid block or cluster size")
+	}
+	blockSize := int64(1024) << logBlockSize
+	m := &ext4BlockMap{
+		clusterSize:      int64(1024) << logClusterSize,
+		clustersPerGroup: int64(le.Uint32(sb[0x24:])),
+		size:             size,
+	}
+
+	blocks := int64(le.Uint32(sb[0x04:]))
+	descSize := int64(ext4MinDescSize)
+	if incompat&ext4FeatureIncompat64Bit != 0 {
+		blocks |= int64(le.Uint32(sb[0x150:])) << 32
+		descSize = int64(le.Uint16(sb[0xFE:]))
+		if descSize < ext4MinDescSize64 {
+			return nil, errors.New("invalid group descriptor size")
+		}
+	}
+	firstDataBlock := int64(le.Uint32(sb[0x14:]))
+	blocksPerGroup := int64(le.Uint32(sb[0x20:]))
+	if blocksPerGroup <= 0 || m.clustersPerGroup <= 0 ||
+		m.clustersPerGroup > blockSize*8 ||
+		blocksPerGroup != m.clustersPerGroup*(m.clusterSize/blockSize) ||
+		firstDataBlock >= blocks || blocks*blockSize > size {
+		return nil, errors.New("invalid filesystem geometry")
+	}
+	m.start = firstDataBlock * blockSize
+	m.end = blocks * blockSize
+
+	groups := (blocks - firstDataBlock + blocksPerGroup - 1) / blocksPerGroup
+	// The descriptors follow the block holding the superblock.
+	descs := make([]byte, groups*descSize)
+	descBlock := ext4SuperblockOffset/blockSize + 1
+	if _, err := dev.ReadAt(descs, descBlock*blockSize); err != nil {
+		return nil, errors.Wrap(err, "unable to read the group descriptors")
+	}
+
+	m.bitmaps = make([][]byte, groups)
+	for g := range m.bitmaps {
+		desc := descs[int64(g)*descSize:]
+		if le.Uint16(desc[0x12:])&ext4BlockGroupBlockUninit != 0 {
+			// Only the metadata of the group is in use, but
+			// finding it is not worth it.
+			continue
+		}
+		bitmapBlock := int64(le.Uint32(desc[0x00:]))
+		if descSize >= ext4MinDescSize64 {
+			bitmapBlock |= int64(le.Uint32(desc[0x20:])) << 32
+		}
+		if bitmapBlock < firstDataBlock || bitmapBlock >= blocks {
+			return nil, errors.Errorf("invalid block bitmap location of group %d", g)
+		}
+		bitmap := make([]byte, (m.clustersPerGroup+7)/8)
+		if _, err := dev.ReadAt(bitmap, bitmapBlock*blockSize); err != nil {
+			return nil, errors.Wrapf(err, "unable to read the block bitmap of group %d", g)
+		}
+		m.bitmaps[g] = bitmap
+	}
+	return m, nil
+}
+
+// used reports whether cluster 'c' of the filesystem is in use.
+func (m *ext4BlockMap) used(c int64) bool {
+	bitmap := m.bitmaps[c/m.clustersPerGroup]
+	if bitmap == nil {
+		return true
+	}
+	i := c % m.clustersPerGroup
+	return bitmap[i/8]&(1<<(i%8)) != 0
+}
+
+// nextData returns the first region at or after 'offset' which is in use, or
+// 'data' equal to the size of the source if there is none.
+func (m *ext4BlockMap) nextData(offset int64) (data int64, end int64, err error) {
+	if offset < m.start || offset >= m.end {
+		return offset, m.regionEnd(offset), nil
+	}
+	clusters := (m.end - m.start + m.clusterSize - 1) / m.clusterSize
+	c := (offset - m.start) / m.clusterSize
+	for c < clusters && !m.used(c) {
+		c++
+	}
+	if c == clusters {
+		// Only free clusters remain in the filesystem.
+		return m.end, m.regionEnd(m.end), nil
+	}
+	data = m.start + c*m.clusterSize
+	if data < offset {
+		data = offset
+	}
+	for c < clusters && m.used(c) {
+		c++
+	}
+	end = m.start + c*m.clusterSize
+	if end > m.end {
+		end = m.end
+	}
+	return data, end, nil
+}
+
+// regionEnd returns the end of the region outside of the groups, which
+// starts at 'offset'.
+func (m *ext4BlockMap) regionEnd(offset int64) int64 {
+	if offset < m.start {
+		return m.start
+	}
+	return m.size
+}
@@ -0,0 +1,416 @@
+// Copyright 2023 Northern.tech AS
+//
+//    Licensed under the Apache License, Version 2.0 (the "License");
+//    you may not use this file except in compliance with the License.
+//    You may obtain a copy of the License at
+//
+//        http://www.apache.org/licenses/LICENSE-2.0
+//
+//    Unless required by applicable law or agreed to in writing, software
+//    distributed under the License is distributed on an "AS IS" BASIS,
+//    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//    See the License for the specific language governing permissions and
+//    limitations under the License.
+package cli
+
+import (
+	"bytes"
+	"compress/gzip"
+	"fmt"
+	"io"
+	"io/ioutil"
+	"math/rand"
+	"os"
+	"os/exec"
+	"path"
+	"strings"
+	"testing"
+	"time"
+
+	"github.com/klauspost/compress/zstd"
+	"github.com/pkg/errors"
+	"github.com/stretchr/testify/assert"
+	"github.com/stretchr/testify/require"
+	"golang.org/x/sys/unix"
+)
+
+type nopWriteCloser struct {
+	io.Writer
+}
+
+func (nopWriteCloser) Close() error {
+	return nil
+}
+
+type failingWriter struct {
+	left int
+}
+
+func (w *failingWriter) Write(p []byte) (int, error) {
+	if w.left < len(p) {
+		return 0, errors.New("disk full")
+	}
+	w.left -= len(p)
+	return len(p), nil
+}
+
+func decompress(t *testing.T, compression string, data []byte) []byte {
+	var r io.Reader
+	switch compression {
+	case "gzip":
+		gr, err := gzip.NewReader(bytes.NewReader(data))
+		require.NoError(t, err)
+		r = gr
+	case "zstd":
+		zr, err := zstd.NewReader(bytes.NewReader(data))
+		require.NoError(t, err)
+		defer zr.Close()
+		r = zr
+	default:
+		return data
+	}
+	out, err := ioutil.ReadAll(r)
+	require.NoError(t, err)
+	return out
+}
+
+// snapshotSource returns 'size' bytes of mixed content: random data, which
+// does not compress, text-like data, which does, and zeros.
+func snapshotSource(size int) []byte {
+	data := make([]byte, size)
+	rnd := rand.New(rand.NewSource(42))
+	quarter := size / 4
+	rnd.Read(data[:quarter])
+	for i := quarter; i < 2*quarter; {
+		i += copy(data[i:2*quarter], fmt.Sprintf("line %d: %x\n", i, rnd.Int31n(64)))
+	}
+	return data
+}
+
+// writeSparseFile writes 'data' to a new file, leaving holes where 'data'
+// holds zeros, in units of 'holeSize'.
+func writeSparseFile(t testing.TB, name string, data []byte, holeSize int) {
+	f, err := os.Create(name)
+	require.NoError(t, err)
+	defer f.Close()
+	zeros := make([]byte, holeSize)
+	for off := 0; off < len(data); off += holeSize {
+		end := off + holeSize
+		if end > len(data) {
+			end = len(data)
+		}
+		if bytes.Equal(data[off:end], zeros[:end-off]) {
+			continue
+		}
+		_, err = f.WriteAt(data[off:end], int64(off))
+		require.NoError(t, err)
+	}
+	require.NoError(t, f.Truncate(int64(len(data))))
+}
+
+func TestParallelCompressor(t *testing.T) {
+	data := snapshotSource(5*compressionBlockSize + 1234)
+
+	for _, compression := range []string{"gzip", "zstd"} {
+		for _, size := range []int{0, 1, compressionBlockSize, len(data)} {
+			t.Run(fmt.Sprintf("%s/%d", compression, size), func(t *testing.T) {
+				var out bytes.Buffer
+				ss := &snapshot{dst: nopWriteCloser{&out}, workers: 3}
+				require.NoError(t, ss.assignCompression(compression))
+
+				// Odd write sizes, straddling blocks.
+				input := data[:size]
+				for len(input) > 0 {
+					n := 333333
+					if n > len(input) {
+						n = len(input)
+					}
+					written, err := ss.dst.Write(input[:n])
+					require.NoError(t, err)
+					require.Equal(t, n, written)
+					input = input[n:]
+				}
+				require.NoError(t, ss.compressor.Close())
+				require.NoError(t, ss.dst.Close())
+
+				assert.True(t, bytes.Equal(data[:size], decompress(t, compression, out.Bytes())))
+			})
+		}
+	}
+
+	t.Run("write error", func(t *testing.T) {
+		pc := newGzipCompressor(&failingWriter{left: 10}, 2)
+		var err error
+		for i := 0; i < 10 && err == nil; i++ {
+			_, err = pc.Write(data[:compressionBlockSize])
+		}
+		assert.EqualError(t, pc.Close(), "disk full")
+	})
+}
+
+func TestSnapshotDo(t *testing.T) {
+	const holeSize = 64 * 1024
+	td, err := ioutil.TempDir("", "mender-snapshot-")
+	require.NoError(t, err)
+	defer os.RemoveAll(td)
+
+	data := snapshotSource(4*bufferSize + 3*holeSize)
+	srcPath := path.Join(td, "rootfs")
+	writeSparseFile(t, srcPath, data, holeSize)
+
+	allocated := func(name string) int64 {
+		var stat unix.Stat_t
+		require.NoError(t, unix.Stat(name, &stat))
+		return stat.Blocks * 512
+	}
+
+	for _, compression := range []string{"none", "gzip", "zstd"} {
+		for _, sparse := range []bool{false, true} {
+			t.Run(fmt.Sprintf("%s/sparse=%v", compression, sparse), func(t *testing.T) {
+				src, err := os.Open(srcPath)
+				require.NoError(t, err)
+				dstPath := path.Join(td, "snapshot")
+				dst, err := os.Create(dstPath)
+				require.NoError(t, err)
+
+				ss := &snapshot{src: src, dst: dst, sparse: sparse}
+				require.NoError(t, ss.assignCompression(compression))
+				require.NoError(t, ss.Do())
+				ss.cleanup()
+				if compression != "none" {
+					require.NoError(t, dst.Close())
+				}
+
+				out, err := ioutil.ReadFile(dstPath)
+				require.NoError(t, err)
+				assert.True(t, bytes.Equal(data, decompress(t, compression, out)))
+
+				if compression == "none" && sparse &&
+					allocated(srcPath) < int64(len(data)) {
+					// The file system supports holes, and
+					// they are preserved.
+					assert.Less(t, allocated(dstPath), int64(len(data)))
+				}
+			})
+		}
+	}
+}
+
+// makeExt4Image creates an ext4 image of 'size' bytes, holding 'files'. The
+// free blocks are filled with garbage, and the image has no holes, like a
+// partition.
+func makeExt4Image(
+	t *testing.T,
+	name string,
+	size int,
+	files map[string][]byte,
+	mkfsArgs ...string,
+) {
+	if _, err := exec.LookPath("mkfs.ext4"); err != nil {
+		t.Skip("mkfs.ext4 is not available")
+	}
+	content, err := ioutil.TempDir("", "mender-snapshot-content-")
+	require.NoError(t, err)
+	defer os.RemoveAll(content)
+	for file, data := range files {
+		require.NoError(t, ioutil.WriteFile(path.Join(content, file), data, 0644))
+	}
+
+	require.NoError(t, ioutil.WriteFile(name, bytes.Repeat([]byte{0xAA}, size), 0644))
+	args := append([]string{"-q", "-F", "-E", "nodiscard", "-d", content}, mkfsArgs...)
+	args = append(args, name)
+	out, err := exec.Command("mkfs.ext4", args...).CombinedOutput()
+	require.NoError(t, err, string(out))
+}
+
+// checkExt4Snapshot checks that the snapshot 'name' of an image made by
+// makeExt4Image is a valid filesystem holding 'files', and that the free
+// blocks were not copied.
+func checkExt4Snapshot(t *testing.T, name string, files map[string][]byte) {
+	out, err := exec.Command("e2fsck", "-f", "-n", name).CombinedOutput()
+	assert.NoError(t, err, string(out))
+	for file, data := range files {
+		out, err := exec.Command("debugfs", "-R", "cat /"+file, name).Output()
+		require.NoError(t, err)
+		assert.True(t, bytes.Equal(data, out), "content of %s", file)
+	}
+
+	snapshot, err := ioutil.ReadFile(name)
+	require.NoError(t, err)
+	assert.Less(t, bytes.Count(snapshot, []byte{0xAA}), len(snapshot)/10,
+		"the free blocks must not be copied")
+}
+
+func TestSnapshotSparseExt4(t *testing.T) {
+	const size = 16 * 1024 * 1024
+	td, err := ioutil.TempDir("", "mender-snapshot-")
+	require.NoError(t, err)
+	defer os.RemoveAll(td)
+
+	files := map[string][]byte{
+		"random": snapshotSource(3 * bufferSize),
+		"text":   []byte(strings.Repeat("snapshot\n", 10000)),
+	}
+
+	for _, tc := range []struct {
+		name string
+		args []string
+	}{
+		{name: "1k-blocks", args: []string{"-b", "1024", "-O", "^64bit"}},
+		{name: "4k-blocks", args: []string{"-b", "4096", "-O", "64bit"}},
+		{name: "bigalloc", args: []string{"-b", "1024", "-O", "bigalloc", "-C", "16384"}},
+	} {
+		t.Run(tc.name, func(t *testing.T) {
+			srcPath := path.Join(td, "rootfs")
+			makeExt4Image(t, srcPath, size, files, tc.args...)
+
+			src, err := os.Open(srcPath)
+			require.NoError(t, err)
+			m, err := readExt4BlockMap(src, size)
+			require.NoError(t, err)
+			src.Close()
+			var used int64
+			for offset := int64(0); offset < size; {
+				data, end, err := m.nextData(offset)
+				require.NoError(t, err)
+				require.True(t, data >= offset && end > data || data == size)
+				used += end - data
+				offset = end
+			}
+			assert.Less(t, used, int64(size/2))
+
+			for _, compression := range []string{"none", "zstd"} {
+				src, err := os.Open(srcPath)
+				require.NoError(t, err)
+				dstPath := path.Join(td, "snapshot")
+				dst, err := os.Create(dstPath)
+				require.NoError(t, err)
+
+				ss := &snapshot{src: src, dst: dst, sparse: true}
+				require.NoError(t, ss.assignCompression(compression))
+				require.NoError(t, ss.Do())
+				ss.cleanup()
+
+				if compression != "none" {
+					data, err := ioutil.ReadFile(dstPath)
+					require.NoError(t, err)
+					require.NoError(t, ioutil.WriteFile(dstPath,
+						decompress(t, compression, data), 0644))
+				}
+				checkExt4Snapshot(t, dstPath, files)
+			}
+		})
+	}
+
+	t.Run("not ext4", func(t *testing.T) {
+		srcPath := path.Join(td, "rootfs")
+		require.NoError(t, ioutil.WriteFile(srcPath, snapshotSource(size), 0644))
+		src, err := os.Open(srcPath)
+		require.NoError(t, err)
+		defer src.Close()
+		_, err = readExt4BlockMap(src, size)
+		assert.EqualError(t, err, "not an ext2/3/4 filesystem")
+	})
+}
+
+// TestSnapshotSparseBlockDevice snapshots an ext4 filesystem through a loop
+// device, which, unlike a file, never reports holes.
+func TestSnapshotSparseBlockDevice(t *testing.T) {
+	const size = 16 * 1024 * 1024
+	if os.Geteuid() != 0 {
+		t.Skip("loop devices require root")
+	}
+	td, err := ioutil.TempDir("", "mender-snapshot-")
+	require.NoError(t, err)
+	defer os.RemoveAll(td)
+
+	files := map[string][]byte{"random": snapshotSource(3 * bufferSize)}
+	imgPath := path.Join(td, "rootfs.img")
+	makeExt4Image(t, imgPath, size, files)
+
+	out, err := exec.Command("losetup", "--find", "--show", imgPath).Output()
+	if err != nil {
+		t.Skipf("unable to set up a loop device: %v", err)
+	}
+	loop := strings.TrimSpace(string(out))
+	defer func() {
+		_ = exec.Command("losetup", "--detach", loop).Run()
+	}()
+
+	src, err := os.Open(loop)
+	require.NoError(t, err)
+	info, err := src.Stat()
+	require.NoError(t, err)
+	require.Equal(t, os.ModeDevice, info.Mode()&os.ModeDevice)
+
+	dstPath := path.Join(td, "snapshot")
+	dst, err := os.Create(dstPath)
+	require.NoError(t, err)
+	ss := &snapshot{src: src, dst: dst, sparse: true}
+	require.NoError(t, ss.assignCompression("none"))
+	require.NoError(t, ss.Do())
+	ss.cleanup()
+
+	checkExt4Snapshot(t, dstPath, files)
+}
+
+// BenchmarkSnapshot compares the throughput of snapshots of a file-backed
+// source, and how long the source would stay frozen, against the previous
+// single-threaded path.
+func BenchmarkSnapshot(b *testing.B) {
+	const size = 64 * 1024 * 1024
+
+	td, err := ioutil.TempDir("", "mender-snapshot-")
+	require.NoError(b, err)
+	defer os.RemoveAll(td)
+	srcPath := path.Join(td, "rootfs")
+	writeSparseFile(b, srcPath, snapshotSource(size), 64*1024)
+
+	legacy := func(src io.Reader, dst io.Writer) error {
+		gw := gzip.NewWriter(dst)
+		if _, err := io.CopyBuffer(gw, src, make([]byte, 32*1024)); err != nil {
+			return err
+		}
+		return gw.Close()
+	}
+
+	benchmarks := []struct {
+		name        string
+		compression string
+		sparse      bool
+		legacy      bool
+	}{
+		{name: "legacy-gzip", legacy: true},
+		{name: "none", compression: "none"},
+		{name: "none-sparse", compression: "none", sparse: true},
+		{name: "gzip", compression: "gzip"},
+		{name: "zstd", compression: "zstd"},
+		{name: "zstd-sparse", compression: "zstd", sparse: true},
+	}
+	for _, bm := range benchmarks {
+		b.Run(bm.name, func(b *testing.B) {
+			b.SetBytes(size)
+			var frozen time.Duration
+			for i := 0; i < b.N; i++ {
+				src, err := os.Open(srcPath)
+				require.NoError(b, err)
+				dst, err := os.Create(path.Join(td, "snapshot"))
+				require.NoError(b, err)
+
+				start := time.Now()
+				if bm.legacy {
+					err = legacy(src, dst)
+				} else {
+					ss := &snapshot{src: src, dst: dst, sparse: bm.sparse}
+					require.NoError(b, ss.assignCompression(bm.compression))
+					err = ss.Do()
+				}
+				frozen += time.Since(start)
+				require.NoError(b, err)
+				src.Close()
+				dst.Close()
+			}
+			b.ReportMetric(float64(frozen.Milliseconds())/float64(b.N), "frozen-ms/op")
+		})
+	}
+}
@@ -24,6 +24,7 @@ import (
 
 type InventorySubmitter interface {
 	Submit(api ApiRequester, server string, data interface{}) error
+	SubmitPartial(api ApiRequester, server string, data interface{}) error
 }
 
 type InventoryClient struct {
@@ -56,6 +57,19 @@ func (i *InventoryClient) Submit(api ApiRequester, url string, data interface{})
 	return err
 }
 
+// SubmitPartial updates the given attributes on the backend, and leaves the
+// other attributes of the device as they are.
+func (i *InventoryClient) SubmitPartial(api ApiRequester, url string, data interface{}) error {
+	r, err := doSubmitInventory(api, http.MethodPatch, url, data)
+	if err == nil {
+		defer r.Body.Close()
+	}
+
+	log.Debugf("Partial inventory update sent, response %v", r)
+
+	return err
+}
+
 func doSubmitInventory(
 	api ApiRequester,
 	method, url string,
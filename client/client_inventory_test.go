@@ -105,3 +105,34 @@ func TestInventoryFallbackToPatch(t *testing.T) {
 	})
 	assert.NoError(t, err)
 }
+
+func TestInventorySubmitPartial(t *testing.T) {
+	var method string
+	var recdata []byte
+	ts := startTestHTTPS(
+		http.HandlerFunc(func(w http.ResponseWriter, r *http.Request) {
+			method = r.Method
+			recdata, _ = ioutil.ReadAll(r.Body)
+			w.WriteHeader(http.StatusOK)
+		}),
+		localhostCert,
+		localhostKey)
+	defer ts.Close()
+
+	ac, err := NewApiClient(
+		Config{ServerCert: "testdata/server.crt"},
+	)
+	assert.NoError(t, err)
+
+	client := NewInventory()
+	err = client.SubmitPartial(ac, ts.URL, InventoryData{
+		{"foo", "bar"},
+	})
+	assert.NoError(t, err)
+	assert.Equal(t, http.MethodPatch, method)
+	assert.JSONEq(t, `[{"name": "foo", "value": "bar"}]`, string(recdata))
+
+	err = client.SubmitPartial(NewMockApiClient(nil, errors.New("foo")),
+		ts.URL, InventoryData{{"foo", "bar"}})
+	assert.Error(t, err)
+}
@@ -16,6 +16,7 @@ package client
 import (
 	"bytes"
 	"fmt"
+	"io"
 	"net/http"
 
 	"github.com/pkg/errors"
@@ -29,6 +30,10 @@ type LogUploader interface {
 type LogData struct {
 	DeploymentID string `json:"-"`
 	Messages     []byte `json:"messages"`
+	// If set, the messages are streamed from a reader opened by Open,
+	// instead of being sent from Messages. It is called once for every
+	// time the request is sent.
+	Open func() (io.ReadCloser, error) `json:"-"`
 }
 
 type LogUploadClient struct {
@@ -44,6 +49,8 @@ func (u *LogUploadClient) Upload(api ApiRequester, url string, logs LogData) err
 	if err != nil {
 		return errors.Wrapf(err, "failed to prepare log upload request")
 	}
+	// The client may send a body from GetBody instead.
+	defer req.Body.Close()
 
 	r, err := api.Do(req)
 	if err != nil {
@@ -68,11 +75,46 @@ func makeLogUploadRequest(server string, logs *LogData) (*http.Request, error) {
 		logs.DeploymentID)
 	url := buildApiURL(server, path)
 
-	hreq, err := http.NewRequest(http.MethodPut, url, bytes.NewReader(logs.Messages))
+	if logs.Open == nil {
+		hreq, err := http.NewRequest(http.MethodPut, url, bytes.NewReader(logs.Messages))
+		if err != nil {
+			return nil, errors.Wrapf(err, "failed to create log sending HTTP request")
+		}
+		hreq.Header.Add("Content-Type", "application/json")
+		return hreq, nil
+	}
+
+	// The reauthorizing client sends the body from GetBody, so the body
+	// of the request is only opened if it is read.
+	hreq, err := http.NewRequest(http.MethodPut, url, &lazyLogBody{open: logs.Open})
 	if err != nil {
 		return nil, errors.Wrapf(err, "failed to create log sending HTTP request")
 	}
-
+	hreq.GetBody = logs.Open
 	hreq.Header.Add("Content-Type", "application/json")
 	return hreq, nil
 }
+
+// lazyLogBody opens the logs on the first Read.
+type lazyLogBody struct {
+	open func() (io.ReadCloser, error)
+	body io.ReadCloser
+}
+
+func (b *lazyLogBody) Read(buf []byte) (int, error) {
+	if b.body == nil {
+		body, err := b.open()
+		if err != nil {
+			return 0, errors.Wrapf(err, "failed to open logs")
+		}
+		b.body = body
+	}
+	return b.body.Read(buf)
+}
+
+func (b *lazyLogBody) Close() error {
+	if b.body == nil {
+		return nil
+	}
+	return b.body.Close()
+}
@@ -14,6 +14,8 @@
 package client
 
 import (
+	"bytes"
+	"io"
 	"io/ioutil"
 	"net/http"
 	"testing"
@@ -82,6 +84,50 @@ func TestLogUploadClient(t *testing.T) {
 	   ]}`, string(responder.recdata))
 	assert.Equal(t, apiPrefix+"v1/deployments/device/deployments/deployment1/log", responder.path)
 
+	// streamed from a reader
+	responder.recdata = nil
+	opened := 0
+	err = client.Upload(ac, ts.URL, LogData{
+		DeploymentID: "deployment1",
+		Open: func() (io.ReadCloser, error) {
+			opened++
+			return ioutil.NopCloser(bytes.NewReader(ld.Messages)), nil
+		},
+	})
+	assert.NoError(t, err)
+	assert.Equal(t, 1, opened)
+	assert.JSONEq(t, string(ld.Messages), string(responder.recdata))
+
+	// The reauthorizing client sends the body from GetBody, and does not
+	// open the logs once more.
+	rc, err := NewReauthorizingClient(
+		Config{ServerCert: "testdata/server.crt"},
+		func() (AuthToken, ServerURL, error) {
+			return AuthToken("token"), ServerURL(ts.URL), nil
+		},
+	)
+	assert.NoError(t, err)
+	responder.recdata = nil
+	opened = 0
+	err = client.Upload(rc, ts.URL, LogData{
+		DeploymentID: "deployment1",
+		Open: func() (io.ReadCloser, error) {
+			opened++
+			return ioutil.NopCloser(bytes.NewReader(ld.Messages)), nil
+		},
+	})
+	assert.NoError(t, err)
+	assert.Equal(t, 1, opened)
+	assert.JSONEq(t, string(ld.Messages), string(responder.recdata))
+
+	err = client.Upload(ac, ts.URL, LogData{
+		DeploymentID: "deployment1",
+		Open: func() (io.ReadCloser, error) {
+			return nil, errors.New("no logs")
+		},
+	})
+	assert.Error(t, err)
+
 	responder.httpStatus = 401
 	err = client.Upload(ac, ts.URL, LogData{
 		DeploymentID: "deployment1",
@@ -49,6 +49,7 @@ var (
 
 type UpdateClient struct {
 	minImageSize int64
+	download     DownloadConfig
 }
 
 func NewUpdate() *UpdateClient {
@@ -58,6 +59,14 @@ func NewUpdate() *UpdateClient {
 	return &up
 }
 
+// NewUpdateWithDownloadConfig returns an UpdateClient which downloads
+// artifacts according to 'config'.
+func NewUpdateWithDownloadConfig(config DownloadConfig) *UpdateClient {
+	up := NewUpdate()
+	up.download = config
+	return up
+}
+
 // CurrentUpdate describes currently installed update. Non empty fields will be
 // used when querying for the next update.
 type CurrentUpdate struct {
@@ -204,6 +213,12 @@ func (u *UpdateClient) FetchUpdate(
 		return nil, -1, errors.New("Image size is smaller than expected. Aborting.")
 	}
 
+	if u.download.Connections > 1 &&
+		r.Header.Get("Accept-Ranges") == "bytes" &&
+		r.ContentLength > u.download.segmentSize() {
+		return NewSegmentedDownload(r, maxWait, api, req, u.download), r.ContentLength, nil
+	}
+
 	return NewUpdateResumer(r.Body, r.ContentLength, maxWait, api, req), r.ContentLength, nil
 }
 
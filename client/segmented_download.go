@@ -0,0 +1,309 @@
+// Copyright 2023 Northern.tech AS
+//
+//    Licensed under the Apache License, Version 2.0 (the "License");
+//    you may not use this file except in compliance with the License.
+//    You may obtain a copy of the License at
+//
+//        http://www.apache.org/licenses/LICENSE-2.0
+//
+//    Unless required by applicable law or agreed to in writing, software
+//    distributed under the License is distributed on an "AS IS" BASIS,
+//    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//    See the License for the specific language governing permissions and
+//    limitations under the License.
+package client
+
+import (
+	"context"
+	"fmt"
+	"io"
+	"net/http"
+	"sync"
+	"time"
+
+	"github.com/pkg/errors"
+	log "github.com/sirupsen/logrus"
+
+	"github.com/mendersoftware/mender/utils"
+)
+
+const (
+	// DefaultDownloadBufferSize is the memory shared between the
+	// connections of a segmented download, unless configured.
+	DefaultDownloadBufferSize int64 = 8 * 1024 * 1024
+	// Segments smaller than this are not worth a request of their own.
+	minDownloadSegmentSize int64 = 64 * 1024
+)
+
+var errRangeIgnored = errors.New("HTTP server ignored the requested range")
+
+// DownloadConfig configures how artifacts are downloaded.
+// NOTE: Careful when changing this, the struct is exposed directly in the
+// 'mender.conf' file.
+type DownloadConfig struct {
+	// Number of connections used to download an artifact in parallel
+	// segments. With less than two, the artifact is downloaded over one
+	// connection.
+	Connections int `json:",omitempty"`
+	// Number of bytes buffered ahead of the reader, shared between the
+	// connections. Each segment is BufferSize/Connections bytes.
+	BufferSize int64 `json:",omitempty"`
+}
+
+func (c DownloadConfig) segmentSize() int64 {
+	bufferSize := c.BufferSize
+	if bufferSize <= 0 {
+		bufferSize = DefaultDownloadBufferSize
+	}
+	segmentSize := bufferSize / int64(c.Connections)
+	if segmentSize < minDownloadSegmentSize {
+		segmentSize = minDownloadSegmentSize
+	}
+	return segmentSize
+}
+
+// segmentSlot is a buffer holding one downloaded segment. Slot 'j' is used by
+// segments j+1, j+1+N, j+1+2N, ..., where N is the number of slots.
+type segmentSlot struct {
+	buf []byte
+	// Receives the result of each download into buf.
+	ready chan error
+	// Receives a token when buf may be reused for the next segment.
+	free chan struct{}
+}
+
+// SegmentedDownload reads an artifact as a sequential stream, while fetching
+// the segments ahead of the reader in parallel, using HTTP Range requests.
+// The first segment is read from the original response, so no data is
+// fetched twice. Each of the other segments is downloaded into a slot of a
+// bounded ring, which is handed to the reader in order, and retried on its own
+// if its connection breaks.
+//
+// If the server turns out to ignore Range requests, the rest of the artifact
+// is read from the original response, like UpdateResumer does.
+type SegmentedDownload struct {
+	primary       *UpdateResumer
+	apiReq        ApiRequester
+	req           *http.Request
+	contentLength int64
+	segmentSize   int64
+	segments      int
+	maxWait       time.Duration
+
+	ctx    context.Context
+	cancel context.CancelFunc
+	wg     sync.WaitGroup
+	slots  []*segmentSlot
+
+	// Segment being read, and the read position within it.
+	segment  int
+	position int64
+	// Length of the current segment buffer.
+	available int64
+	// Set once the server ignored a Range request.
+	sequential bool
+	err        error
+}
+
+// NewSegmentedDownload returns a reader of the artifact returned in 'res',
+// which was requested with 'req'. Nothing must have been read from the body
+// of 'res' yet.
+func NewSegmentedDownload(
+	res *http.Response,
+	maxWait time.Duration,
+	apiReq ApiRequester,
+	req *http.Request,
+	config DownloadConfig,
+) *SegmentedDownload {
+	segmentSize := config.segmentSize()
+	segments := int((res.ContentLength + segmentSize - 1) / segmentSize)
+	connections := config.Connections
+	if connections > segments-1 {
+		connections = segments - 1
+	}
+
+	ctx, cancel := context.WithCancel(context.Background())
+	d := &SegmentedDownload{
+		// The resumer sets its own Range on the request, so it gets a
+		// copy.
+		primary: NewUpdateResumer(res.Body, res.ContentLength, maxWait, apiReq,
+			req.Clone(req.Context())),
+		apiReq:        apiReq,
+		req:           req,
+		contentLength: res.ContentLength,
+		segmentSize:   segmentSize,
+		segments:      segments,
+		maxWait:       maxWait,
+		ctx:           ctx,
+		cancel:        cancel,
+		slots:         make([]*segmentSlot, connections),
+		available:     segmentSize,
+	}
+
+	log.Infof("Downloading artifact of %d bytes in %d segments over %d connections",
+		d.contentLength, segments, connections+1)
+
+	for j := range d.slots {
+		slot := &segmentSlot{
+			buf:   make([]byte, segmentSize),
+			ready: make(chan error, 1),
+			free:  make(chan struct{}, 1),
+		}
+		slot.free <- struct{}{}
+		d.slots[j] = slot
+		d.wg.Add(1)
+		go d.fetchSegments(j, slot)
+	}
+	return d
+}
+
+// segmentRange returns the offset and length of segment 'i'.
+func (d *SegmentedDownload) segmentRange(i int) (int64, int64) {
+	offset := int64(i) * d.segmentSize
+	length := d.contentLength - offset
+	if length > d.segmentSize {
+		length = d.segmentSize
+	}
+	return offset, length
+}
+
+// fetchSegments downloads every segment belonging to 'slot' in turn, waiting
+// for the reader to free the slot before each one.
+func (d *SegmentedDownload) fetchSegments(j int, slot *segmentSlot) {
+	defer d.wg.Done()
+	for i := j + 1; i < d.segments; i += len(d.slots) {
+		select {
+		case <-slot.free:
+		case <-d.ctx.Done():
+			return
+		}
+		offset, length := d.segmentRange(i)
+		err := d.fetchSegment(slot.buf[:length], offset)
+		slot.ready <- err
+		if err != nil {
+			return
+		}
+	}
+}
+
+// fetchSegment fills 'buf' with the artifact data at 'offset', resuming from
+// where it stopped if the connection breaks.
+func (d *SegmentedDownload) fetchSegment(buf []byte, offset int64) error {
+	var read int
+	for attempt := 0; ; attempt++ {
+		if attempt > 0 {
+			waitTime, err := GetExponentialBackoffTime(attempt-1, d.maxWait, 0)
+			if err != nil {
+				return errors.Wrapf(err, "Cannot download the segment at offset %d", offset)
+			}
+			log.Infof("Resuming download of the segment at offset %d in %s",
+				offset+int64(read), waitTime.String())
+			select {
+			case <-time.After(waitTime):
+			case <-d.ctx.Done():
+				return d.ctx.Err()
+			}
+		}
+
+		n, err := d.fetchRange(buf[read:], offset+int64(read))
+		read += n
+		if err == nil {
+			return nil
+		} else if err == errRangeIgnored || d.ctx.Err() != nil {
+			return err
+		}
+		log.Errorf("Download of the segment at offset %d broken: %s", offset, err.Error())
+	}
+}
+
+// fetchRange issues one Range request for the artifact data at 'offset', and
+// reads as much of it into 'buf' as the connection allows.
+func (d *SegmentedDownload) fetchRange(buf []byte, offset int64) (int, error) {
+	req := d.req.Clone(d.ctx)
+	req.Header.Set("Range", fmt.Sprintf("bytes=%d-%d", offset, offset+int64(len(buf))-1))
+
+	res, err := d.apiReq.Do(req)
+	if err != nil {
+		return 0, err
+	}
+	defer res.Body.Close()
+	if res.StatusCode == http.StatusOK {
+		return 0, errRangeIgnored
+	}
+
+	stream, err := getStreamFromPartialContent(res, offset, d.contentLength)
+	if err != nil {
+		return 0, err
+	}
+	return io.ReadFull(stream, buf)
+}
+
+func (d *SegmentedDownload) Read(buf []byte) (int, error) {
+	start := time.Now()
+	for d.err == nil && !d.sequential && d.position == d.available {
+		d.nextSegment()
+	}
+	if d.err != nil {
+		return 0, d.err
+	}
+
+	if d.segment == 0 || d.sequential {
+		// The original response stays open until the first Range
+		// request has succeeded. Reading it is metered by the
+		// UpdateResumer.
+		if remaining := d.available - d.position; !d.sequential &&
+			int64(len(buf)) > remaining {
+			buf = buf[:remaining]
+		}
+		n, err := d.primary.Read(buf)
+		d.position += int64(n)
+		d.err = err
+		return n, err
+	}
+
+	slot := d.slots[(d.segment-1)%len(d.slots)]
+	n := copy(buf, slot.buf[d.position:d.available])
+	d.position += int64(n)
+	utils.Metrics.AddSince(utils.StageDownload, int64(n), start)
+	return n, nil
+}
+
+// nextSegment waits for the next segment, and releases the slot of the
+// current one. On error, either d.err or d.sequential is set.
+func (d *SegmentedDownload) nextSegment() {
+	if d.segment+1 == d.segments {
+		d.err = io.EOF
+		return
+	}
+	if d.segment > 0 {
+		d.slots[(d.segment-1)%len(d.slots)].free <- struct{}{}
+	}
+	d.segment++
+	d.position = 0
+	_, d.available = d.segmentRange(d.segment)
+
+	err := <-d.slots[(d.segment-1)%len(d.slots)].ready
+	if err == nil {
+		if d.segment == 1 {
+			// The server supports Range requests, so the rest of
+			// the original response is not needed.
+			d.primary.Close()
+		}
+		return
+	}
+
+	d.cancel()
+	if err == errRangeIgnored && d.segment == 1 {
+		log.Warn("HTTP server does not support Range requests. " +
+			"Continuing the download over one connection.")
+		d.sequential = true
+		return
+	}
+	d.err = err
+}
+
+func (d *SegmentedDownload) Close() error {
+	d.cancel()
+	d.wg.Wait()
+	return d.primary.Close()
+}
@@ -0,0 +1,161 @@
+// Copyright 2023 Northern.tech AS
+//
+//    Licensed under the Apache License, Version 2.0 (the "License");
+//    you may not use this file except in compliance with the License.
+//    You may obtain a copy of the License at
+//
+//        http://www.apache.org/licenses/LICENSE-2.0
+//
+//    Unless required by applicable law or agreed to in writing, software
+//    distributed under the License is distributed on an "AS IS" BASIS,
+//    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//    See the License for the specific language governing permissions and
+//    limitations under the License.
+
+// The test server imports the client package, so these tests live in a
+// package of their own.
+package client_test
+
+import (
+	"bytes"
+	"crypto/rand"
+	"io"
+	"io/ioutil"
+	"net/http"
+	"testing"
+	"time"
+
+	"github.com/stretchr/testify/assert"
+	"github.com/stretchr/testify/require"
+
+	"github.com/mendersoftware/mender/client"
+	cltest "github.com/mendersoftware/mender/client/test"
+)
+
+func TestSegmentedDownload(t *testing.T) {
+	oldExponentialBackoffSmallestUnit := client.ExponentialBackoffSmallestUnit
+	client.ExponentialBackoffSmallestUnit = time.Millisecond
+	defer func() {
+		client.ExponentialBackoffSmallestUnit = oldExponentialBackoffSmallestUnit
+	}()
+
+	const segmentSize = 64 * 1024
+	data := make([]byte, 16*segmentSize+1234)
+	_, err := rand.Read(data)
+	require.NoError(t, err)
+
+	tests := map[string]struct {
+		config        client.DownloadConfig
+		rangeSupport  bool
+		acceptRanges  bool
+		drops         int
+		dropAfter     int64
+		segmented     bool
+		rangeRequests int
+	}{
+		"disabled": {
+			config:       client.DownloadConfig{Connections: 1},
+			rangeSupport: true,
+		},
+		"segmented": {
+			config:        client.DownloadConfig{Connections: 4, BufferSize: 4 * segmentSize},
+			rangeSupport:  true,
+			segmented:     true,
+			rangeRequests: 16,
+		},
+		"default buffer size": {
+			// Artifact is smaller than a segment.
+			config:       client.DownloadConfig{Connections: 4},
+			rangeSupport: true,
+		},
+		"more connections than segments": {
+			config:        client.DownloadConfig{Connections: 64, BufferSize: 64 * segmentSize},
+			rangeSupport:  true,
+			segmented:     true,
+			rangeRequests: 16,
+		},
+		"connection drops": {
+			config:       client.DownloadConfig{Connections: 3, BufferSize: 3 * segmentSize},
+			rangeSupport: true,
+			drops:        5,
+			dropAfter:    segmentSize / 3,
+			segmented:    true,
+			// Each drop costs one extra request.
+			rangeRequests: 16 + 5,
+		},
+		"server without range support": {
+			config: client.DownloadConfig{Connections: 4, BufferSize: 4 * segmentSize},
+		},
+		"server ignoring range": {
+			config:       client.DownloadConfig{Connections: 4, BufferSize: 4 * segmentSize},
+			acceptRanges: true,
+			segmented:    true,
+			// Requests made before the reader noticed.
+			rangeRequests: -1,
+		},
+	}
+
+	for name, tc := range tests {
+		t.Run(name, func(t *testing.T) {
+			srv := cltest.NewClientTestServer()
+			defer srv.Close()
+
+			srv.UpdateDownload.Data.Write(data)
+			srv.UpdateDownload.RangeSupport = tc.rangeSupport
+			srv.UpdateDownload.Latency = 5 * time.Millisecond
+			srv.UpdateDownload.Drops = tc.drops
+			srv.UpdateDownload.DropAfter = tc.dropAfter
+			if tc.acceptRanges {
+				srv.ResponseHeader.Header = http.Header{"Accept-Ranges": []string{"bytes"}}
+			}
+
+			upd := client.NewUpdateWithDownloadConfig(tc.config)
+			stream, size, err := upd.FetchUpdate(&http.Client{},
+				srv.URL+"/api/devices/v1/download", 10*time.Millisecond)
+			require.NoError(t, err)
+			assert.EqualValues(t, len(data), size)
+			_, segmented := stream.(*client.SegmentedDownload)
+			assert.Equal(t, tc.segmented, segmented)
+
+			actual, err := ioutil.ReadAll(stream)
+			require.NoError(t, err)
+			require.NoError(t, stream.Close())
+			assert.True(t, bytes.Equal(data, actual))
+
+			if tc.rangeRequests >= 0 {
+				assert.Equal(t, tc.rangeRequests, srv.UpdateDownload.RangeRequests)
+			}
+		})
+	}
+}
+
+func TestSegmentedDownloadClose(t *testing.T) {
+	const segmentSize = 64 * 1024
+	data := make([]byte, 32*segmentSize)
+
+	srv := cltest.NewClientTestServer()
+	defer srv.Close()
+	srv.UpdateDownload.Data.Write(data)
+	srv.UpdateDownload.RangeSupport = true
+
+	upd := client.NewUpdateWithDownloadConfig(
+		client.DownloadConfig{Connections: 4, BufferSize: 4 * segmentSize})
+	stream, _, err := upd.FetchUpdate(&http.Client{}, srv.URL+"/api/devices/v1/download", 0)
+	require.NoError(t, err)
+
+	// Stop in the middle of the second segment, while the ring is full.
+	_, err = io.CopyN(ioutil.Discard, stream, 3*segmentSize/2)
+	require.NoError(t, err)
+	time.Sleep(50 * time.Millisecond)
+
+	done := make(chan error)
+	go func() {
+		done <- stream.Close()
+	}()
+	select {
+	case err = <-done:
+		assert.NoError(t, err)
+	case <-time.After(5 * time.Second):
+		t.Fatal("Close did not return")
+	}
+}
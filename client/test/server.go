@@ -26,6 +26,8 @@ import (
 	"reflect"
 	"strconv"
 	"strings"
+	"sync"
+	"time"
 
 	log "github.com/sirupsen/logrus"
 
@@ -46,6 +48,40 @@ type updateType struct {
 type updateDownloadType struct {
 	Called bool
 	Data   bytes.Buffer
+
+	// If set, Range requests are honored.
+	RangeSupport bool
+	// Delay before every response.
+	Latency time.Duration
+	// The next Drops responses are cut off after DropAfter bytes of body.
+	Drops     int
+	DropAfter int64
+	// Number of requests received, and how many of them had a Range.
+	Requests      int
+	RangeRequests int
+
+	lock sync.Mutex
+}
+
+// droppingResponseWriter aborts the connection once 'left' bytes of body
+// have been written.
+type droppingResponseWriter struct {
+	http.ResponseWriter
+	left int64
+}
+
+func (w *droppingResponseWriter) Write(buf []byte) (int, error) {
+	if int64(len(buf)) > w.left {
+		n, _ := w.ResponseWriter.Write(buf[:w.left])
+		w.left = 0
+		if f, ok := w.ResponseWriter.(http.Flusher); ok {
+			f.Flush()
+		}
+		log.Infof("dropping update download connection after %d bytes", n)
+		panic(http.ErrAbortHandler)
+	}
+	w.left -= int64(len(buf))
+	return w.ResponseWriter.Write(buf)
 }
 
 type authType struct {
@@ -69,6 +105,10 @@ type logType struct {
 type inventoryType struct {
 	Called bool
 	Attrs  []client.InventoryAttribute
+	// If set, PATCH requests update the given attributes in Attrs.
+	PatchSupport bool
+	// Method of the last request.
+	Method string
 }
 
 type requestHeader struct {
@@ -275,8 +315,10 @@ func (cts *ClientTestServer) headersHook(f http.HandlerFunc) http.HandlerFunc {
 func (cts *ClientTestServer) inventoryReq(w http.ResponseWriter, r *http.Request) {
 	log.Infof("got inventory request %v", r)
 	cts.Inventory.Called = true
+	cts.Inventory.Method = r.Method
 
-	if !isMethod(http.MethodPut, w, r) {
+	if !(cts.Inventory.PatchSupport && r.Method == http.MethodPatch) &&
+		!isMethod(http.MethodPut, w, r) {
 		return
 	}
 
@@ -296,7 +338,22 @@ func (cts *ClientTestServer) inventoryReq(w http.ResponseWriter, r *http.Request
 		return
 	}
 	log.Infof("got attrs: %v", attrs)
-	cts.Inventory.Attrs = attrs
+	if r.Method == http.MethodPatch {
+		for _, attr := range attrs {
+			replaced := false
+			for i := range cts.Inventory.Attrs {
+				if cts.Inventory.Attrs[i].Name == attr.Name {
+					cts.Inventory.Attrs[i] = attr
+					replaced = true
+				}
+			}
+			if !replaced {
+				cts.Inventory.Attrs = append(cts.Inventory.Attrs, attr)
+			}
+		}
+	} else {
+		cts.Inventory.Attrs = attrs
+	}
 	w.WriteHeader(http.StatusOK)
 }
 
@@ -570,7 +627,18 @@ func (cts *ClientTestServer) updateReqv2(w http.ResponseWriter, r *http.Request)
 
 func (cts *ClientTestServer) updateDownloadReq(w http.ResponseWriter, r *http.Request) {
 	log.Infof("got update download request %v", r)
+	cts.UpdateDownload.lock.Lock()
 	cts.UpdateDownload.Called = true
+	cts.UpdateDownload.Requests++
+	if r.Header.Get("Range") != "" {
+		cts.UpdateDownload.RangeRequests++
+	}
+	if cts.UpdateDownload.Drops > 0 {
+		cts.UpdateDownload.Drops--
+		w = &droppingResponseWriter{ResponseWriter: w, left: cts.UpdateDownload.DropAfter}
+	}
+	latency := cts.UpdateDownload.Latency
+	cts.UpdateDownload.lock.Unlock()
 
 	if !isMethod(http.MethodGet, w, r) {
 		return
@@ -582,8 +650,17 @@ func (cts *ClientTestServer) updateDownloadReq(w http.ResponseWriter, r *http.Re
 		w.WriteHeader(http.StatusBadRequest)
 	}
 
+	time.Sleep(latency)
+
+	if cts.UpdateDownload.RangeSupport {
+		w.Header().Set("Content-Type", "application/octet-stream")
+		http.ServeContent(w, r, "", time.Time{},
+			bytes.NewReader(cts.UpdateDownload.Data.Bytes()))
+		return
+	}
+
 	w.Header().Set("Content-Length", strconv.Itoa(cts.UpdateDownload.Data.Len()))
 	w.Header().Set("Content-Type", "application/octet-stream")
 	w.WriteHeader(http.StatusOK)
-	_, _ = io.Copy(w, &cts.UpdateDownload.Data)
+	_, _ = w.Write(cts.UpdateDownload.Data.Bytes())
 }
@@ -26,6 +26,8 @@ import (
 	log "github.com/sirupsen/logrus"
 
 	"github.com/pkg/errors"
+
+	"github.com/mendersoftware/mender/utils"
 )
 
 type UpdateResumer struct {
@@ -56,6 +58,10 @@ func NewUpdateResumer(stream io.ReadCloser,
 
 func (h *UpdateResumer) Read(buf []byte) (int, error) {
 	origOffset := h.offset
+	start := time.Now()
+	defer func() {
+		utils.Metrics.AddSince(utils.StageDownload, h.offset-origOffset, start)
+	}()
 	for {
 		bytesRead, err := h.stream.Read(buf[h.offset-origOffset:])
 		if bytesRead > 0 {
@@ -111,11 +117,22 @@ func (h *UpdateResumer) Read(buf []byte) (int, error) {
 }
 
 func (h *UpdateResumer) getStreamFromPartialContent(res *http.Response) (io.ReadCloser, error) {
+	return getStreamFromPartialContent(res, h.offset, h.contentLength)
+}
+
+// getStreamFromPartialContent validates the Content-Range of the response to a
+// request for the bytes starting at 'offset' of an artifact of size
+// 'contentLength', and returns the body, positioned at 'offset'.
+func getStreamFromPartialContent(
+	res *http.Response,
+	offset int64,
+	contentLength int64,
+) (io.ReadCloser, error) {
 	var err error
 
-	if h.offset > 0 && res.StatusCode != http.StatusPartialContent {
+	if offset > 0 && res.StatusCode != http.StatusPartialContent {
 		return nil, fmt.Errorf("Could not resume download from offset %d. HTTP status code: %s",
-			h.offset, res.Status)
+			offset, res.Status)
 	}
 
 	hRangeStr := res.Header.Get("Content-Range")
@@ -133,9 +150,9 @@ func (h *UpdateResumer) getStreamFromPartialContent(res *http.Response) (io.Read
 		sizeFromServer, err = strconv.ParseInt(hRangePosAndSize[1], 10, 64)
 		if err != nil {
 			return nil, fmt.Errorf("HTTP server returned garbled or missing range: '%s'", hRangeStr)
-		} else if sizeFromServer != h.contentLength {
+		} else if sizeFromServer != contentLength {
 			return nil, fmt.Errorf("Size of artifact changed after download was resumed "+
-				"(expected %d, got %d)", h.contentLength, sizeFromServer)
+				"(expected %d, got %d)", contentLength, sizeFromServer)
 		}
 		// Intentional fallthrough. Response does not have to contain
 		// the total size after '/'.
@@ -151,20 +168,20 @@ func (h *UpdateResumer) getStreamFromPartialContent(res *http.Response) (io.Read
 		return nil, errors.Wrapf(err, "HTTP server returned garbled range: %s", hRangeStr)
 	}
 
-	if newOffset > h.offset {
+	if newOffset > offset {
 		return nil, fmt.Errorf("HTTP server did not return expected range. Expected %d, got %d",
-			h.offset, newOffset)
-	} else if newOffset < h.offset {
+			offset, newOffset)
+	} else if newOffset < offset {
 		// Server gave us an offset which is earlier than we asked.
 		// Consume input to get back where we were.
-		bytesRead, err := io.CopyN(ioutil.Discard, res.Body, h.offset-newOffset)
+		bytesRead, err := io.CopyN(ioutil.Discard, res.Body, offset-newOffset)
 		if err == io.ErrUnexpectedEOF {
 			// Treat this specifically to force a retry in the outer function.
 			return nil, err
-		} else if err != nil || bytesRead != h.offset-newOffset {
+		} else if err != nil || bytesRead != offset-newOffset {
 			return nil, errors.Wrapf(err,
 				"Could not resume download, unable to catch up to offset %d from offset %d",
-				h.offset, newOffset)
+				offset, newOffset)
 		}
 		// Intentional fallthrough to end.
 	}
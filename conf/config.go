@@ -18,6 +18,7 @@ import (
 	"io/ioutil"
 	"os"
 	"strings"
+	"time"
 
 	"github.com/pkg/errors"
 	log "github.com/sirupsen/logrus"
@@ -28,6 +29,7 @@ import (
 
 const (
 	DefaultUpdateControlMapBootExpirationTimeSeconds = 600
+	DefaultDBGroupCommitMilliseconds                 = 1000
 )
 
 type MenderConfigFromFile struct {
@@ -46,10 +48,16 @@ type MenderConfigFromFile struct {
 	Security client.Security `json:",omitempty"`
 	// Connectivity connection handling and transfer parameters
 	Connectivity client.Connectivity `json:",omitempty"`
+	// Parallel, segmented download of artifacts
+	Download client.DownloadConfig `json:",omitempty"`
 
 	// Rootfs device path
 	RootfsPartA string `json:",omitempty"`
 	RootfsPartB string `json:",omitempty"`
+	// Parameters for writing rootfs images to the inactive partition
+	RootfsWriter RootfsWriterConfig `json:",omitempty"`
+	// Parameters for storing artifact payloads
+	PayloadPipeline PayloadPipelineConfig `json:",omitempty"`
 
 	// Command to set active partition.
 	BootUtilitiesSetActivePart string `json:",omitempty"`
@@ -60,6 +68,10 @@ type MenderConfigFromFile struct {
 	DeviceTypeFile string `json:",omitempty"`
 	// DBus configuration
 	DBus DBusConfig `json:",omitempty"`
+	// Maximum time non-critical database writes are held back, so that
+	// they are committed together. Zero selects the default, and a
+	// negative value commits each write immediately.
+	DBGroupCommitMilliseconds int `json:",omitempty"`
 	// Expiration timeout for the control map
 	UpdateControlMapExpirationTimeSeconds int `json:",omitempty"`
 	// Expiration timeout for the control map when just booted
@@ -69,6 +81,11 @@ type MenderConfigFromFile struct {
 	UpdatePollIntervalSeconds int `json:",omitempty"`
 	// Poll interval for periodically sending inventory data
 	InventoryPollIntervalSeconds int `json:",omitempty"`
+	// Number of inventory scripts run at the same time
+	InventoryScriptConcurrency int `json:",omitempty"`
+	// The timeout for the execution of each inventory script, after which
+	// it will be killed
+	InventoryScriptTimeoutSeconds int `json:",omitempty"`
 
 	// Skip CA certificate validation
 	SkipVerify bool `json:",omitempty"`
@@ -122,9 +139,50 @@ type DBusConfig struct {
 	Enabled bool
 }
 
+// RootfsWriterConfig tunes how rootfs images are written to the inactive
+// partition. The zero value selects the defaults.
+type RootfsWriterConfig struct {
+	// Number of bytes written between each sync of the partition.
+	SyncIntervalBytes uint64 `json:",omitempty"`
+	// Maximum time between each sync of the partition.
+	SyncIntervalSeconds int `json:",omitempty"`
+	// Number of frames to read ahead from the partition while comparing.
+	ReadAheadFrames int `json:",omitempty"`
+	// Open the partition with O_DIRECT, bypassing the page cache.
+	DirectIO bool `json:",omitempty"`
+	// Use the sequential read, compare, seek and write path instead of the
+	// pipelined one.
+	Sequential bool `json:",omitempty"`
+	// Always compare with the contents of the partition, instead of the
+	// hashes recorded when it was last written.
+	DisableFrameIndex bool `json:",omitempty"`
+	// Issue BLKZEROOUT for all-zero frames instead of writing them, which
+	// lets devices that support it unmap the frames. These frames are
+	// zeroed out again by every update.
+	DiscardZeroFrames bool `json:",omitempty"`
+}
+
+// PayloadPipelineConfig tunes how artifact payloads are stored. The zero value
+// selects the defaults.
+//
+// The memory used to store one payload file is bounded: the queue takes up to
+// Buffers times 256 KiB, 4 MiB by default. A file streamed to an update
+// module is not read ahead any further, and takes another 256 KiB copy buffer,
+// and a FIFO of up to 1 MiB of kernel memory. Storing payloads sequentially,
+// the queue is replaced by a read ahead of up to 4 MiB for update modules.
+type PayloadPipelineConfig struct {
+	// Number of buffers of 256 KiB of decompressed and verified payload
+	// data queued for the update module or the inactive partition.
+	Buffers int `json:",omitempty"`
+	// Decompress, verify and write payloads on one goroutine, instead of
+	// overlapping the stages.
+	Sequential bool `json:",omitempty"`
+}
+
 type DualRootfsDeviceConfig struct {
-	RootfsPartA string
-	RootfsPartB string
+	RootfsPartA  string
+	RootfsPartB  string
+	RootfsWriter RootfsWriterConfig
 }
 
 func NewMenderConfig() *MenderConfig {
@@ -231,6 +289,15 @@ func (c *MenderConfigFromFile) GetUpdateControlMapBootExpirationTimeSeconds() in
 	return c.UpdateControlMapBootExpirationTimeSeconds
 }
 
+func (c *MenderConfigFromFile) GetDBGroupCommitDelay() time.Duration {
+	if c.DBGroupCommitMilliseconds == 0 {
+		return DefaultDBGroupCommitMilliseconds * time.Millisecond
+	} else if c.DBGroupCommitMilliseconds < 0 {
+		return 0
+	}
+	return time.Duration(c.DBGroupCommitMilliseconds) * time.Millisecond
+}
+
 func checkConfigDefaults(config *MenderConfig) {
 	if config.MenderConfigFromFile.UpdateControlMapExpirationTimeSeconds == 0 {
 		log.Info(
@@ -339,8 +406,9 @@ func (c *MenderConfig) GetHttpConfig() client.Config {
 
 func (c *MenderConfig) GetDeviceConfig() DualRootfsDeviceConfig {
 	return DualRootfsDeviceConfig{
-		RootfsPartA: c.RootfsPartA,
-		RootfsPartB: c.RootfsPartB,
+		RootfsPartA:  c.RootfsPartA,
+		RootfsPartB:  c.RootfsPartB,
+		RootfsWriter: c.RootfsWriter,
 	}
 }
 
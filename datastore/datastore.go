@@ -112,14 +112,13 @@ func StoreStateDataAndTransaction(dbStore store.Store, sd StateData,
 		}
 
 		// See if there is an existing entry and update the store count.
-		existingData, err := txn.ReadAll(key)
-		if err == nil {
-			var existing StateData
-			err := json.Unmarshal(existingData, &existing)
+		_ = store.ReadLent(txn, key, func(existingData []byte) error {
+			existing, err := DecodeStateData(existingData)
 			if err == nil {
 				sd.UpdateInfo.StateDataStoreCount = existing.UpdateInfo.StateDataStoreCount
 			}
-		}
+			return nil
+		})
 
 		if sd.UpdateInfo.StateDataStoreCount >= MaximumStateDataStoreCount {
 			// Reset store count to prevent subsequent states from
@@ -132,7 +131,7 @@ func StoreStateDataAndTransaction(dbStore store.Store, sd StateData,
 			sd.UpdateInfo.StateDataStoreCount++
 		}
 
-		data, err := json.Marshal(sd)
+		data, err := EncodeStateData(sd)
 		if err != nil {
 			return err
 		}
@@ -156,19 +155,12 @@ func StoreStateDataAndTransaction(dbStore store.Store, sd StateData,
 func loadStateData(txn store.Transaction, key string) (StateData, error) {
 	var sd StateData
 
-	data, err := txn.ReadAll(key)
-	if err != nil {
-		return sd, err
-	}
-
-	// We are relying on the fact that Unmarshal will decode all and only
-	// the fields that it can find in the destination type.
-	err = json.Unmarshal(data, &sd)
-	if err != nil {
-		return sd, err
-	}
-
-	return sd, nil
+	err := store.ReadLent(txn, key, func(data []byte) error {
+		var err error
+		sd, err = DecodeStateData(data)
+		return err
+	})
+	return sd, err
 }
 
 func LoadStateData(dbStore store.Store) (StateData, error) {
@@ -184,8 +176,8 @@ func LoadStateData(dbStore store.Store) (StateData, error) {
 			return err
 		}
 
-		switch sd.Version {
-		case 0, 1:
+		switch version := sd.Version; version {
+		case 0, 1, 2:
 			// We need to upgrade the schema. Check if we have
 			// already written an updated one.
 			uncommSd, err := loadStateData(txn, StateDataKeyUncommitted)
@@ -201,18 +193,24 @@ func LoadStateData(dbStore store.Store) (StateData, error) {
 				return err
 			}
 
-			// If we are upgrading the schema, we know for a fact
-			// that we came from a rootfs-image update, because it
-			// was the only thing that was supported there. Store
-			// this, since this information will be missing in
-			// databases before version 2.
-			sd.UpdateInfo.Artifact.PayloadTypes = []string{"rootfs-image"}
-			sd.UpdateInfo.RebootRequested = []RebootType{RebootTypeCustom}
-			sd.UpdateInfo.SupportsRollback = RollbackSupported
+			if version < 2 {
+				// If we are upgrading the schema from before
+				// version 2, we know for a fact that we came
+				// from a rootfs-image update, because it was
+				// the only thing that was supported there.
+				// Store this, since this information will be
+				// missing in the database.
+				sd.UpdateInfo.Artifact.PayloadTypes = []string{"rootfs-image"}
+				sd.UpdateInfo.RebootRequested = []RebootType{RebootTypeCustom}
+				sd.UpdateInfo.SupportsRollback = RollbackSupported
+			}
 
+			// Version 2 only differs in its encoding. A client
+			// that we roll back to may not read the new one, so
+			// the committed entry is kept for it.
 			sd.UpdateInfo.HasDBSchemaUpdate = true
 
-		case 2:
+		case StateDataVersion:
 			sd.UpdateInfo.HasDBSchemaUpdate = false
 
 		default:
@@ -233,7 +231,7 @@ func LoadStateData(dbStore store.Store) (StateData, error) {
 		// reboots, which should never loop indefinitely.
 		sd.UpdateInfo.StateDataStoreCount++
 
-		data, err := json.Marshal(sd)
+		data, err := EncodeStateData(sd)
 		if err != nil {
 			return err
 		}
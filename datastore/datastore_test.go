@@ -0,0 +1,174 @@
+// Copyright 2023 Northern.tech AS
+//
+//    Licensed under the Apache License, Version 2.0 (the "License");
+//    you may not use this file except in compliance with the License.
+//    You may obtain a copy of the License at
+//
+//        http://www.apache.org/licenses/LICENSE-2.0
+//
+//    Unless required by applicable law or agreed to in writing, software
+//    distributed under the License is distributed on an "AS IS" BASIS,
+//    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//    See the License for the specific language governing permissions and
+//    limitations under the License.
+package datastore
+
+import (
+	"encoding/json"
+	"io/ioutil"
+	"os"
+	"testing"
+	"time"
+
+	"github.com/stretchr/testify/assert"
+	"github.com/stretchr/testify/require"
+
+	"github.com/mendersoftware/mender/store"
+)
+
+func TestLoadStateDataMigratesEncoding(t *testing.T) {
+	ms := store.NewMemStore()
+
+	// Stored by a client using JSON.
+	sd := StateData{
+		Version: 2,
+		Name:    MenderStateReboot,
+		UpdateInfo: UpdateInfo{
+			ID:                  "abc",
+			StateDataStoreCount: 3,
+		},
+	}
+	committed, err := json.Marshal(sd)
+	require.NoError(t, err)
+	require.NoError(t, ms.WriteAll(StateDataKey, committed))
+
+	sd, err = LoadStateData(ms)
+	require.NoError(t, err)
+	assert.Equal(t, StateDataVersion, sd.Version)
+	assert.Equal(t, MenderStateReboot, sd.Name)
+	assert.Equal(t, 4, sd.UpdateInfo.StateDataStoreCount)
+	assert.True(t, sd.UpdateInfo.HasDBSchemaUpdate)
+
+	// The committed entry is kept for a rollback to the old client, and
+	// the new encoding is used for the uncommitted one.
+	data, err := ms.ReadAll(StateDataKey)
+	require.NoError(t, err)
+	assert.Equal(t, committed, data)
+	data, err = ms.ReadAll(StateDataKeyUncommitted)
+	require.NoError(t, err)
+	assert.Equal(t, stateDataMagic, string(data[:len(stateDataMagic)]))
+
+	sd.Name = MenderStateAfterReboot
+	require.NoError(t, StoreStateData(ms, sd, true))
+	sd, err = LoadStateData(ms)
+	require.NoError(t, err)
+	assert.Equal(t, MenderStateAfterReboot, sd.Name)
+	assert.Equal(t, 6, sd.UpdateInfo.StateDataStoreCount)
+	assert.True(t, sd.UpdateInfo.HasDBSchemaUpdate)
+
+	// After the commit, only the new encoding is left.
+	sd.UpdateInfo.HasDBSchemaUpdate = false
+	require.NoError(t, StoreStateData(ms, sd, true))
+	_, err = ms.ReadAll(StateDataKeyUncommitted)
+	assert.True(t, os.IsNotExist(err))
+	data, err = ms.ReadAll(StateDataKey)
+	require.NoError(t, err)
+	decoded, err := DecodeStateData(data)
+	require.NoError(t, err)
+	assert.Equal(t, StateDataVersion, decoded.Version)
+	assert.False(t, decoded.UpdateInfo.HasDBSchemaUpdate)
+}
+
+// BenchmarkDeploymentStateStorage stores the state data of the transitions of
+// a rootfs deployment, with a control map refresh after each, as with update
+// control, followed by the idle state and an inventory submit. It reports the
+// transitions per second, and the number of database commits, which each
+// sync the database file, per deployment.
+func BenchmarkDeploymentStateStorage(b *testing.B) {
+	deployment := []MenderState{
+		MenderStateUpdateFetch,
+		MenderStateUpdateStore,
+		MenderStateUpdateAfterStore,
+		MenderStateUpdateInstall,
+		MenderStateReboot,
+		MenderStateVerifyReboot,
+		MenderStateAfterReboot,
+		MenderStateUpdateCommit,
+		MenderStateUpdateAfterFirstCommit,
+		MenderStateUpdateAfterCommit,
+		MenderStateUpdateStatusReport,
+		MenderStateUpdateCleanup,
+	}
+	updateInfo := UpdateInfo{
+		ID: "f3a3c76f-1c3a-4b84-b6a1-0ad5c2a7b8e5",
+		Artifact: Artifact{
+			CompatibleDevices: []string{"raspberrypi4"},
+			PayloadTypes:      []string{"rootfs-image"},
+			ArtifactName:      "release-2",
+			TypeInfoProvides: map[string]string{
+				"rootfs-image.checksum": "9f86d081884c7d659a2feaa0c55ad015a3bf4f1b2b0b822cd15d6c15b0f00a08",
+				"rootfs-image.version":  "release-2",
+			},
+		},
+		RebootRequested:  RebootRequestedType{RebootTypeAutomatic},
+		SupportsRollback: RollbackSupported,
+	}
+	updateInfo.Artifact.Source.URI = "https://s3.example.com/mender-artifacts/" +
+		"f3a3c76f-1c3a-4b84-b6a1-0ad5c2a7b8e5?X-Amz-Expires=86400&X-Amz-Signature=" +
+		"0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef"
+	controlMaps := []byte(`{"active":[{"id":"f3a3c76f-1c3a-4b84-b6a1-0ad5c2a7b8e5",` +
+		`"priority":0,"states":{"ArtifactReboot_Enter":{"action":"continue"}}}],"expired":[]}`)
+	inventoryDigest := make([]byte, 2048)
+
+	benchmarks := []struct {
+		name        string
+		version     int
+		groupCommit bool
+	}{
+		// As before: JSON, and every write committed on its own.
+		{name: "json-sync", version: 2},
+		{name: "binary-sync", version: StateDataVersion},
+		{name: "binary-group-commit", version: StateDataVersion, groupCommit: true},
+	}
+	for _, bm := range benchmarks {
+		b.Run(bm.name, func(b *testing.B) {
+			tmpdir, err := ioutil.TempDir("", "mender-datastore-")
+			require.NoError(b, err)
+			defer os.RemoveAll(tmpdir)
+
+			db := store.NewDBStore(tmpdir)
+			require.NotNil(b, db)
+			defer db.Close()
+			if bm.groupCommit {
+				require.NoError(b, db.EnableGroupCommit(time.Hour))
+			}
+
+			b.ResetTimer()
+			start := time.Now()
+			startCommits := db.Commits()
+			for i := 0; i < b.N; i++ {
+				for _, state := range deployment {
+					err := StoreStateData(db, StateData{
+						Version:    bm.version,
+						Name:       state,
+						UpdateInfo: updateInfo,
+					}, true)
+					require.NoError(b, err)
+					require.NoError(b, store.WriteAllDeferred(db,
+						UpdateControlMaps, controlMaps))
+				}
+				require.NoError(b, db.Remove(StateDataKey))
+				require.NoError(b, store.WriteAllDeferred(db,
+					SubmittedInventoryKey, inventoryDigest))
+				// The group commit deadline expires once per
+				// deployment.
+				require.NoError(b, db.Flush())
+			}
+			elapsed := time.Since(start)
+			commits := db.Commits() - startCommits
+
+			b.ReportMetric(float64(b.N*(len(deployment)+1))/elapsed.Seconds(), "transitions/s")
+			b.ReportMetric(float64(commits)/float64(b.N), "fsyncs/deployment")
+		})
+	}
+}
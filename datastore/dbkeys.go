@@ -41,7 +41,8 @@ const (
 	StandaloneStateKey = "standalone-state"
 
 	// Name of key that state data is stored under across reboots. Uses the
-	// StateData structure, marshalled to JSON.
+	// StateData structure, encoded with EncodeStateData: in JSON before
+	// StateDataVersion 3, and in a binary encoding since.
 	StateDataKey = "state"
 
 	// Added together with update modules in v2.0.0. This key is invoked if,
@@ -59,6 +60,17 @@ const (
 	// in memory.
 	UpdateControlMaps = "update-control-maps"
 
+	// Followed by the device path of a rootfs partition. Holds the hashes
+	// of the frames last written to that partition, in the binary format
+	// of installer.FrameIndex. Removed before the partition is written, and
+	// stored again once the write has completed.
+	RootfsFrameIndexKeyPrefix = "rootfs-frame-index:"
+
+	// Describes the inventory last submitted successfully, as the JSON of
+	// inventory.SubmittedInventory. Used to skip submitting an unchanged
+	// inventory, and to only submit the attributes which changed.
+	SubmittedInventoryKey = "submitted-inventory"
+
 	// ---------------------- NOT IN USE ANYMORE --------------------------
 
 	// Key used to store the auth token.
@@ -38,7 +38,9 @@ type StateData struct {
 // current version of the format of StateData;
 // increase the version number once the format of StateData is changed
 // StateDataVersion = 2 was introduced in Mender 2.0.0.
-const StateDataVersion = 2
+// StateDataVersion = 3 replaced the JSON encoding with a binary one, see
+// EncodeStateData.
+const StateDataVersion = 3
 
 type MenderState int
 
@@ -189,13 +191,21 @@ func (m *MenderState) UnmarshalJSON(data []byte) error {
 	if err != nil {
 		return err
 	}
+	state, err := menderStateByName(s)
+	if err != nil {
+		return err
+	}
+	*m = state
+	return nil
+}
+
+func menderStateByName(s string) (MenderState, error) {
 	for k, v := range stateNames {
 		if v == s {
-			*m = k
-			return nil
+			return k, nil
 		}
 	}
-	return fmt.Errorf("unmarshal error; unknown state %s", s)
+	return MenderStateInit, fmt.Errorf("unmarshal error; unknown state %s", s)
 }
 
 type SupportsRollbackType string
@@ -0,0 +1,287 @@
+// Copyright 2023 Northern.tech AS
+//
+//    Licensed under the Apache License, Version 2.0 (the "License");
+//    you may not use this file except in compliance with the License.
+//    You may obtain a copy of the License at
+//
+//        http://www.apache.org/licenses/LICENSE-2.0
+//
+//    Unless required by applicable law or agreed to in writing, software
+//    distributed under the License is distributed on an "AS IS" BASIS,
+//    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//    See the License for the specific language governing permissions and
+//    limitations under the License.
+package datastore
+
+import (
+	"encoding/binary"
+	"encoding/json"
+	"sort"
+
+	"github.com/pkg/errors"
+)
+
+// State data of version 3 and later is stored in a binary encoding: the magic
+// below, the version as a varint, and then the fields of StateData in order.
+// Strings are a uvarint length followed by the bytes. Lists and maps are a
+// uvarint count, plus one so that nil and empty lists stay distinct like in
+// JSON, followed by the elements. Later versions may only append fields.
+// Older versions are stored as JSON, which never starts with the magic.
+const (
+	stateDataMagic = "\x00msd"
+
+	// First version stored in the binary encoding.
+	binaryStateDataVersion = 3
+)
+
+var errCorruptStateData = errors.New("corrupt state data")
+
+// EncodeStateData encodes 'sd' in the format of its version.
+func EncodeStateData(sd StateData) ([]byte, error) {
+	if sd.Version < binaryStateDataVersion {
+		return json.Marshal(sd)
+	}
+
+	name, ok := stateNames[sd.Name]
+	if !ok {
+		return nil, errors.Errorf("marshal error; unknown state %v", sd.Name)
+	}
+
+	e := stateDataEncoder{buf: make([]byte, 0, 256)}
+	e.buf = append(e.buf, stateDataMagic...)
+	e.varint(int64(sd.Version))
+	e.string(name)
+
+	ui := &sd.UpdateInfo
+	e.string(ui.Artifact.Source.URI)
+	e.string(ui.Artifact.Source.Expire)
+	e.strings(ui.Artifact.CompatibleDevices)
+	e.strings(ui.Artifact.PayloadTypes)
+	e.string(ui.Artifact.ArtifactName)
+	e.string(ui.Artifact.ArtifactGroup)
+	e.stringMap(ui.Artifact.TypeInfoProvides)
+	if len(ui.Artifact.ClearsArtifactProvides) > 0 {
+		e.strings(ui.Artifact.ClearsArtifactProvides)
+	} else {
+		// Omitted when empty, like in JSON.
+		e.strings(nil)
+	}
+	e.string(ui.ID)
+	if ui.RebootRequested == nil {
+		e.uvarint(0)
+	} else {
+		e.uvarint(uint64(len(ui.RebootRequested)) + 1)
+		for _, r := range ui.RebootRequested {
+			e.string(string(r))
+		}
+	}
+	e.string(string(ui.SupportsRollback))
+	e.varint(int64(ui.StateDataStoreCount))
+	e.bool(ui.HasDBSchemaUpdate)
+
+	return e.buf, nil
+}
+
+// DecodeStateData decodes state data of any version. 'data' is not retained,
+// so it may be lent by the store.
+func DecodeStateData(data []byte) (StateData, error) {
+	var sd StateData
+	if len(data) < len(stateDataMagic) || string(data[:len(stateDataMagic)]) != stateDataMagic {
+		// We are relying on the fact that Unmarshal will decode all
+		// and only the fields that it can find in the destination
+		// type.
+		err := json.Unmarshal(data, &sd)
+		return sd, err
+	}
+
+	d := stateDataDecoder{data: data[len(stateDataMagic):]}
+	sd.Version = int(d.varint())
+	if d.err == nil && (sd.Version < binaryStateDataVersion || sd.Version > StateDataVersion) {
+		return sd, errors.New("unsupported state data version")
+	}
+	if name := d.string(); d.err == nil {
+		if sd.Name, d.err = menderStateByName(name); d.err != nil {
+			return sd, d.err
+		}
+	}
+
+	ui := &sd.UpdateInfo
+	ui.Artifact.Source.URI = d.string()
+	ui.Artifact.Source.Expire = d.string()
+	ui.Artifact.CompatibleDevices = d.strings()
+	ui.Artifact.PayloadTypes = d.strings()
+	ui.Artifact.ArtifactName = d.string()
+	ui.Artifact.ArtifactGroup = d.string()
+	ui.Artifact.TypeInfoProvides = d.stringMap()
+	ui.Artifact.ClearsArtifactProvides = d.strings()
+	ui.ID = d.string()
+	if n := d.count(); n >= 0 {
+		ui.RebootRequested = make(RebootRequestedType, n)
+		for i := range ui.RebootRequested {
+			ui.RebootRequested[i] = RebootType(d.string())
+		}
+	}
+	ui.SupportsRollback = SupportsRollbackType(d.string())
+	ui.StateDataStoreCount = int(d.varint())
+	ui.HasDBSchemaUpdate = d.bool()
+
+	return sd, d.err
+}
+
+type stateDataEncoder struct {
+	buf []byte
+}
+
+func (e *stateDataEncoder) uvarint(v uint64) {
+	var tmp [binary.MaxVarintLen64]byte
+	n := binary.PutUvarint(tmp[:], v)
+	e.buf = append(e.buf, tmp[:n]...)
+}
+
+func (e *stateDataEncoder) varint(v int64) {
+	var tmp [binary.MaxVarintLen64]byte
+	n := binary.PutVarint(tmp[:], v)
+	e.buf = append(e.buf, tmp[:n]...)
+}
+
+func (e *stateDataEncoder) bool(v bool) {
+	if v {
+		e.buf = append(e.buf, 1)
+	} else {
+		e.buf = append(e.buf, 0)
+	}
+}
+
+func (e *stateDataEncoder) string(s string) {
+	e.uvarint(uint64(len(s)))
+	e.buf = append(e.buf, s...)
+}
+
+func (e *stateDataEncoder) strings(ss []string) {
+	if ss == nil {
+		e.uvarint(0)
+		return
+	}
+	e.uvarint(uint64(len(ss)) + 1)
+	for _, s := range ss {
+		e.string(s)
+	}
+}
+
+func (e *stateDataEncoder) stringMap(m map[string]string) {
+	// Omitted when empty, like in JSON.
+	if len(m) == 0 {
+		e.uvarint(0)
+		return
+	}
+	keys := make([]string, 0, len(m))
+	for k := range m {
+		keys = append(keys, k)
+	}
+	sort.Strings(keys)
+	e.uvarint(uint64(len(keys)) + 1)
+	for _, k := range keys {
+		e.string(k)
+		e.string(m[k])
+	}
+}
+
+// stateDataDecoder decodes the fields of binary state data in turn. After
+// the first error, all fields decode as zero values.
+type stateDataDecoder struct {
+	data []byte
+	err  error
+}
+
+func (d *stateDataDecoder) uvarint() uint64 {
+	if d.err != nil {
+		return 0
+	}
+	v, n := binary.Uvarint(d.data)
+	if n <= 0 {
+		d.err = errCorruptStateData
+		return 0
+	}
+	d.data = d.data[n:]
+	return v
+}
+
+func (d *stateDataDecoder) varint() int64 {
+	if d.err != nil {
+		return 0
+	}
+	v, n := binary.Varint(d.data)
+	if n <= 0 {
+		d.err = errCorruptStateData
+		return 0
+	}
+	d.data = d.data[n:]
+	return v
+}
+
+func (d *stateDataDecoder) bool() bool {
+	if d.err != nil {
+		return false
+	}
+	if len(d.data) == 0 || d.data[0] > 1 {
+		d.err = errCorruptStateData
+		return false
+	}
+	v := d.data[0] == 1
+	d.data = d.data[1:]
+	return v
+}
+
+// string copies the string out of the data.
+func (d *stateDataDecoder) string() string {
+	n := d.uvarint()
+	if d.err != nil {
+		return ""
+	}
+	if n > uint64(len(d.data)) {
+		d.err = errCorruptStateData
+		return ""
+	}
+	s := string(d.data[:n])
+	d.data = d.data[n:]
+	return s
+}
+
+// count returns the number of elements of a list or map, or -1 for nil.
+func (d *stateDataDecoder) count() int {
+	n := d.uvarint()
+	if d.err != nil || n == 0 {
+		return -1
+	}
+	// Each element takes at least one byte.
+	if n-1 > uint64(len(d.data)) {
+		d.err = errCorruptStateData
+		return -1
+	}
+	return int(n - 1)
+}
+
+func (d *stateDataDecoder) strings() []string {
+	n := d.count()
+	if n < 0 {
+		return nil
+	}
+	ss := make([]string, n)
+	for i := range ss {
+		ss[i] = d.string()
+	}
+	return ss
+}
+
+func (d *stateDataDecoder) stringMap() map[string]string {
+	n := d.count()
+	if n < 0 {
+		return nil
+	}
+	m := make(map[string]string, n)
+	for i := 0; i < n; i++ {
+		k := d.string()
+		m[k] = d.string()
+	}
+	return m
+}
@@ -15,9 +15,12 @@ package datastore
 
 import (
 	"encoding/json"
+	"fmt"
+	"reflect"
 	"testing"
 
 	"github.com/stretchr/testify/assert"
+	"github.com/stretchr/testify/require"
 )
 
 func TestMenderState(t *testing.T) {
@@ -36,3 +39,147 @@ func TestMenderState(t *testing.T) {
 	assert.NoError(t, err)
 	assert.Equal(t, MenderStateInit, s)
 }
+
+func TestStateDataEncoding(t *testing.T) {
+	full := StateData{
+		Version: StateDataVersion,
+		Name:    MenderStateUpdateAfterFirstCommit,
+		UpdateInfo: UpdateInfo{
+			ID: "abc",
+			Artifact: Artifact{
+				CompatibleDevices:      []string{"dev1", "dev2"},
+				PayloadTypes:           []string{"rootfs-image"},
+				ArtifactName:           "name",
+				ArtifactGroup:          "group",
+				TypeInfoProvides:       map[string]string{"b": "2", "a": "1"},
+				ClearsArtifactProvides: []string{"rootfs-image.*"},
+			},
+			RebootRequested:     RebootRequestedType{RebootTypeNone, RebootTypeAutomatic},
+			SupportsRollback:    RollbackSupported,
+			StateDataStoreCount: 7,
+			HasDBSchemaUpdate:   true,
+		},
+	}
+	full.UpdateInfo.Artifact.Source.URI = "https://example.com/artifact"
+	full.UpdateInfo.Artifact.Source.Expire = "never"
+
+	empty := StateData{
+		Version: StateDataVersion,
+		UpdateInfo: UpdateInfo{
+			Artifact: Artifact{
+				CompatibleDevices: []string{},
+			},
+			RebootRequested: RebootRequestedType{},
+		},
+	}
+
+	for name, sd := range map[string]StateData{"full": full, "empty": empty} {
+		t.Run(name, func(t *testing.T) {
+			data, err := EncodeStateData(sd)
+			require.NoError(t, err)
+			assert.Equal(t, stateDataMagic, string(data[:len(stateDataMagic)]))
+
+			decoded, err := DecodeStateData(data)
+			require.NoError(t, err)
+			assert.Equal(t, sd, decoded)
+
+			// Same result as a JSON round trip.
+			jsonData, err := json.Marshal(sd)
+			require.NoError(t, err)
+			var jsonDecoded StateData
+			require.NoError(t, json.Unmarshal(jsonData, &jsonDecoded))
+			assert.Equal(t, jsonDecoded, decoded)
+			assert.Less(t, len(data), len(jsonData))
+
+			// Truncated data is detected.
+			for i := len(stateDataMagic); i < len(data); i++ {
+				_, err = DecodeStateData(data[:i])
+				assert.Error(t, err, "truncated at %d", i)
+			}
+		})
+	}
+
+	t.Run("old versions", func(t *testing.T) {
+		sd := full
+		sd.Version = 2
+		data, err := EncodeStateData(sd)
+		require.NoError(t, err)
+		assert.Contains(t, string(data), `"Name":"update-after-first-commit"`)
+
+		decoded, err := DecodeStateData(data)
+		require.NoError(t, err)
+		assert.Equal(t, sd, decoded)
+	})
+
+	t.Run("unknown", func(t *testing.T) {
+		sd := full
+		sd.Version = StateDataVersion + 1
+		data, err := EncodeStateData(sd)
+		require.NoError(t, err)
+		_, err = DecodeStateData(data)
+		assert.EqualError(t, err, "unsupported state data version")
+
+		sd.Version = StateDataVersion
+		sd.Name = MenderState(333)
+		_, err = EncodeStateData(sd)
+		assert.Error(t, err)
+	})
+}
+
+// fillStateData sets every field under 'v' to a distinct non-zero value, and
+// fails on kinds it does not know, so that new fields are never left out.
+func fillStateData(t *testing.T, v reflect.Value, path string, n *int) {
+	*n++
+	switch v.Kind() {
+	case reflect.Struct:
+		for i := 0; i < v.NumField(); i++ {
+			field := v.Type().Field(i)
+			if field.PkgPath != "" {
+				// Unexported; not stored in JSON either.
+				continue
+			}
+			fillStateData(t, v.Field(i), path+"."+field.Name, n)
+		}
+	case reflect.String:
+		v.SetString(fmt.Sprintf("%s-%d", path, *n))
+	case reflect.Int, reflect.Int8, reflect.Int16, reflect.Int32, reflect.Int64:
+		v.SetInt(int64(*n))
+	case reflect.Bool:
+		v.SetBool(true)
+	case reflect.Slice:
+		v.Set(reflect.MakeSlice(v.Type(), 2, 2))
+		for i := 0; i < v.Len(); i++ {
+			fillStateData(t, v.Index(i), fmt.Sprintf("%s[%d]", path, i), n)
+		}
+	case reflect.Map:
+		v.Set(reflect.MakeMap(v.Type()))
+		for i := 0; i < 2; i++ {
+			key := reflect.New(v.Type().Key()).Elem()
+			fillStateData(t, key, fmt.Sprintf("%s.key", path), n)
+			elem := reflect.New(v.Type().Elem()).Elem()
+			fillStateData(t, elem, fmt.Sprintf("%s[%d]", path, i), n)
+			v.SetMapIndex(key, elem)
+		}
+	default:
+		t.Fatalf("%s: %s fields are not handled by EncodeStateData, nor by this test",
+			path, v.Kind())
+	}
+}
+
+// TestStateDataEncodingAllFields guards against fields being added to
+// StateData, or UpdateInfo, without being added to the binary encoding, which
+// would silently lose them across a reboot.
+func TestStateDataEncodingAllFields(t *testing.T) {
+	var sd StateData
+	var n int
+	fillStateData(t, reflect.ValueOf(&sd).Elem(), "StateData", &n)
+	// These must be valid.
+	sd.Version = StateDataVersion
+	sd.Name = MenderStateUpdateCommit
+
+	data, err := EncodeStateData(sd)
+	require.NoError(t, err)
+	decoded, err := DecodeStateData(data)
+	require.NoError(t, err)
+	assert.Equal(t, sd, decoded)
+}
@@ -57,6 +57,7 @@ func NewDeviceManager(
 		DualRootfs: dualRootfsDevice,
 		Modules: installer.NewModuleInstallerFactory(config.ModulesPath,
 			config.ModulesWorkPath, d, d, config.ModuleTimeoutSeconds),
+		Pipeline: config.PayloadPipeline,
 	}
 
 	return d
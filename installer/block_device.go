@@ -19,10 +19,13 @@ import (
 	"os"
 	"path/filepath"
 	"syscall"
+	"time"
 
 	"github.com/pkg/errors"
 	log "github.com/sirupsen/logrus"
 
+	"github.com/mendersoftware/mender/conf"
+	"github.com/mendersoftware/mender/store"
 	"github.com/mendersoftware/mender/system"
 	"github.com/mendersoftware/mender/utils"
 )
@@ -53,17 +56,28 @@ type BlockDeviceGetSectorSizeFunc func(file *os.File) (int, error)
 type BlockDevice struct {
 	Path string // Device path, ex. /dev/mmcblk0p1
 	w    io.WriteCloser
+
+	// Set when the frame index of the device is to be stored on Close.
+	pw         *PipelinedBlockDeviceWriter
+	indexStore store.Store
 }
 
 type bdevice int
 
 // Give the block-device a package-like interface,
-// i.e., blockdevice.Open(partition, size)
+// i.e., blockdevice.Open(partition, size, config)
 var blockdevice bdevice
 
 // Open tries to open the 'device' (/dev/<device> usually), and returns a
-// BlockDevice.
-func (bd bdevice) Open(device string, size int64) (*BlockDevice, error) {
+// BlockDevice. The 'config' selects and tunes the write path used for
+// non-UBI devices. If 'indexStore' is not nil, it keeps the frame index of the
+// device between updates.
+func (bd bdevice) Open(
+	device string,
+	size int64,
+	config conf.RootfsWriterConfig,
+	indexStore store.Store,
+) (*BlockDevice, error) {
 	log.Infof("Opening device %q for writing", device)
 
 	var out *os.File
@@ -152,8 +166,25 @@ func (bd bdevice) Open(device string, size int64) (*BlockDevice, error) {
 		chunkSize,
 	)
 
+	directIO := config.DirectIO && !typeUBI
+	if directIO && chunkSize%nativeSsz != 0 {
+		log.Warnf("Chunk size %d of device %s is not sector aligned. "+
+			"Not using direct I/O", chunkSize, device)
+		directIO = false
+	}
+	if directIO {
+		flag |= syscall.O_DIRECT
+	}
+
 	log.Debugf("Opening device: %s for writing with flag: %d", device, flag)
 	out, err = os.OpenFile(device, flag, 0)
+	if err != nil && directIO && errors.Is(err, syscall.EINVAL) {
+		log.Warnf("Device %s does not support direct I/O. "+
+			"Falling back to buffered I/O", device)
+		directIO = false
+		flag &^= syscall.O_DIRECT
+		out, err = os.OpenFile(device, flag, 0)
+	}
 	if err != nil {
 		return nil, errors.Wrapf(err, "Failed to open the device: %q", device)
 	}
@@ -182,8 +213,25 @@ func (bd bdevice) Open(device string, size int64) (*BlockDevice, error) {
 		}
 	}
 
+	// The device is about to change. Drop its index, so that an
+	// interrupted write does not leave a stale one behind.
+	var index *FrameIndex
+	if indexStore != nil {
+		index = LoadFrameIndex(indexStore, device)
+		if err = RemoveFrameIndex(indexStore, device); err != nil {
+			out.Close()
+			return nil, errors.Wrapf(err, "Failed to remove the frame index of %q", device)
+		}
+	}
+	if index != nil && (config.DisableFrameIndex || config.Sequential ||
+		!index.Matches(out, chunkSize, alignedBuffer(chunkSize))) {
+		log.Infof("The frame index of %s is stale. "+
+			"Comparing the update with the contents of the device", device)
+		index = nil
+	}
+
 	var bdw io.WriteCloser
-	if !typeUBI {
+	if !typeUBI && config.Sequential {
 		//
 		// FlushingWriter is needed due to a driver bug in the linux emmc driver
 		// OOM errors.
@@ -209,6 +257,27 @@ func (bd bdevice) Open(device string, size int64) (*BlockDevice, error) {
 			buf:       bytes.NewBuffer(nil),
 			w:         odw,
 		}
+	} else if !typeUBI {
+		//
+		// Reads ahead, compares and writes dirty frames with positioned
+		// writes. Owns the block-device.
+		//
+		pw := NewPipelinedBlockDeviceWriter(out, PipelinedWriterOptions{
+			FrameSize:         chunkSize,
+			SectorSize:        nativeSsz,
+			Size:              size,
+			ReadAheadFrames:   config.ReadAheadFrames,
+			SyncIntervalBytes: config.SyncIntervalBytes,
+			SyncInterval:      time.Duration(config.SyncIntervalSeconds) * time.Second,
+			DirectIO:          directIO,
+			Index:             index,
+			Discard:           discardFunc(out, config.DiscardZeroFrames),
+		})
+		if indexStore != nil && !config.DisableFrameIndex {
+			b.pw = pw
+			b.indexStore = indexStore
+		}
+		bdw = pw
 	} else {
 		// No optimized writes possible on UBI (Mirza)
 		// All the bytes have to be written
@@ -237,6 +306,18 @@ func (bd bdevice) Open(device string, size int64) (*BlockDevice, error) {
 //                   |
 //                   |
 //                   v
+//          PipelinedBlockDeviceWriter
+//       Buffers the writes into 'chunkSize' frames, and
+//       compares each of them with the same frame on the
+//       block-device, which has been read ahead by a
+//       separate goroutine. Only dirty frames are written,
+//       using positioned writes, and Sync() is called on a
+//       byte and time budget.
+//       Note: This is not done for UBI volumes
+//
+// When the 'Sequential' write path is configured, the PipelinedBlockDeviceWriter
+// is replaced by the following chain:
+//
 //              BlockFrameWriter
 //       Buffers the writes into 'chunkSize' frames
 //       for writing to the underlying writer.
@@ -245,7 +326,6 @@ func (bd bdevice) Open(device string, size int64) (*BlockDevice, error) {
 //                   v
 //             OptimizedBlockDeviceWriter
 //       Only writes dirty frames to the underlying block-device.
-//       Note: This is not done for UBI volumes
 //                   |
 //                   |
 //                   v
@@ -271,7 +351,35 @@ func (bd *BlockDevice) Close() error {
 	if bd.w == nil {
 		return nil
 	}
-	return bd.w.Close()
+	if err := bd.w.Close(); err != nil {
+		return err
+	}
+	if bd.pw != nil && !bd.pw.Complete() {
+		// Only part of the image was written, for instance because
+		// the artifact could not be read. The index stays removed.
+		log.Infof("The image was not fully written to %s. Not storing its frame index",
+			bd.Path)
+		bd.pw = nil
+	} else if bd.pw != nil {
+		err := StoreFrameIndex(bd.indexStore, bd.Path, bd.pw.FrameIndex())
+		if err != nil {
+			// Not fatal, the next update just has to read the device.
+			log.Warnf("Failed to store the frame index of %s: %v", bd.Path, err)
+		}
+		bd.pw = nil
+	}
+	return nil
+}
+
+// discardFunc returns a function which zeroes out a range of 'file', or nil if
+// discarding is not 'enabled'.
+func discardFunc(file *os.File, enabled bool) func(offset, length int64) error {
+	if !enabled {
+		return nil
+	}
+	return func(offset, length int64) error {
+		return system.ZeroOutBlockDeviceRange(file, uint64(offset), uint64(length))
+	}
 }
 
 // Size queries the size of the underlying block device. Automatically opens a
@@ -429,7 +537,9 @@ func (fw *FlushingWriter) Write(p []byte) (int, error) {
 }
 
 func (fw *FlushingWriter) Sync() error {
+	start := time.Now()
 	err := fw.BlockDevicer.Sync()
+	utils.Metrics.AddSince(utils.StageSync, int64(fw.unflushedBytesWritten), start)
 	fw.unflushedBytesWritten = 0
 	return err
 }
@@ -19,11 +19,18 @@ import (
 	"io/ioutil"
 	"os"
 	"path"
+	"runtime"
+	"syscall"
 	"testing"
+	"time"
 
 	"github.com/pkg/errors"
+	log "github.com/sirupsen/logrus"
 	"github.com/stretchr/testify/assert"
 	"github.com/stretchr/testify/require"
+
+	"github.com/mendersoftware/mender/conf"
+	"github.com/mendersoftware/mender/store"
 )
 
 func TestBlockDeviceFail(t *testing.T) {
@@ -97,7 +104,7 @@ func TestBlockDeviceWrite(t *testing.T) {
 	BlockDeviceGetSectorSizeOf = makeBlockDeviceSectorSize(t, 5, nil, bdpath)
 
 	// test simple write
-	bd, err := blockdevice.Open(bdpath, 10)
+	bd, err := blockdevice.Open(bdpath, 10, conf.RootfsWriterConfig{}, nil)
 	require.NoError(t, err, "Failed to open the blockdevice: %q", bdpath)
 
 	// Ensure that a standard write of < 10 bytes succeeds
@@ -329,3 +336,314 @@ func TestFlushingWriter(t *testing.T) {
 		assert.Equal(t, test.input, td.Bytes())
 	}
 }
+
+// Implements BlockDeviceFile
+type testDeviceFile struct {
+	*os.File
+	syncs int
+	reads int
+}
+
+func (tf *testDeviceFile) ReadAt(b []byte, off int64) (int, error) {
+	tf.reads += 1
+	return tf.File.ReadAt(b, off)
+}
+
+func (tf *testDeviceFile) Sync() error { tf.syncs += 1; return tf.File.Sync() }
+
+// failingDeviceFile fails the write at offset 'failAt', and counts the writes
+// and syncs after it.
+type failingDeviceFile struct {
+	testDeviceFile
+	failAt int64
+	failed bool
+	after  int
+}
+
+func (ff *failingDeviceFile) WriteAt(b []byte, off int64) (int, error) {
+	if ff.failed {
+		ff.after += 1
+	} else if off == ff.failAt {
+		ff.failed = true
+		return 0, syscall.EIO
+	}
+	return ff.testDeviceFile.WriteAt(b, off)
+}
+
+func (ff *failingDeviceFile) Sync() error {
+	if ff.failed {
+		ff.after += 1
+	}
+	return ff.testDeviceFile.Sync()
+}
+
+func TestPipelinedBlockDeviceWriter(t *testing.T) {
+
+	tests := map[string]struct {
+		disk              []byte
+		input             []byte
+		frameSize         int
+		syncIntervalBytes uint64
+		expectedFrames    int
+		expectedDirty     int
+		expectedSyncs     int
+	}{
+		"Verify dirty-frame writes": {
+			disk:           []byte("foobarfoobar"),
+			input:          []byte("foobazfoobar"),
+			frameSize:      3,
+			expectedFrames: 4,
+			expectedDirty:  1,
+			expectedSyncs:  1,
+		},
+
+		"Verify that clean frames are not written": {
+			disk:           []byte("foobarfoobar"),
+			input:          []byte("foobarfoobar"),
+			frameSize:      4,
+			expectedFrames: 3,
+			expectedDirty:  0,
+			expectedSyncs:  0,
+		},
+
+		"Partial last frame": {
+			disk:           []byte("foobarfoobar"),
+			input:          []byte("foobarfox"),
+			frameSize:      4,
+			expectedFrames: 3,
+			expectedDirty:  1,
+			expectedSyncs:  1,
+		},
+
+		"Device shorter than the image": {
+			disk:           []byte("foo"),
+			input:          []byte("foobarbaz"),
+			frameSize:      3,
+			expectedFrames: 3,
+			expectedDirty:  2,
+			expectedSyncs:  1,
+		},
+
+		"Sync on the byte budget": {
+			disk:              []byte("aaaaaaaaaaaa"),
+			input:             []byte("foobarfoobar"),
+			frameSize:         3,
+			syncIntervalBytes: 6,
+			expectedFrames:    4,
+			expectedDirty:     4,
+			expectedSyncs:     2,
+		},
+	}
+
+	for name, test := range tests {
+		t.Run(name, func(t *testing.T) {
+			td, err := ioutil.TempDir("", "mender-block-device-")
+			require.NoError(t, err)
+			defer os.RemoveAll(td)
+
+			bdpath := path.Join(td, "foo")
+			require.NoError(t, ioutil.WriteFile(bdpath, test.disk, 0644))
+			f, err := os.OpenFile(bdpath, os.O_RDWR, 0)
+			require.NoError(t, err)
+			file := &testDeviceFile{File: f}
+
+			pw := NewPipelinedBlockDeviceWriter(file, PipelinedWriterOptions{
+				FrameSize:         test.frameSize,
+				Size:              int64(len(test.input)),
+				SyncIntervalBytes: test.syncIntervalBytes,
+				SyncInterval:      time.Hour,
+			})
+
+			// Write in odd sized pieces to exercise the frame buffering.
+			for i := 0; i < len(test.input); i += 5 {
+				end := i + 5
+				if end > len(test.input) {
+					end = len(test.input)
+				}
+				n, err := pw.Write(test.input[i:end])
+				require.NoError(t, err)
+				assert.Equal(t, end-i, n)
+			}
+			require.NoError(t, pw.Close())
+
+			assert.Equal(t, test.expectedFrames, pw.totalFrames)
+			assert.Equal(t, test.expectedDirty, pw.dirtyFrames)
+			assert.Equal(t, test.expectedSyncs, file.syncs)
+
+			actual, err := ioutil.ReadFile(bdpath)
+			require.NoError(t, err)
+			expected := append([]byte(nil), test.input...)
+			if len(test.disk) > len(expected) {
+				expected = append(expected, test.disk[len(expected):]...)
+			}
+			assert.Equal(t, string(expected), string(actual))
+		})
+	}
+}
+
+func TestPipelinedBlockDeviceWriterWriteError(t *testing.T) {
+	td, err := ioutil.TempDir("", "mender-block-device-")
+	require.NoError(t, err)
+	defer os.RemoveAll(td)
+
+	// The first frame is dirty, and equal to the second one on the device.
+	bdpath := path.Join(td, "foo")
+	require.NoError(t, ioutil.WriteFile(bdpath, []byte("xxx\x00\x00\x00"), 0644))
+
+	for name, index := range map[string]*FrameIndex{
+		"read ahead": nil,
+		"index": {
+			FrameSize: 3,
+			ImageSize: 6,
+			Hashes:    []FrameHash{hashFrame([]byte("xxx")), hashFrame(make([]byte, 3))},
+		},
+	} {
+		t.Run(name, func(t *testing.T) {
+			f, err := os.OpenFile(bdpath, os.O_RDWR, 0)
+			require.NoError(t, err)
+			file := &failingDeviceFile{testDeviceFile: testDeviceFile{File: f}}
+			pw := NewPipelinedBlockDeviceWriter(file, PipelinedWriterOptions{
+				FrameSize:    3,
+				Size:         6,
+				SyncInterval: time.Hour,
+				Index:        index,
+			})
+			_, err = pw.Write(make([]byte, 3))
+			assert.Equal(t, syscall.EIO, err)
+			_, err = pw.Write(make([]byte, 3))
+			assert.Equal(t, syscall.EIO, err)
+			// The failed frame must not be compared with the next
+			// one on the device, and be taken as clean.
+			assert.Equal(t, syscall.EIO, pw.Close())
+			assert.Equal(t, syscall.EIO, pw.Close())
+			assert.Zero(t, file.after, "the device was used after the failed write")
+			assert.Empty(t, pw.FrameIndex().Hashes)
+			assert.Zero(t, pw.FrameIndex().ImageSize)
+		})
+	}
+}
+
+func TestPipelinedBlockDeviceWriterSequential(t *testing.T) {
+	td, err := ioutil.TempDir("", "mender-block-device-")
+	require.NoError(t, err)
+	defer os.RemoveAll(td)
+
+	bdpath := path.Join(td, "foo")
+	require.NoError(t, ioutil.WriteFile(bdpath, []byte("abxdrz1234"), 0644))
+
+	old := BlockDeviceGetSizeOf
+	oldSectorSize := BlockDeviceGetSectorSizeOf
+	defer func() {
+		BlockDeviceGetSizeOf = old
+		BlockDeviceGetSectorSizeOf = oldSectorSize
+	}()
+	BlockDeviceGetSizeOf = makeBlockDeviceSize(t, 10, nil, bdpath)
+	BlockDeviceGetSectorSizeOf = makeBlockDeviceSectorSize(t, 5, nil, bdpath)
+
+	bd, err := blockdevice.Open(bdpath, 10, conf.RootfsWriterConfig{Sequential: true}, nil)
+	require.NoError(t, err)
+	_, err = io.Copy(bd, bytes.NewBuffer([]byte("foobar")))
+	assert.NoError(t, err)
+	assert.NoError(t, bd.Close())
+
+	actualData, err := ioutil.ReadFile(bdpath)
+	assert.NoError(t, err)
+	assert.Equal(t, "foobar1234", string(actualData))
+}
+
+// benchmarkImage prepares a fake partition and an image of 'size' bytes, where
+// every other frame differs from what is already on the partition.
+func benchmarkImage(b *testing.B, size, frameSize int) (string, []byte) {
+	bdpath := path.Join(b.TempDir(), "partition")
+	image := make([]byte, size)
+	for i := range image {
+		image[i] = byte(i)
+	}
+	require.NoError(b, ioutil.WriteFile(bdpath, image, 0644))
+	for off := 0; off < size; off += 2 * frameSize {
+		image[off] ^= 0xff
+	}
+	return bdpath, image
+}
+
+// BenchmarkBlockDeviceWrite compares the sequential and the pipelined write
+// paths, writing to a regular file standing in for the inactive partition.
+// The indexed variant is the pipelined path with a frame index of the
+// partition, hence without reading it.
+func BenchmarkBlockDeviceWrite(b *testing.B) {
+	const (
+		imageSize = 64 * 1024 * 1024
+		sector    = 512
+	)
+
+	level := log.GetLevel()
+	log.SetLevel(log.WarnLevel)
+	defer log.SetLevel(level)
+
+	for _, mode := range []string{"sequential", "pipelined", "indexed"} {
+		b.Run(mode, func(b *testing.B) {
+			bdpath, image := benchmarkImage(b, imageSize, 1024*1024)
+
+			old := BlockDeviceGetSizeOf
+			oldSectorSize := BlockDeviceGetSectorSizeOf
+			defer func() {
+				BlockDeviceGetSizeOf = old
+				BlockDeviceGetSectorSizeOf = oldSectorSize
+			}()
+			BlockDeviceGetSizeOf = func(*os.File) (uint64, error) { return imageSize, nil }
+			BlockDeviceGetSectorSizeOf = func(*os.File) (int, error) { return sector, nil }
+
+			// Restore the partition so that every iteration sees
+			// the same share of dirty frames.
+			pristine, err := ioutil.ReadFile(bdpath)
+			require.NoError(b, err)
+
+			config := conf.RootfsWriterConfig{Sequential: mode == "sequential"}
+			var indexStore store.Store
+			var index []byte
+			if mode == "indexed" {
+				// Index the pristine partition by writing it
+				// onto itself.
+				indexStore = store.NewMemStore()
+				bd, err := blockdevice.Open(bdpath, imageSize, config, indexStore)
+				require.NoError(b, err)
+				_, err = bd.Write(pristine)
+				require.NoError(b, err)
+				require.NoError(b, bd.Close())
+				index, err = indexStore.ReadAll(frameIndexKey(bdpath))
+				require.NoError(b, err)
+			}
+
+			var allocs uint64
+			var stats runtime.MemStats
+			b.SetBytes(imageSize)
+			b.ReportAllocs()
+			b.ResetTimer()
+			for i := 0; i < b.N; i++ {
+				b.StopTimer()
+				require.NoError(b, ioutil.WriteFile(bdpath, pristine, 0644))
+				if indexStore != nil {
+					require.NoError(b, indexStore.WriteAll(frameIndexKey(bdpath), index))
+				}
+				runtime.ReadMemStats(&stats)
+				before := stats.Mallocs
+				b.StartTimer()
+
+				bd, err := blockdevice.Open(bdpath, imageSize, config, indexStore)
+				require.NoError(b, err)
+				// Feed the writer in 32 KiB pieces, like io.Copy.
+				for off := 0; off < imageSize; off += 32 * 1024 {
+					_, err = bd.Write(image[off : off+32*1024])
+					require.NoError(b, err)
+				}
+				require.NoError(b, bd.Close())
+
+				b.StopTimer()
+				runtime.ReadMemStats(&stats)
+				allocs += stats.Mallocs - before
+				b.StartTimer()
+			}
+			b.ReportMetric(float64(allocs)/float64(b.N)/(imageSize/(1024*1024)), "allocs/MB")
+		})
+	}
+}
@@ -0,0 +1,495 @@
+// Copyright 2023 Northern.tech AS
+//
+//    Licensed under the Apache License, Version 2.0 (the "License");
+//    you may not use this file except in compliance with the License.
+//    You may obtain a copy of the License at
+//
+//        http://www.apache.org/licenses/LICENSE-2.0
+//
+//    Unless required by applicable law or agreed to in writing, software
+//    distributed under the License is distributed on an "AS IS" BASIS,
+//    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//    See the License for the specific language governing permissions and
+//    limitations under the License.
+package installer
+
+import (
+	"bytes"
+	"io"
+	"os"
+	"time"
+	"unsafe"
+
+	"github.com/pkg/errors"
+	log "github.com/sirupsen/logrus"
+
+	"github.com/mendersoftware/mender/utils"
+)
+
+const (
+	// DefaultReadAheadFrames is the number of frames read from the
+	// block-device ahead of the frame currently being compared.
+	DefaultReadAheadFrames = 2
+	// DefaultSyncIntervalBytes is the number of dirty bytes written before
+	// the block-device is synced.
+	DefaultSyncIntervalBytes = 8 * 1024 * 1024
+	// DefaultSyncInterval is the maximum time between each sync.
+	DefaultSyncInterval = 2 * time.Second
+
+	// Memory alignment of the frame buffers. Satisfies O_DIRECT on all
+	// devices with a logical sector size up to a page.
+	frameBufferAlignment = 4096
+)
+
+// BlockDeviceFile is the subset of *os.File used by the
+// PipelinedBlockDeviceWriter. All I/O is positioned, hence the file offset is
+// never used.
+type BlockDeviceFile interface {
+	io.ReaderAt
+	io.WriterAt
+	io.Closer
+	Sync() error // Commits previously-written data to stable storage.
+}
+
+// PipelinedWriterOptions configures a PipelinedBlockDeviceWriter.
+type PipelinedWriterOptions struct {
+	// FrameSize is the size of each compared and written frame.
+	FrameSize int
+	// SectorSize is the logical sector size of the device. Only used to
+	// round up the last frame when DirectIO is set.
+	SectorSize int
+	// Size is the total number of bytes which will be written.
+	Size int64
+	// ReadAheadFrames is the number of frames read ahead of the current
+	// one. Zero selects DefaultReadAheadFrames.
+	ReadAheadFrames int
+	// SyncIntervalBytes is the number of dirty bytes written between each
+	// sync. Zero selects DefaultSyncIntervalBytes.
+	SyncIntervalBytes uint64
+	// SyncInterval is the maximum time between each sync. Zero selects
+	// DefaultSyncInterval.
+	SyncInterval time.Duration
+	// DirectIO must be set if the file is opened with O_DIRECT, in which
+	// case all I/O is done on sector aligned lengths.
+	DirectIO bool
+	// Index, if set, holds the verified hashes of the frames on the
+	// device. Frames are then compared against it, and the device is not
+	// read.
+	Index *FrameIndex
+	// Discard, if set, is called instead of writing full all-zero frames
+	// which are not already zero on the device. Such frames are never
+	// trusted to be clean by the next update, since the writer cannot
+	// know what the device returns for them.
+	Discard func(offset, length int64) error
+}
+
+// deviceFrame is a frame read from the block-device by the read-ahead
+// goroutine.
+type deviceFrame struct {
+	buf []byte
+	n   int
+	err error
+}
+
+// PipelinedBlockDeviceWriter writes only dirty frames to the block-device,
+// like the OptimizedBlockDeviceWriter, but without allocating per frame and
+// without waiting for the device read of each frame: a goroutine reads the
+// following frames of the device into a small pool of aligned buffers while
+// the current one is compared. Dirty frames are written with positioned
+// writes, and syncs are batched on a byte and time budget.
+//
+// If the options carry a FrameIndex of the device, frames are compared by
+// hash, and the device is not read at all. Either way, the hashes of the
+// written image are collected, and returned by FrameIndex.
+type PipelinedBlockDeviceWriter struct {
+	file BlockDeviceFile
+	opts PipelinedWriterOptions
+
+	// Frame currently being filled by Write.
+	frame []byte
+	fill  int
+
+	free  chan []byte
+	ahead chan deviceFrame
+	done  chan struct{}
+
+	zeros    []byte
+	zeroHash FrameHash
+	hashes   []FrameHash
+	// Frames hashed in the background while they are compared and
+	// written.
+	hashIn  chan []byte
+	hashOut chan FrameHash
+
+	offset          int64
+	unsynced        uint64
+	lastSync        time.Time
+	totalFrames     int
+	dirtyFrames     int
+	cleanFrames     int
+	zeroFrames      int
+	discardedFrames int
+	started         time.Time
+	closed          bool
+	// First error comparing, writing or syncing a frame. The frames read
+	// ahead no longer line up with the offset after it, so the device is
+	// not touched again.
+	err error
+}
+
+// NewPipelinedBlockDeviceWriter returns a writer which owns 'file', and starts
+// reading the first frames of it.
+func NewPipelinedBlockDeviceWriter(
+	file BlockDeviceFile,
+	opts PipelinedWriterOptions,
+) *PipelinedBlockDeviceWriter {
+	if opts.ReadAheadFrames <= 0 {
+		opts.ReadAheadFrames = DefaultReadAheadFrames
+	}
+	if opts.SyncIntervalBytes == 0 {
+		opts.SyncIntervalBytes = DefaultSyncIntervalBytes
+	}
+	if opts.SyncInterval == 0 {
+		opts.SyncInterval = DefaultSyncInterval
+	}
+	if opts.SectorSize <= 0 {
+		opts.SectorSize = 1
+	}
+	buffers := opts.ReadAheadFrames
+	if opts.Index != nil {
+		// Only needed for merging the last frame with O_DIRECT.
+		buffers = 1
+	}
+
+	nFrames := (opts.Size + int64(opts.FrameSize) - 1) / int64(opts.FrameSize)
+	pw := &PipelinedBlockDeviceWriter{
+		file:     file,
+		opts:     opts,
+		frame:    alignedBuffer(opts.FrameSize),
+		free:     make(chan []byte, buffers),
+		ahead:    make(chan deviceFrame, opts.ReadAheadFrames),
+		done:     make(chan struct{}),
+		zeros:    make([]byte, opts.FrameSize),
+		hashes:   make([]FrameHash, 0, nFrames),
+		hashIn:   make(chan []byte),
+		hashOut:  make(chan FrameHash),
+		lastSync: time.Now(),
+		started:  time.Now(),
+	}
+	pw.zeroHash = hashFrame(pw.zeros)
+	for i := 0; i < buffers; i++ {
+		pw.free <- alignedBuffer(opts.FrameSize)
+	}
+	if opts.Index == nil {
+		go pw.readAhead()
+		go pw.hash()
+	}
+	return pw
+}
+
+// alignedBuffer returns a buffer of length 'size' whose first byte is aligned
+// to frameBufferAlignment, as required for O_DIRECT I/O.
+func alignedBuffer(size int) []byte {
+	buf := make([]byte, size+frameBufferAlignment)
+	offset := 0
+	if rem := int(uintptr(unsafe.Pointer(&buf[0])) % frameBufferAlignment); rem != 0 {
+		offset = frameBufferAlignment - rem
+	}
+	return buf[offset : offset+size : offset+size]
+}
+
+// ioLength returns the number of bytes to read or write for a frame holding
+// 'n' bytes of image data.
+func (pw *PipelinedBlockDeviceWriter) ioLength(n int) int {
+	if !pw.opts.DirectIO {
+		return n
+	}
+	ssz := pw.opts.SectorSize
+	return (n + ssz - 1) / ssz * ssz
+}
+
+// readAhead reads every frame of the image area of the device, in order, into
+// the free buffers, and hands them over to the writer.
+func (pw *PipelinedBlockDeviceWriter) readAhead() {
+	defer close(pw.ahead)
+	frameSize := int64(pw.opts.FrameSize)
+	for off := int64(0); off < pw.opts.Size; off += frameSize {
+		var buf []byte
+		select {
+		case buf = <-pw.free:
+		case <-pw.done:
+			return
+		}
+		n := int(frameSize)
+		if remaining := pw.opts.Size - off; remaining < frameSize {
+			n = int(remaining)
+		}
+		read, err := pw.file.ReadAt(buf[:pw.ioLength(n)], off)
+		if err == io.EOF {
+			// The device (most likely a regular file) is shorter
+			// than the image. The missing bytes are dirty.
+			err = nil
+		}
+		if read > n {
+			read = n
+		}
+		select {
+		case pw.ahead <- deviceFrame{buf: buf, n: read, err: err}:
+		case <-pw.done:
+			return
+		}
+		if err != nil {
+			return
+		}
+	}
+}
+
+// hash hashes the frames handed to it, until the writer is closed.
+func (pw *PipelinedBlockDeviceWriter) hash() {
+	for {
+		select {
+		case frame := <-pw.hashIn:
+			pw.hashOut <- hashFrame(frame)
+		case <-pw.done:
+			return
+		}
+	}
+}
+
+// Write buffers 'b' into frames, and compares and writes each full frame.
+func (pw *PipelinedBlockDeviceWriter) Write(b []byte) (int, error) {
+	if pw.closed {
+		return 0, errors.New("Write to closed block-device writer")
+	}
+	if pw.err != nil {
+		return 0, pw.err
+	}
+	written := 0
+	for written < len(b) {
+		n := copy(pw.frame[pw.fill:], b[written:])
+		pw.fill += n
+		written += n
+		if pw.fill == len(pw.frame) {
+			if err := pw.writeFrame(); err != nil {
+				return written - n, err
+			}
+		}
+	}
+	return written, nil
+}
+
+// compare reports whether the frame 'data', with hash 'hash', is already on
+// the device. Unless there is an index, the frame read ahead from the device
+// is returned as well, and must be handed back to the free pool.
+func (pw *PipelinedBlockDeviceWriter) compare(
+	data []byte,
+	hash FrameHash,
+) (bool, *deviceFrame, error) {
+	if index := pw.opts.Index; index != nil {
+		i := pw.totalFrames
+		return i < len(index.Hashes) &&
+			index.frameLen(i) == len(data) &&
+			index.Hashes[i] == hash, nil, nil
+	}
+
+	dev, ok := <-pw.ahead
+	if !ok {
+		return false, nil, errors.New("Failed to read the frame from the block-device: " +
+			"the image is larger than announced")
+	}
+	if dev.err != nil {
+		log.Errorf("Failed to read a full frame of size: %d from the block-device: %v",
+			len(data), dev.err)
+		return false, &dev, dev.err
+	}
+	return dev.n >= len(data) && bytes.Equal(dev.buf[:len(data)], data), &dev, nil
+}
+
+// writeFrame compares the buffered frame with the frame on the device, and
+// writes it with a positioned write if it is dirty. Any error sticks.
+func (pw *PipelinedBlockDeviceWriter) writeFrame() error {
+	if pw.err == nil {
+		pw.err = pw.writeFrameOnce()
+	}
+	return pw.err
+}
+
+func (pw *PipelinedBlockDeviceWriter) writeFrameOnce() error {
+	data := pw.frame[:pw.fill]
+
+	zero := isZeroFrame(data, pw.zeros)
+	hash := pw.zeroHash
+	background := false
+	if zero && len(data) == len(pw.zeros) {
+		// Known hash.
+	} else if pw.opts.Index != nil {
+		// Needed for the comparison.
+		hash = hashFrame(data)
+	} else {
+		pw.hashIn <- data
+		background = true
+	}
+
+	discarded, err := pw.storeFrame(data, hash, zero)
+	if discarded {
+		// What the device returns for it is not known.
+		hash = unknownFrameHash
+	}
+	if background {
+		// Also makes sure that the frame is not modified while it
+		// is being hashed.
+		hash = <-pw.hashOut
+	}
+	if err != nil {
+		return err
+	}
+	pw.hashes = append(pw.hashes, hash)
+	pw.advance()
+
+	if pw.unsynced >= pw.opts.SyncIntervalBytes ||
+		(pw.unsynced > 0 && time.Since(pw.lastSync) >= pw.opts.SyncInterval) {
+		return pw.sync()
+	}
+	return nil
+}
+
+// storeFrame compares and writes the frame 'data'. 'hash' is only valid if
+// there is an index. Returns true if the frame was handed to the Discard
+// function instead of being written.
+func (pw *PipelinedBlockDeviceWriter) storeFrame(
+	data []byte,
+	hash FrameHash,
+	zero bool,
+) (bool, error) {
+	clean, dev, err := pw.compare(data, hash)
+	if dev != nil {
+		defer func() { pw.free <- dev.buf }()
+	}
+	if err != nil {
+		return false, err
+	}
+
+	pw.totalFrames += 1
+	if clean && zero {
+		pw.zeroFrames += 1
+		return false, nil
+	} else if clean {
+		pw.cleanFrames += 1
+		return false, nil
+	} else if zero && pw.discard(len(data)) {
+		pw.discardedFrames += 1
+		return true, nil
+	}
+
+	out := data
+	if ioLen := pw.ioLength(len(data)); ioLen != len(data) {
+		// Last, unaligned frame with O_DIRECT: Merge the new data
+		// into the sector aligned device frame, and write that.
+		if out, err = pw.readTail(dev, ioLen); err != nil {
+			return false, err
+		}
+		copy(out, data)
+	}
+	if _, err := pw.file.WriteAt(out, pw.offset); err != nil {
+		log.Errorf("Failed to write the frame at offset %d to the block-device: %v",
+			pw.offset, err)
+		return false, err
+	}
+	pw.dirtyFrames += 1
+	pw.unsynced += uint64(len(data))
+	return false, nil
+}
+
+// readTail returns the sector aligned 'ioLen' bytes of the device at the
+// current offset, either from the frame read ahead, or read on demand.
+func (pw *PipelinedBlockDeviceWriter) readTail(dev *deviceFrame, ioLen int) ([]byte, error) {
+	if dev != nil {
+		return dev.buf[:ioLen], nil
+	}
+	buf := <-pw.free
+	defer func() { pw.free <- buf }()
+	if _, err := pw.file.ReadAt(buf[:ioLen], pw.offset); err != nil && err != io.EOF {
+		log.Errorf("Failed to read the last frame from the block-device: %v", err)
+		return nil, err
+	}
+	return buf[:ioLen], nil
+}
+
+// discard discards a zero frame of 'n' bytes at the current offset instead of
+// writing it, if configured to, and if 'n' is a full frame. Returns false if
+// the frame must be written.
+func (pw *PipelinedBlockDeviceWriter) discard(n int) bool {
+	if pw.opts.Discard == nil || n != pw.opts.FrameSize {
+		return false
+	}
+	if err := pw.opts.Discard(pw.offset, int64(n)); err != nil {
+		log.Warnf("Failed to discard zero frames on the block-device, "+
+			"writing them instead: %v", err)
+		pw.opts.Discard = nil
+		return false
+	}
+	return true
+}
+
+func (pw *PipelinedBlockDeviceWriter) advance() {
+	pw.offset += int64(pw.fill)
+	pw.fill = 0
+}
+
+func (pw *PipelinedBlockDeviceWriter) sync() error {
+	start := time.Now()
+	err := pw.file.Sync()
+	pw.lastSync = time.Now()
+	utils.Metrics.Add(utils.StageSync, int64(pw.unsynced), pw.lastSync.Sub(start))
+	pw.unsynced = 0
+	return err
+}
+
+// Complete reports whether the whole image was written without error.
+func (pw *PipelinedBlockDeviceWriter) Complete() bool {
+	return pw.err == nil && pw.offset == pw.opts.Size
+}
+
+// FrameIndex returns the index of the frames written so far.
+func (pw *PipelinedBlockDeviceWriter) FrameIndex() *FrameIndex {
+	return &FrameIndex{
+		FrameSize: pw.opts.FrameSize,
+		ImageSize: pw.offset,
+		Hashes:    pw.hashes,
+	}
+}
+
+// Close writes the last partial frame -- if any, syncs and closes the
+// block-device. After a failed write, it only closes the block-device, and
+// returns the error of the write.
+func (pw *PipelinedBlockDeviceWriter) Close() error {
+	if pw.closed {
+		return pw.err
+	}
+	err := pw.err
+	if err == nil && pw.fill > 0 {
+		err = pw.writeFrame()
+	}
+	pw.closed = true
+	close(pw.done)
+	if err == nil && pw.unsynced > 0 {
+		err = pw.sync()
+	}
+
+	elapsed := time.Since(pw.started)
+	s := "The pipelined block-device writer wrote a total of %d frames, " +
+		"where %d frames did need to be rewritten, %d were clean, " +
+		"%d were already zero and %d were discarded, in %v (%.2f MiB/s)"
+	log.Infof(s, pw.totalFrames, pw.dirtyFrames, pw.cleanFrames, pw.zeroFrames,
+		pw.discardedFrames, elapsed.Round(time.Millisecond),
+		float64(pw.offset)/(1024*1024)/elapsed.Seconds())
+
+	if cerr := pw.file.Close(); err == nil {
+		err = cerr
+	}
+	pw.err = err
+	return err
+}
+
+// Make sure *os.File can be driven by the pipelined writer.
+var _ BlockDeviceFile = (*os.File)(nil)
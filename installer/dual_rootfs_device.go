@@ -27,6 +27,7 @@ import (
 	"github.com/mendersoftware/mender-artifact/artifact"
 	"github.com/mendersoftware/mender-artifact/handlers"
 	"github.com/mendersoftware/mender/conf"
+	"github.com/mendersoftware/mender/store"
 	"github.com/mendersoftware/mender/system"
 )
 
@@ -42,7 +43,9 @@ type dualRootfsDeviceImpl struct {
 	BootEnvReadWriter
 	system.Commander
 	*partitions
-	rebooter *system.SystemRebootCmd
+	rebooter     *system.SystemRebootCmd
+	writerConfig conf.RootfsWriterConfig
+	indexStore   store.Store
 }
 
 // This interface is only here for tests.
@@ -73,11 +76,13 @@ func checkMounted(part string) string {
 	return ""
 }
 
-// Returns nil if config doesn't contain partition paths.
+// Returns nil if config doesn't contain partition paths. The 'indexStore'
+// keeps the frame indexes of the partitions, and may be nil.
 func NewDualRootfsDevice(
 	env BootEnvReadWriter,
 	sc system.StatCommander,
 	config conf.DualRootfsDeviceConfig,
+	indexStore store.Store,
 ) DualRootfsDevice {
 	if config.RootfsPartA == "" || config.RootfsPartB == "" {
 		return nil
@@ -96,6 +101,8 @@ func NewDualRootfsDevice(
 		Commander:         sc,
 		partitions:        &partitions,
 		rebooter:          system.NewSystemRebootCmd(sc),
+		writerConfig:      config.RootfsWriter,
+		indexStore:        indexStore,
 	}
 	return &dualRootfsDevice
 }
@@ -193,7 +200,8 @@ func (d *dualRootfsDeviceImpl) StoreUpdate(image io.Reader, info os.FileInfo) er
 
 	imageSize := info.Size()
 
-	dev, err := blockdevice.Open(inactivePartition, imageSize)
+	dev, err := blockdevice.Open(
+		inactivePartition, imageSize, d.writerConfig, d.indexStore)
 	if err != nil {
 		errmsg := "Failed to write the update to the inactive partition: %q"
 		return errors.Wrapf(err, errmsg, inactivePartition)
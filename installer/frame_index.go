@@ -0,0 +1,173 @@
+// Copyright 2023 Northern.tech AS
+//
+//    Licensed under the Apache License, Version 2.0 (the "License");
+//    you may not use this file except in compliance with the License.
+//    You may obtain a copy of the License at
+//
+//        http://www.apache.org/licenses/LICENSE-2.0
+//
+//    Unless required by applicable law or agreed to in writing, software
+//    distributed under the License is distributed on an "AS IS" BASIS,
+//    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//    See the License for the specific language governing permissions and
+//    limitations under the License.
+package installer
+
+import (
+	"bytes"
+	"crypto/sha256"
+	"encoding/binary"
+	"io"
+	"os"
+
+	"github.com/pkg/errors"
+	log "github.com/sirupsen/logrus"
+
+	"github.com/mendersoftware/mender/datastore"
+	"github.com/mendersoftware/mender/store"
+)
+
+const (
+	frameIndexMagic   = "MFI"
+	frameIndexVersion = 1
+	// magic + version, frame size, image size, frame count
+	frameIndexHeaderSize = 4 + 4 + 8 + 4
+
+	// Number of frames, besides the first one, read from the device to
+	// check that the index is not stale.
+	frameIndexSamples = 3
+)
+
+// FrameHash is the hash of one frame written to a partition.
+type FrameHash [sha256.Size]byte
+
+// FrameIndex holds the hash of every frame last written to a partition, so
+// that the next update of that partition can find the clean frames without
+// reading them from the device.
+type FrameIndex struct {
+	FrameSize int
+	ImageSize int64
+	Hashes    []FrameHash
+}
+
+// unknownFrameHash is recorded for frames which were not written, such as
+// discarded ones, so that they never match, and are always written again.
+var unknownFrameHash FrameHash
+
+func hashFrame(frame []byte) FrameHash {
+	return FrameHash(sha256.Sum256(frame))
+}
+
+// MarshalBinary encodes the index in its compact, versioned binary format.
+func (fi *FrameIndex) MarshalBinary() ([]byte, error) {
+	buf := make([]byte, frameIndexHeaderSize, frameIndexHeaderSize+len(fi.Hashes)*sha256.Size)
+	copy(buf, frameIndexMagic)
+	buf[3] = frameIndexVersion
+	binary.BigEndian.PutUint32(buf[4:], uint32(fi.FrameSize))
+	binary.BigEndian.PutUint64(buf[8:], uint64(fi.ImageSize))
+	binary.BigEndian.PutUint32(buf[16:], uint32(len(fi.Hashes)))
+	for i := range fi.Hashes {
+		buf = append(buf, fi.Hashes[i][:]...)
+	}
+	return buf, nil
+}
+
+// UnmarshalBinary decodes an index encoded by MarshalBinary.
+func (fi *FrameIndex) UnmarshalBinary(data []byte) error {
+	if len(data) < frameIndexHeaderSize || string(data[:3]) != frameIndexMagic {
+		return errors.New("invalid frame index")
+	}
+	if data[3] != frameIndexVersion {
+		return errors.Errorf("unsupported frame index version %d", data[3])
+	}
+	count := int(binary.BigEndian.Uint32(data[16:]))
+	if len(data) != frameIndexHeaderSize+count*sha256.Size {
+		return errors.New("truncated frame index")
+	}
+	fi.FrameSize = int(binary.BigEndian.Uint32(data[4:]))
+	fi.ImageSize = int64(binary.BigEndian.Uint64(data[8:]))
+	fi.Hashes = make([]FrameHash, count)
+	for i := range fi.Hashes {
+		copy(fi.Hashes[i][:], data[frameIndexHeaderSize+i*sha256.Size:])
+	}
+	return nil
+}
+
+// frameLen returns the number of image bytes in frame 'i'.
+func (fi *FrameIndex) frameLen(i int) int {
+	if remaining := fi.ImageSize - int64(i)*int64(fi.FrameSize); remaining < int64(fi.FrameSize) {
+		return int(remaining)
+	}
+	return fi.FrameSize
+}
+
+// Matches reads a few of the indexed frames from the device, and checks that
+// they still hash to the indexed values. The first frame is always checked,
+// since that is where most filesystems keep their superblock, which changes
+// whenever the filesystem is mounted read-write. 'buf' must be able to hold a
+// full frame.
+func (fi *FrameIndex) Matches(device io.ReaderAt, frameSize int, buf []byte) bool {
+	if fi.FrameSize != frameSize || len(fi.Hashes) == 0 {
+		return false
+	}
+	n := len(fi.Hashes)
+	checked := make(map[int]bool, frameIndexSamples+1)
+	for s := 0; s <= frameIndexSamples; s++ {
+		i := s * (n - 1) / frameIndexSamples
+		if checked[i] || fi.frameLen(i) != frameSize || fi.Hashes[i] == unknownFrameHash {
+			// Partial frames may not be readable with O_DIRECT,
+			// and unknown ones cannot be checked.
+			continue
+		}
+		checked[i] = true
+		read, err := device.ReadAt(buf[:frameSize], int64(i)*int64(frameSize))
+		if err != nil || read != frameSize || hashFrame(buf[:frameSize]) != fi.Hashes[i] {
+			return false
+		}
+	}
+	return len(checked) > 0
+}
+
+func frameIndexKey(device string) string {
+	return datastore.RootfsFrameIndexKeyPrefix + device
+}
+
+// LoadFrameIndex returns the index stored for 'device', or nil if there is
+// none or it cannot be decoded.
+func LoadFrameIndex(s store.Store, device string) *FrameIndex {
+	data, err := s.ReadAll(frameIndexKey(device))
+	if err != nil {
+		if !os.IsNotExist(err) {
+			log.Warnf("Failed to read the frame index of %s: %v", device, err)
+		}
+		return nil
+	}
+	var fi FrameIndex
+	if err = fi.UnmarshalBinary(data); err != nil {
+		log.Warnf("Ignoring the frame index of %s: %v", device, err)
+		return nil
+	}
+	return &fi
+}
+
+// StoreFrameIndex persists the index of 'device'. The index is only an
+// optimization, so it is committed with the next group commit.
+func StoreFrameIndex(s store.Store, device string, fi *FrameIndex) error {
+	data, err := fi.MarshalBinary()
+	if err != nil {
+		return err
+	}
+	return store.WriteAllDeferred(s, frameIndexKey(device), data)
+}
+
+// RemoveFrameIndex removes the index of 'device'. Must be called before the
+// device is modified.
+func RemoveFrameIndex(s store.Store, device string) error {
+	return s.Remove(frameIndexKey(device))
+}
+
+// isZeroFrame reports whether 'frame' only holds zeros. 'zeros' must be at
+// least as large as 'frame'.
+func isZeroFrame(frame, zeros []byte) bool {
+	return bytes.Equal(frame, zeros[:len(frame)])
+}
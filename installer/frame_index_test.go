@@ -0,0 +1,328 @@
+// Copyright 2023 Northern.tech AS
+//
+//    Licensed under the Apache License, Version 2.0 (the "License");
+//    you may not use this file except in compliance with the License.
+//    You may obtain a copy of the License at
+//
+//        http://www.apache.org/licenses/LICENSE-2.0
+//
+//    Unless required by applicable law or agreed to in writing, software
+//    distributed under the License is distributed on an "AS IS" BASIS,
+//    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//    See the License for the specific language governing permissions and
+//    limitations under the License.
+package installer
+
+import (
+	"bytes"
+	"io/ioutil"
+	"os"
+	"path"
+	"syscall"
+	"testing"
+	"time"
+
+	"github.com/stretchr/testify/assert"
+	"github.com/stretchr/testify/require"
+
+	"github.com/mendersoftware/mender/conf"
+	"github.com/mendersoftware/mender/store"
+	"github.com/mendersoftware/mender/utils"
+)
+
+func TestFrameIndexMarshal(t *testing.T) {
+	fi := FrameIndex{
+		FrameSize: 4,
+		ImageSize: 10,
+		Hashes: []FrameHash{
+			hashFrame([]byte("foob")),
+			hashFrame([]byte("arba")),
+			hashFrame([]byte("z!")),
+		},
+	}
+	data, err := fi.MarshalBinary()
+	require.NoError(t, err)
+	assert.Len(t, data, frameIndexHeaderSize+3*len(FrameHash{}))
+
+	var decoded FrameIndex
+	require.NoError(t, decoded.UnmarshalBinary(data))
+	assert.Equal(t, fi, decoded)
+
+	assert.EqualError(t, decoded.UnmarshalBinary(data[:len(data)-1]),
+		"truncated frame index")
+	assert.EqualError(t, decoded.UnmarshalBinary([]byte("foobar")),
+		"invalid frame index")
+	data[3] = 42
+	assert.EqualError(t, decoded.UnmarshalBinary(data),
+		"unsupported frame index version 42")
+}
+
+func TestFrameIndexStore(t *testing.T) {
+	s := store.NewMemStore()
+	assert.Nil(t, LoadFrameIndex(s, "/dev/foo"))
+
+	fi := &FrameIndex{FrameSize: 3, ImageSize: 3, Hashes: []FrameHash{hashFrame([]byte("foo"))}}
+	require.NoError(t, StoreFrameIndex(s, "/dev/foo", fi))
+	assert.Equal(t, fi, LoadFrameIndex(s, "/dev/foo"))
+	assert.Nil(t, LoadFrameIndex(s, "/dev/bar"))
+
+	require.NoError(t, RemoveFrameIndex(s, "/dev/foo"))
+	assert.Nil(t, LoadFrameIndex(s, "/dev/foo"))
+
+	require.NoError(t, s.WriteAll(frameIndexKey("/dev/foo"), []byte("garbage")))
+	assert.Nil(t, LoadFrameIndex(s, "/dev/foo"))
+}
+
+func TestFrameIndexMatches(t *testing.T) {
+	device := []byte("foobarbazqux")
+	fi := FrameIndex{
+		FrameSize: 3,
+		ImageSize: 12,
+		Hashes: []FrameHash{
+			hashFrame([]byte("foo")),
+			hashFrame([]byte("bar")),
+			hashFrame([]byte("baz")),
+			hashFrame([]byte("qux")),
+		},
+	}
+	buf := make([]byte, 3)
+
+	assert.True(t, fi.Matches(bytes.NewReader(device), 3, buf))
+	assert.False(t, fi.Matches(bytes.NewReader(device), 4, make([]byte, 4)))
+	assert.False(t, fi.Matches(bytes.NewReader([]byte("fooba")), 3, buf))
+	assert.False(t, fi.Matches(bytes.NewReader([]byte("xoobarbazqux")), 3, buf))
+	assert.False(t, fi.Matches(bytes.NewReader([]byte("foobarbazqua")), 3, buf))
+}
+
+func TestPipelinedBlockDeviceWriterIndex(t *testing.T) {
+	td, err := ioutil.TempDir("", "mender-block-device-")
+	require.NoError(t, err)
+	defer os.RemoveAll(td)
+
+	zeros := []byte{0, 0, 0}
+	disk := append([]byte("foobar"), make([]byte, 9)...)
+	input := append(append([]byte("foobaz"), zeros...), []byte("abc\x00\x00\x00")...)
+	bdpath := path.Join(td, "foo")
+	require.NoError(t, ioutil.WriteFile(bdpath, disk, 0644))
+	f, err := os.OpenFile(bdpath, os.O_RDWR, 0)
+	require.NoError(t, err)
+	file := &testDeviceFile{File: f}
+
+	var discarded []int64
+	pw := NewPipelinedBlockDeviceWriter(file, PipelinedWriterOptions{
+		FrameSize:    3,
+		Size:         int64(len(input)),
+		SyncInterval: time.Hour,
+		Index: &FrameIndex{
+			FrameSize: 3,
+			ImageSize: int64(len(disk)),
+			Hashes: []FrameHash{
+				hashFrame([]byte("foo")),
+				hashFrame([]byte("bar")),
+				hashFrame(zeros),
+				hashFrame(zeros),
+				// Claims to be data, but the new frame
+				// is zero.
+				hashFrame([]byte("xyz")),
+			},
+		},
+		Discard: func(offset, length int64) error {
+			discarded = append(discarded, offset, length)
+			return nil
+		},
+	})
+	_, err = pw.Write(input)
+	require.NoError(t, err)
+	require.NoError(t, pw.Close())
+
+	assert.Equal(t, 0, file.reads, "the device must not be read")
+	assert.Equal(t, 5, pw.totalFrames)
+	assert.Equal(t, 2, pw.dirtyFrames)
+	assert.Equal(t, 1, pw.cleanFrames)
+	assert.Equal(t, 1, pw.zeroFrames)
+	assert.Equal(t, 1, pw.discardedFrames)
+	assert.Equal(t, []int64{12, 3}, discarded)
+
+	actual, err := ioutil.ReadFile(bdpath)
+	require.NoError(t, err)
+	assert.Equal(t, "foobaz\x00\x00\x00abc\x00\x00\x00", string(actual))
+
+	fi := pw.FrameIndex()
+	assert.Equal(t, int64(len(input)), fi.ImageSize)
+	assert.Equal(t, []FrameHash{
+		hashFrame([]byte("foo")),
+		hashFrame([]byte("baz")),
+		hashFrame(zeros),
+		hashFrame([]byte("abc")),
+		unknownFrameHash,
+	}, fi.Hashes)
+}
+
+func TestPipelinedBlockDeviceWriterDiscardNotZero(t *testing.T) {
+	td, err := ioutil.TempDir("", "mender-block-device-")
+	require.NoError(t, err)
+	defer os.RemoveAll(td)
+
+	// The last frame keeps its old data when discarded, like on many
+	// eMMC and SD cards.
+	input := []byte("foobar\x00\x00\x00")
+	bdpath := path.Join(td, "foo")
+	require.NoError(t, ioutil.WriteFile(bdpath, []byte("fooxyzxyz"), 0644))
+
+	var discarded int
+	write := func(index *FrameIndex) *PipelinedBlockDeviceWriter {
+		f, err := os.OpenFile(bdpath, os.O_RDWR, 0)
+		require.NoError(t, err)
+		pw := NewPipelinedBlockDeviceWriter(&testDeviceFile{File: f}, PipelinedWriterOptions{
+			FrameSize:    3,
+			Size:         int64(len(input)),
+			SyncInterval: time.Hour,
+			Index:        index,
+			Discard: func(offset, length int64) error {
+				discarded++
+				return nil
+			},
+		})
+		_, err = pw.Write(input)
+		require.NoError(t, err)
+		require.NoError(t, pw.Close())
+		return pw
+	}
+
+	pw := write(nil)
+	assert.Equal(t, 1, discarded)
+	fi := pw.FrameIndex()
+	assert.Equal(t, unknownFrameHash, fi.Hashes[2],
+		"a discarded frame must not be recorded as zero")
+
+	actual, err := ioutil.ReadFile(bdpath)
+	require.NoError(t, err)
+	assert.Equal(t, "foobarxyz", string(actual))
+	assert.True(t, fi.Matches(bytes.NewReader(actual), 3, make([]byte, 3)),
+		"unknown frames are not sampled")
+
+	// The next update must not skip the frame.
+	pw = write(fi)
+	assert.Equal(t, 2, discarded)
+	assert.Equal(t, 2, pw.cleanFrames)
+	assert.Equal(t, 0, pw.zeroFrames)
+	assert.Equal(t, 1, pw.discardedFrames)
+}
+
+func TestBlockDeviceFrameIndex(t *testing.T) {
+	const (
+		frameSize = 1024 * 1024
+		nFrames   = 6
+	)
+
+	td, err := ioutil.TempDir("", "mender-block-device-")
+	require.NoError(t, err)
+	defer os.RemoveAll(td)
+	bdpath := path.Join(td, "foo")
+	require.NoError(t, createFile(bdpath))
+
+	old := BlockDeviceGetSizeOf
+	oldSectorSize := BlockDeviceGetSectorSizeOf
+	defer func() {
+		BlockDeviceGetSizeOf = old
+		BlockDeviceGetSectorSizeOf = oldSectorSize
+	}()
+	BlockDeviceGetSizeOf = makeBlockDeviceSize(t, nFrames*frameSize, nil, bdpath)
+	BlockDeviceGetSectorSizeOf = makeBlockDeviceSectorSize(t, frameSize, nil, bdpath)
+
+	image := make([]byte, nFrames*frameSize)
+	for i := range image {
+		image[i] = byte(i % 251)
+	}
+	indexStore := store.NewMemStore()
+	install := func() {
+		bd, err := blockdevice.Open(bdpath, int64(len(image)), conf.RootfsWriterConfig{}, indexStore)
+		require.NoError(t, err)
+		assert.Nil(t, LoadFrameIndex(indexStore, bdpath),
+			"the index must be removed while writing")
+		_, err = bd.Write(image)
+		require.NoError(t, err)
+		require.NoError(t, bd.Close())
+	}
+	corrupt := func(frame int) {
+		f, err := os.OpenFile(bdpath, os.O_RDWR, 0)
+		require.NoError(t, err)
+		_, err = f.WriteAt([]byte("corrupt"), int64(frame*frameSize))
+		require.NoError(t, err)
+		require.NoError(t, f.Close())
+	}
+	deviceEqualsImage := func() bool {
+		actual, err := ioutil.ReadFile(bdpath)
+		require.NoError(t, err)
+		return bytes.Equal(image, actual)
+	}
+
+	install()
+	assert.True(t, deviceEqualsImage())
+	fi := LoadFrameIndex(indexStore, bdpath)
+	require.NotNil(t, fi)
+	assert.Len(t, fi.Hashes, nFrames)
+
+	// Frame 2 is not among the frames checked by Matches. The index is
+	// trusted, so the device is not read, and the corruption goes
+	// unnoticed.
+	corrupt(2)
+	install()
+	assert.False(t, deviceEqualsImage())
+
+	// The first frame is always checked. The index is stale, and the
+	// whole device is compared.
+	corrupt(0)
+	install()
+	assert.True(t, deviceEqualsImage())
+}
+
+func TestBlockDeviceFrameIndexIncomplete(t *testing.T) {
+	td, err := ioutil.TempDir("", "mender-block-device-")
+	require.NoError(t, err)
+	defer os.RemoveAll(td)
+	bdpath := path.Join(td, "foo")
+	require.NoError(t, ioutil.WriteFile(bdpath, make([]byte, 12), 0644))
+	image := []byte("foobarbazqux")
+	indexStore := store.NewMemStore()
+
+	open := func(failAt int64) *BlockDevice {
+		f, err := os.OpenFile(bdpath, os.O_RDWR, 0)
+		require.NoError(t, err)
+		file := &failingDeviceFile{testDeviceFile: testDeviceFile{File: f}, failAt: failAt}
+		pw := NewPipelinedBlockDeviceWriter(file, PipelinedWriterOptions{
+			FrameSize:    3,
+			Size:         int64(len(image)),
+			SyncInterval: time.Hour,
+		})
+		return &BlockDevice{
+			Path:       bdpath,
+			w:          &utils.LimitedWriteCloser{W: pw, N: uint64(len(image))},
+			pw:         pw,
+			indexStore: indexStore,
+		}
+	}
+
+	// Write fails in the middle of the image.
+	bd := open(6)
+	_, err = bd.Write(image)
+	assert.Equal(t, syscall.EIO, err)
+	assert.Equal(t, syscall.EIO, bd.Close())
+	assert.Nil(t, LoadFrameIndex(indexStore, bdpath))
+
+	// The artifact ends, or fails, in the middle of the image.
+	bd = open(-1)
+	_, err = bd.Write(image[:7])
+	require.NoError(t, err)
+	require.NoError(t, bd.Close())
+	assert.Nil(t, LoadFrameIndex(indexStore, bdpath))
+
+	bd = open(-1)
+	_, err = bd.Write(image)
+	require.NoError(t, err)
+	require.NoError(t, bd.Close())
+	fi := LoadFrameIndex(indexStore, bdpath)
+	require.NotNil(t, fi)
+	assert.Equal(t, int64(len(image)), fi.ImageSize)
+	assert.Len(t, fi.Hashes, 4)
+}
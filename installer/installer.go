@@ -57,6 +57,8 @@ type AllModules struct {
 	DualRootfs handlers.UpdateStorerProducer
 	// External modules.
 	Modules *ModuleInstallerFactory
+	// How payloads are handed to the modules.
+	Pipeline conf.PayloadPipelineConfig
 }
 
 type ArtifactInfoGetter interface {
@@ -69,7 +71,8 @@ type DeviceInfoGetter interface {
 }
 
 type Installer struct {
-	ar *areader.Reader
+	ar      *areader.Reader
+	storers []*payloadStorer
 }
 
 type RebootAction int
@@ -208,6 +211,13 @@ func ReadHeaders(art io.ReadCloser, dt string, keys []*conf.VerificationKey, scr
 		)
 	}
 
+	var storers []*payloadStorer
+	for _, us := range updateStorers {
+		if ps, ok := us.(*payloadStorer); ok {
+			storers = append(storers, ps)
+		}
+	}
+
 	installers, err = getInstallerList(updateStorers)
 	if err != nil {
 		return nil, installers, err
@@ -217,13 +227,22 @@ func ReadHeaders(art io.ReadCloser, dt string, keys []*conf.VerificationKey, scr
 		"Installer: Successfully read artifact [name: %v; version: %v; compatible devices: %v]",
 		ar.GetArtifactName(), ar.GetInfo().Version, ar.GetCompatibleDevices())
 
-	return &Installer{ar}, installers, nil
+	return &Installer{ar: ar, storers: storers}, installers, nil
 }
 
 func (i *Installer) StorePayloads() error {
 	return i.ar.ReadArtifactData()
 }
 
+// PayloadStats returns the PayloadStats of each payload file stored so far.
+func (i *Installer) PayloadStats() []PayloadStats {
+	var stats []PayloadStats
+	for _, s := range i.storers {
+		stats = append(stats, s.stats...)
+	}
+	return stats
+}
+
 func (i *Installer) GetArtifactName() string {
 	return i.ar.GetArtifactName()
 }
@@ -255,7 +274,8 @@ func registerHandlers(ar *areader.Reader, inst *AllModules) error {
 	// Built-in rootfs handler.
 	if inst.DualRootfs != nil {
 		rootfs := handlers.NewRootfsInstaller()
-		rootfs.SetUpdateStorerProducer(inst.DualRootfs)
+		rootfs.SetUpdateStorerProducer(
+			newPayloadStorerProducer(inst.DualRootfs, inst.Pipeline))
 		if err := ar.RegisterHandler(rootfs); err != nil {
 			return errors.Wrap(err, "failed to register rootfs install handler")
 		}
@@ -266,6 +286,7 @@ func registerHandlers(ar *areader.Reader, inst *AllModules) error {
 	}
 
 	// Update modules.
+	modules := newPayloadStorerProducer(inst.Modules, inst.Pipeline)
 	updateTypes := inst.Modules.GetModuleTypes()
 	for _, updateType := range updateTypes {
 		if updateType == "rootfs-image" {
@@ -274,7 +295,7 @@ func registerHandlers(ar *areader.Reader, inst *AllModules) error {
 			continue
 		}
 		moduleImage := handlers.NewModuleImage(updateType)
-		moduleImage.SetUpdateStorerProducer(inst.Modules)
+		moduleImage.SetUpdateStorerProducer(modules)
 		if err := ar.RegisterHandler(moduleImage); err != nil {
 			return errors.Wrapf(err, "failed to register '%s' install handler",
 				updateType)
@@ -287,6 +308,9 @@ func registerHandlers(ar *areader.Reader, inst *AllModules) error {
 func getInstallerList(updateStorers []handlers.UpdateStorer) ([]PayloadUpdatePerformer, error) {
 	var list []PayloadUpdatePerformer
 	for _, us := range updateStorers {
+		if ps, ok := us.(*payloadStorer); ok {
+			us = ps.UpdateStorer
+		}
 		installer, ok := us.(PayloadUpdatePerformer)
 		if !ok {
 			// If the installer does not implement PayloadUpdatePerformer interface, it means that
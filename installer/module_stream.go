@@ -0,0 +1,236 @@
+// Copyright 2023 Northern.tech AS
+//
+//    Licensed under the Apache License, Version 2.0 (the "License");
+//    you may not use this file except in compliance with the License.
+//    You may obtain a copy of the License at
+//
+//        http://www.apache.org/licenses/LICENSE-2.0
+//
+//    Unless required by applicable law or agreed to in writing, software
+//    distributed under the License is distributed on an "AS IS" BASIS,
+//    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//    See the License for the specific language governing permissions and
+//    limitations under the License.
+
+package installer
+
+import (
+	"io"
+	"os"
+	"sync"
+	"time"
+
+	log "github.com/sirupsen/logrus"
+	"golang.org/x/sys/unix"
+)
+
+const (
+	// Capacity requested for the FIFOs that payload files are streamed
+	// through. This is the largest size unprivileged processes may
+	// request by default, see /proc/sys/fs/pipe-max-size.
+	streamPipeSize = 1024 * 1024
+	// Smallest capacity worth requesting, the default is 64KiB.
+	minStreamPipeSize = 128 * 1024
+	// Size of the buffers used to copy payload files.
+	streamBufferSize = 256 * 1024
+	// Maximum amount of the next payload file read ahead while the module
+	// is still busy with the previous one.
+	streamPrefetchSize = 4 * 1024 * 1024
+)
+
+// Buffers for copying payload files.
+var streamBufferPool = sync.Pool{
+	New: func() interface{} {
+		buf := make([]byte, streamBufferSize)
+		return &buf
+	},
+}
+
+// StreamStats describes how one payload file was streamed, either to the
+// update module, or to the "files" directory.
+type StreamStats struct {
+	Name  string
+	Bytes int64
+	// Read ahead of the module opening the stream.
+	Prefetched int64
+	// From the start of the stream until all of it was written.
+	Duration time.Duration
+	// Time spent waiting for the module to open the stream.
+	OpenWait time.Duration
+	// Time spent waiting for the module to read from the stream.
+	WriteStall time.Duration
+	// Time spent waiting for the artifact to provide data.
+	ReadStall time.Duration
+}
+
+// Throughput returns the average number of bytes streamed per second.
+func (s *StreamStats) Throughput() float64 {
+	if s.Duration <= 0 {
+		return 0
+	}
+	return float64(s.Bytes) / s.Duration.Seconds()
+}
+
+// setPipeSize raises the capacity of the pipe 'f', so that the module can
+// read larger chunks at a time, and the writer blocks less often. Failures
+// are not fatal, the pipe keeps its capacity.
+func setPipeSize(f *os.File, size int) {
+	rawConn, err := f.SyscallConn()
+	if err != nil {
+		return
+	}
+	_ = rawConn.Control(func(fd uintptr) {
+		for ; size >= minStreamPipeSize; size /= 2 {
+			// Fails with EPERM above the limit of the user.
+			if _, err = unix.FcntlInt(fd, unix.F_SETPIPE_SZ, size); err == nil {
+				log.Debugf("Capacity of %s set to %d bytes", f.Name(), size)
+				return
+			}
+		}
+		log.Debugf("Unable to raise the capacity of %s: %v", f.Name(), err)
+	})
+}
+
+// copyStream copies 'r' into 'dst', and accounts for the time spent waiting on
+// either side in 'stats'.
+func copyStream(dst *os.File, r io.Reader, stats *StreamStats) error {
+	bufp := streamBufferPool.Get().(*[]byte)
+	defer streamBufferPool.Put(bufp)
+	buf := *bufp
+	for {
+		start := time.Now()
+		n, err := r.Read(buf)
+		stats.ReadStall += time.Since(start)
+		if n > 0 {
+			start = time.Now()
+			written, werr := dst.Write(buf[:n])
+			stats.WriteStall += time.Since(start)
+			stats.Bytes += int64(written)
+			if werr != nil {
+				return werr
+			}
+		}
+		if err == io.EOF {
+			return nil
+		} else if err != nil {
+			return err
+		}
+	}
+}
+
+// prefetchReader reads ahead from 'r' into a bounded buffer, from when it is
+// started until it is first read from. The update module reads each stream
+// only after it is done with the previous one, and meanwhile, the data of the
+// next one can be decompressed and buffered. Once the buffer is drained,
+// reads go straight to 'r'.
+type prefetchReader struct {
+	r io.Reader
+	// Capacity of buf, which is only allocated once started.
+	size int64
+
+	lock sync.Mutex
+	cond *sync.Cond
+	// Filled up to len(buf), and read up to pos.
+	buf []byte
+	pos int
+	// Error returned by 'r' to the prefetcher.
+	err      error
+	reading  bool
+	stop     bool
+	done     chan struct{}
+	started  bool
+	released bool
+}
+
+func newPrefetchReader(r io.Reader, size int64) *prefetchReader {
+	if size < 0 || size > streamPrefetchSize {
+		size = streamPrefetchSize
+	}
+	p := &prefetchReader{
+		r:    r,
+		size: size,
+		done: make(chan struct{}),
+	}
+	p.cond = sync.NewCond(&p.lock)
+	return p
+}
+
+// start begins reading ahead, in a go routine, until stop is called or the
+// buffer is full.
+func (p *prefetchReader) start() {
+	p.lock.Lock()
+	defer p.lock.Unlock()
+	if p.started || p.stop {
+		return
+	}
+	p.started = true
+	p.reading = true
+	p.buf = make([]byte, 0, p.size)
+	go p.prefetch()
+}
+
+func (p *prefetchReader) prefetch() {
+	defer close(p.done)
+
+	p.lock.Lock()
+	for !p.stop && p.err == nil && len(p.buf) < cap(p.buf) {
+		filled := len(p.buf)
+		p.lock.Unlock()
+		// The consumer only reads below len(p.buf), so this part of
+		// the buffer is ours.
+		n, err := p.r.Read(p.buf[filled:cap(p.buf)])
+		p.lock.Lock()
+		p.buf = p.buf[:filled+n]
+		p.err = err
+		p.cond.Broadcast()
+	}
+	p.reading = false
+	p.cond.Broadcast()
+	p.lock.Unlock()
+}
+
+// prefetched returns the number of bytes read ahead so far.
+func (p *prefetchReader) prefetched() int64 {
+	p.lock.Lock()
+	defer p.lock.Unlock()
+	return int64(len(p.buf))
+}
+
+func (p *prefetchReader) Read(b []byte) (int, error) {
+	p.lock.Lock()
+	p.stop = true
+	for p.pos == len(p.buf) && p.reading {
+		p.cond.Wait()
+	}
+	if p.pos < len(p.buf) {
+		n := copy(b, p.buf[p.pos:])
+		p.pos += n
+		p.lock.Unlock()
+		return n, nil
+	}
+	err := p.err
+	if !p.released {
+		// Drained, and the prefetcher is done.
+		p.buf = nil
+		p.pos = 0
+		p.released = true
+	}
+	p.lock.Unlock()
+
+	if err != nil {
+		return 0, err
+	}
+	return p.r.Read(b)
+}
+
+// close stops reading ahead, and waits for the prefetcher to return, so that
+// 'r' may be used by others.
+func (p *prefetchReader) close() {
+	p.lock.Lock()
+	p.stop = true
+	started := p.started
+	p.lock.Unlock()
+	if started {
+		<-p.done
+	}
+}
@@ -0,0 +1,339 @@
+// Copyright 2023 Northern.tech AS
+//
+//    Licensed under the Apache License, Version 2.0 (the "License");
+//    you may not use this file except in compliance with the License.
+//    You may obtain a copy of the License at
+//
+//        http://www.apache.org/licenses/LICENSE-2.0
+//
+//    Unless required by applicable law or agreed to in writing, software
+//    distributed under the License is distributed on an "AS IS" BASIS,
+//    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//    See the License for the specific language governing permissions and
+//    limitations under the License.
+
+package installer
+
+import (
+	"bytes"
+	"fmt"
+	"io"
+	"io/ioutil"
+	"math/rand"
+	"os"
+	"path"
+	"syscall"
+	"testing"
+	"time"
+
+	"github.com/stretchr/testify/assert"
+	"github.com/stretchr/testify/require"
+)
+
+// onlyReader hides the type of a reader, and whichever other interfaces it
+// implements.
+type onlyReader struct {
+	io.Reader
+}
+
+func streamTestData(size int) []byte {
+	data := make([]byte, size)
+	rand.New(rand.NewSource(42)).Read(data)
+	return data
+}
+
+func TestCopyStream(t *testing.T) {
+	tmpdir, err := ioutil.TempDir("", "TestCopyStream")
+	require.NoError(t, err)
+	defer os.RemoveAll(tmpdir)
+
+	data := streamTestData(3*streamBufferSize + 1234)
+	srcPath := path.Join(tmpdir, "src")
+	require.NoError(t, ioutil.WriteFile(srcPath, data, 0600))
+
+	tests := map[string]struct {
+		source func(t *testing.T) io.Reader
+		length int
+	}{
+		"buffer": {
+			source: func(t *testing.T) io.Reader {
+				return bytes.NewReader(data)
+			},
+			length: len(data),
+		},
+		"file": {
+			source: func(t *testing.T) io.Reader {
+				f, err := os.Open(srcPath)
+				require.NoError(t, err)
+				return f
+			},
+			length: len(data),
+		},
+		"limited file": {
+			source: func(t *testing.T) io.Reader {
+				f, err := os.Open(srcPath)
+				require.NoError(t, err)
+				return io.LimitReader(f, streamBufferSize+10)
+			},
+			length: streamBufferSize + 10,
+		},
+		"pipe": {
+			source: func(t *testing.T) io.Reader {
+				r, w, err := os.Pipe()
+				require.NoError(t, err)
+				go func() {
+					// Slowly, so that the pipe runs empty.
+					for off := 0; off < len(data); off += 100000 {
+						end := off + 100000
+						if end > len(data) {
+							end = len(data)
+						}
+						_, _ = w.Write(data[off:end])
+					}
+					w.Close()
+				}()
+				return r
+			},
+			length: len(data),
+		},
+	}
+
+	for name, tc := range tests {
+		t.Run(name, func(t *testing.T) {
+			fifoPath := path.Join(tmpdir, "fifo")
+			require.NoError(t, syscall.Mkfifo(fifoPath, 0600))
+			defer os.Remove(fifoPath)
+
+			received := make(chan []byte)
+			go func() {
+				f, err := os.Open(fifoPath)
+				if err != nil {
+					received <- nil
+					return
+				}
+				defer f.Close()
+				out, _ := ioutil.ReadAll(f)
+				received <- out
+			}()
+
+			dst, err := os.OpenFile(fifoPath, os.O_WRONLY, 0)
+			require.NoError(t, err)
+			setPipeSize(dst, streamPipeSize)
+
+			src := tc.source(t)
+			if c, ok := src.(io.Closer); ok {
+				defer c.Close()
+			}
+			var stats StreamStats
+			err = copyStream(dst, src, &stats)
+			dst.Close()
+			require.NoError(t, err)
+
+			assert.True(t, bytes.Equal(data[:tc.length], <-received))
+			assert.EqualValues(t, tc.length, stats.Bytes)
+			if lr, ok := src.(*io.LimitedReader); ok {
+				assert.Zero(t, lr.N)
+			}
+		})
+	}
+
+	t.Run("to file", func(t *testing.T) {
+		dstPath := path.Join(tmpdir, "dst")
+		dst, err := os.Create(dstPath)
+		require.NoError(t, err)
+		src, err := os.Open(srcPath)
+		require.NoError(t, err)
+		defer src.Close()
+
+		var stats StreamStats
+		require.NoError(t, copyStream(dst, src, &stats))
+		require.NoError(t, dst.Close())
+
+		out, err := ioutil.ReadFile(dstPath)
+		require.NoError(t, err)
+		assert.True(t, bytes.Equal(data, out))
+	})
+
+	t.Run("reader gone", func(t *testing.T) {
+		fifoPath := path.Join(tmpdir, "fifo")
+		require.NoError(t, syscall.Mkfifo(fifoPath, 0600))
+		defer os.Remove(fifoPath)
+
+		go func() {
+			f, err := os.Open(fifoPath)
+			if err == nil {
+				f.Close()
+			}
+		}()
+		dst, err := os.OpenFile(fifoPath, os.O_WRONLY, 0)
+		require.NoError(t, err)
+		defer dst.Close()
+		src, err := os.Open(srcPath)
+		require.NoError(t, err)
+		defer src.Close()
+
+		var stats StreamStats
+		err = copyStream(dst, src, &stats)
+		assert.Error(t, err)
+		assert.Contains(t, err.Error(), "broken pipe")
+	})
+}
+
+func TestPrefetchReader(t *testing.T) {
+	data := streamTestData(1000000)
+
+	for _, size := range []int64{-1, 0, 1000, int64(len(data)), int64(len(data)) + 1} {
+		t.Run(fmt.Sprintf("size=%d", size), func(t *testing.T) {
+			p := newPrefetchReader(bytes.NewReader(data), size)
+			p.start()
+			<-p.done
+			expected := size
+			if size < 0 || size > int64(len(data)) {
+				expected = int64(len(data))
+			}
+			assert.Equal(t, expected, p.prefetched())
+
+			out, err := ioutil.ReadAll(onlyReader{p})
+			require.NoError(t, err)
+			assert.True(t, bytes.Equal(data, out))
+			p.close()
+		})
+	}
+
+	t.Run("read while prefetching", func(t *testing.T) {
+		r, w := io.Pipe()
+		go func() {
+			for off := 0; off < len(data); off += 1000 {
+				_, _ = w.Write(data[off : off+1000])
+			}
+			w.CloseWithError(io.ErrUnexpectedEOF)
+		}()
+		p := newPrefetchReader(r, -1)
+		p.start()
+		out, err := ioutil.ReadAll(p)
+		assert.Equal(t, io.ErrUnexpectedEOF, err)
+		assert.True(t, bytes.Equal(data, out))
+		p.close()
+	})
+
+	t.Run("never started", func(t *testing.T) {
+		p := newPrefetchReader(bytes.NewReader(data), -1)
+		// Nothing is allocated until the prefetcher starts.
+		assert.Nil(t, p.buf)
+		p.close()
+		out, err := ioutil.ReadAll(p)
+		require.NoError(t, err)
+		assert.True(t, bytes.Equal(data, out))
+	})
+}
+
+func TestModulesDownloadStreaming(t *testing.T) {
+	tmpdir, err := ioutil.TempDir("", "TestModulesDownloadStreaming")
+	require.NoError(t, err)
+	defer os.RemoveAll(tmpdir)
+
+	data := streamTestData(4 * 1024 * 1024)
+	srcPath := path.Join(tmpdir, "payload")
+	require.NoError(t, ioutil.WriteFile(srcPath, data, 0600))
+
+	download, delayKiller := moduleDownloadSetup(t, tmpdir, "moduleDownloadDrainSlowly")
+
+	for i := 0; i < 3; i++ {
+		require.NoError(t, download.downloadStream(bytes.NewReader(data),
+			fmt.Sprintf("buffered%d", i), int64(len(data))))
+	}
+	src, err := os.Open(srcPath)
+	require.NoError(t, err)
+	defer src.Close()
+	require.NoError(t, download.downloadStream(src, "file", int64(len(data))))
+
+	// Fed by the payload pipeline, as storePipelined does.
+	pipe := newPayloadPipe(4)
+	fillErr := make(chan error, 1)
+	go func() {
+		fillErr <- pipe.fill(bytes.NewReader(data))
+	}()
+	require.NoError(t, download.downloadStream(pipe, "pipelined", int64(len(data))))
+	pipe.closeRead()
+	assert.Equal(t, io.EOF, <-fillErr)
+	pipe.drain()
+
+	require.NoError(t, download.finishDownloadProcess())
+	delayKiller.Stop()
+
+	require.Len(t, download.streamStats, 5)
+	for i, stats := range download.streamStats {
+		assert.EqualValues(t, len(data), stats.Bytes)
+		assert.Positive(t, stats.Throughput())
+		if i == 4 {
+			// Queued by the pipeline instead.
+			assert.Zero(t, stats.Prefetched, stats.Name)
+		} else if i > 0 {
+			// The module was busy with the previous stream. The
+			// first stream may be read ahead too, depending on
+			// how soon the module opens it.
+			assert.Positive(t, stats.Prefetched, stats.Name)
+		}
+	}
+	download.logStreamStats()
+}
+
+// BenchmarkModulesDownload streams a payload file to a module which drains
+// the FIFOs, and compares with writing it to disk.
+func BenchmarkModulesDownload(b *testing.B) {
+	const size = 64 * 1024 * 1024
+
+	tmpdir, err := ioutil.TempDir("", "BenchmarkModulesDownload")
+	require.NoError(b, err)
+	defer os.RemoveAll(tmpdir)
+
+	srcPath := path.Join(tmpdir, "payload")
+	require.NoError(b, ioutil.WriteFile(srcPath, streamTestData(size), 0600))
+
+	open := func(b *testing.B) (*os.File, io.Reader) {
+		src, err := os.Open(srcPath)
+		require.NoError(b, err)
+		return src, onlyReader{src}
+	}
+
+	b.Run("disk", func(b *testing.B) {
+		b.SetBytes(size)
+		for i := 0; i < b.N; i++ {
+			src, r := open(b)
+			dst, err := os.Create(path.Join(tmpdir, "copy"))
+			require.NoError(b, err)
+			_, err = io.Copy(dst, r)
+			require.NoError(b, err)
+			require.NoError(b, dst.Close())
+			src.Close()
+		}
+	})
+
+	b.Run("module", func(b *testing.B) {
+		b.SetBytes(size)
+		var stalled, opened time.Duration
+		for i := 0; i < b.N; i++ {
+			b.StopTimer()
+			workdir := path.Join(tmpdir, "work")
+			require.NoError(b, os.RemoveAll(workdir))
+			require.NoError(b, os.Mkdir(workdir, 0700))
+			download, delayKiller := moduleDownloadSetup(b, workdir,
+				"moduleDownloadDrain")
+			src, r := open(b)
+			b.StartTimer()
+
+			require.NoError(b, download.downloadStream(r, "payload", size))
+			require.NoError(b, download.finishDownloadProcess())
+
+			b.StopTimer()
+			delayKiller.Stop()
+			src.Close()
+			stats := download.streamStats[0]
+			stalled += stats.WriteStall + stats.ReadStall
+			opened += stats.OpenWait
+			b.StartTimer()
+		}
+		b.ReportMetric(float64(stalled.Milliseconds())/float64(b.N), "stall-ms/op")
+		b.ReportMetric(float64(opened.Milliseconds())/float64(b.N), "open-wait-ms/op")
+	})
+}
@@ -261,6 +261,11 @@ type stream struct {
 	name      string
 	openFlags int
 	status    chan error
+	// Closed once the file is open.
+	opened chan struct{}
+	// Only collected for payload files. Must not be accessed before the
+	// status has been received.
+	stats *StreamStats
 }
 
 func newStream(r io.Reader, name string, openFlags int) *stream {
@@ -271,43 +276,86 @@ func newStream(r io.Reader, name string, openFlags int) *stream {
 	}
 }
 
+// newPayloadStream returns a stream of a payload file. If 'name' is a FIFO,
+// its capacity is raised.
+func newPayloadStream(r *namedReader, name string, openFlags int) *stream {
+	s := newStream(r.r, name, openFlags)
+	s.stats = &StreamStats{Name: r.name}
+	if r.prefetch != nil {
+		s.r = r.prefetch
+	}
+	return s
+}
+
 func (s *stream) start() {
 	s.status = make(chan error)
+	s.opened = make(chan struct{})
 	runtime.SetFinalizer(s, func(s *stream) {
 		s.cancel()
 	})
 	// Use function arguments so that garbage collector can destroy outer
 	// object, and invoke our finalizer.
-	go func(r io.Reader, name string, openFlags int, status chan error) {
+	go func(r io.Reader, name string, openFlags int, status chan error,
+		opened chan struct{}, stats *StreamStats) {
 		defer close(status)
 
+		openStart := time.Now()
 		fd, err := os.OpenFile(name, openFlags, 0600)
 		if err != nil {
 			status <- errors.Wrapf(err, "Unable to open %s", name)
 			return
 		}
 		defer fd.Close()
-
-		_, err = io.Copy(fd, r)
+		close(opened)
+
+		if stats == nil {
+			_, err = io.Copy(fd, r)
+		} else {
+			start := time.Now()
+			stats.OpenWait = start.Sub(openStart)
+			if prefetch, ok := r.(*prefetchReader); ok {
+				stats.Prefetched = prefetch.prefetched()
+			}
+			if fi, err := fd.Stat(); err == nil && fi.Mode()&os.ModeNamedPipe != 0 {
+				setPipeSize(fd, streamPipeSize)
+			}
+			err = copyStream(fd, r, stats)
+			stats.Duration = time.Since(start)
+		}
 		if err != nil {
 			status <- errors.Wrapf(err, "Unable to stream into %s", name)
 			return
 		}
 
 		status <- nil
-	}(s.r, s.name, s.openFlags, s.status)
+	}(s.r, s.name, s.openFlags, s.status, s.opened, s.stats)
+}
+
+// isOpen reports whether the file of the stream has been opened.
+func (s *stream) isOpen() bool {
+	select {
+	case <-s.opened:
+		return true
+	default:
+		return false
+	}
 }
 
 func (s *stream) cancel() {
+	_ = s.wait()
+}
+
+// wait waits for the stream to end, and returns its status.
+func (s *stream) wait() error {
 	// Open and immediately close the pipe to shake loose the download
 	// process. We use the non-blocking flag so that we ourselves do not get
 	// stuck.
 
 	for {
 		select {
-		case <-s.status:
+		case err := <-s.status:
 			// Go routine has returned, or channel is closed.
-			return
+			return err
 		default:
 			cancel, err := os.OpenFile(s.name, os.O_RDONLY|syscall.O_NONBLOCK, 0600)
 			if err == nil {
@@ -332,6 +380,9 @@ const (
 type namedReader struct {
 	r    io.Reader
 	name string
+	// Reads ahead from 'r' while the module is busy with the previous
+	// stream.
+	prefetch *prefetchReader
 }
 
 type moduleDownload struct {
@@ -366,6 +417,8 @@ type moduleDownload struct {
 	streamNext *stream
 	// The streaming object for the stream itself
 	stream *stream
+	// Statistics of the payload files streamed so far.
+	streamStats []StreamStats
 
 	////////////////////////////////////////////////////////////////////////
 	// End of status variables
@@ -421,13 +474,22 @@ func (d *moduleDownload) handleCmdErr(err error) error {
 			// We may have gotten a stream already. Start
 			// downloading it straight into "files" directory.
 			filePath := path.Join(d.payloadPath, "files", d.currentStream.name)
-			d.stream = newStream(d.currentStream.r, filePath,
+			d.stream = newPayloadStream(d.currentStream, filePath,
 				os.O_WRONLY|os.O_CREATE|os.O_EXCL)
 			d.stream.start()
 		}
 
 	} else if d.downloaderType == moduleDownloader {
-		// Should always get finishFlag before this happens.
+		// Should always get finishFlag before this happens. If the
+		// module left in the middle of a stream, writing the stream
+		// fails too, which tells more about why.
+		if d.stream != nil && d.stream.isOpen() {
+			err = d.stream.wait()
+			d.stream = nil
+			if err != nil {
+				return err
+			}
+		}
 		return errors.New("Update module terminated in the middle of the download")
 	}
 
@@ -438,7 +500,7 @@ func (d *moduleDownload) handleNextArtifactStream() error {
 	if d.downloaderType == menderDownloader {
 		// Download new stream straight to "files".
 		filePath := path.Join(d.payloadPath, "files", d.currentStream.name)
-		d.stream = newStream(d.currentStream.r, filePath,
+		d.stream = newPayloadStream(d.currentStream, filePath,
 			os.O_WRONLY|os.O_CREATE|os.O_EXCL)
 		d.stream.start()
 	} else {
@@ -450,6 +512,11 @@ func (d *moduleDownload) handleNextArtifactStream() error {
 			return err
 		}
 		d.streamNext.start()
+		// The module reads "stream-next" once it is done with the
+		// previous stream. Meanwhile, read ahead of it.
+		if d.currentStream.prefetch != nil {
+			d.currentStream.prefetch.start()
+		}
 	}
 
 	return nil
@@ -481,7 +548,7 @@ func (d *moduleDownload) handleStreamNextChannel(err error) error {
 	// Process has read from "stream-next", now stream into
 	// the file in the "streams" directory.
 	filePath := path.Join(d.payloadPath, "streams", d.currentStream.name)
-	d.stream = newStream(d.currentStream.r, filePath,
+	d.stream = newPayloadStream(d.currentStream, filePath,
 		os.O_WRONLY)
 	d.stream.start()
 
@@ -489,6 +556,7 @@ func (d *moduleDownload) handleStreamNextChannel(err error) error {
 }
 
 func (d *moduleDownload) handleStreamChannel(err error) error {
+	stats := d.stream.stats
 	d.stream = nil
 
 	// Process has finished streaming, give back status.
@@ -496,6 +564,14 @@ func (d *moduleDownload) handleStreamChannel(err error) error {
 		// If error, bail.
 		return err
 	} else {
+		log.Debugf("Streamed %s: %d bytes at %.1f MiB/s; waited %s for it to be "+
+			"opened, stalled %s on the update module and %s on the artifact "+
+			"(%d bytes read ahead)",
+			stats.Name, stats.Bytes, stats.Throughput()/(1024*1024),
+			stats.OpenWait, stats.WriteStall, stats.ReadStall,
+			stats.Prefetched)
+		d.streamStats = append(d.streamStats, *stats)
+
 		// If successful, stay in loop.
 		d.status <- err
 		return nil
@@ -633,12 +709,43 @@ func (d *moduleDownload) initializeMenderDownload() error {
 	return err
 }
 
-func (d *moduleDownload) downloadStream(r io.Reader, name string) error {
-	d.nextArtifactStream <- &namedReader{r, name}
+// downloadStream streams 'r', of 'size' bytes, or -1 if unknown, as payload
+// file 'name'.
+func (d *moduleDownload) downloadStream(r io.Reader, name string, size int64) error {
+	nr := &namedReader{
+		r:    r,
+		name: name,
+	}
+	// The payload pipeline reads ahead already, into its queue.
+	if _, ok := r.(*payloadPipe); !ok {
+		nr.prefetch = newPrefetchReader(r, size)
+		// The artifact reader must not be read from after we return.
+		defer nr.prefetch.close()
+	}
+	d.nextArtifactStream <- nr
 	err := <-d.status
 	return err
 }
 
+// logStreamStats summarizes how the payload files were streamed.
+func (d *moduleDownload) logStreamStats() {
+	if len(d.streamStats) == 0 {
+		return
+	}
+	var total StreamStats
+	for _, s := range d.streamStats {
+		total.Bytes += s.Bytes
+		total.Duration += s.Duration
+		total.OpenWait += s.OpenWait
+		total.WriteStall += s.WriteStall
+		total.ReadStall += s.ReadStall
+	}
+	log.Infof("Streamed %d payload files, %d bytes, at %.1f MiB/s; waited %s for them "+
+		"to be opened, stalled %s on the update module and %s on the artifact",
+		len(d.streamStats), total.Bytes, total.Throughput()/(1024*1024),
+		total.OpenWait, total.WriteStall, total.ReadStall)
+}
+
 // This function should be called even if downloadStream() returned errors.
 func (d *moduleDownload) finishDownloadProcess() error {
 	d.finishChannel <- true
@@ -707,7 +814,7 @@ func (mod *ModuleInstaller) StoreUpdate(r io.Reader, info os.FileInfo) error {
 		return errors.New("Internal error: StoreUpdate() called when download is inactive")
 	}
 
-	return mod.downloader.downloadStream(r, info.Name())
+	return mod.downloader.downloadStream(r, info.Name(), info.Size())
 }
 
 func (mod *ModuleInstaller) FinishStoreUpdate() error {
@@ -719,6 +826,7 @@ func (mod *ModuleInstaller) FinishStoreUpdate() error {
 
 	err := mod.downloader.finishDownloadProcess()
 	mod.processKiller.Stop()
+	mod.downloader.logStreamStats()
 
 	mod.downloader = nil
 	mod.processKiller = nil
@@ -258,7 +258,7 @@ func TestStreamsTree(t *testing.T) {
 	assert.Equal(t, 0, len(dirlist))
 }
 
-func moduleDownloadSetup(t *testing.T, tmpdir, helperArg string) (*moduleDownload, *delayKiller) {
+func moduleDownloadSetup(t testing.TB, tmpdir, helperArg string) (*moduleDownload, *delayKiller) {
 	require.NoError(t, os.MkdirAll(path.Join(tmpdir, "streams"), 0700))
 	require.NoError(t, os.MkdirAll(path.Join(tmpdir, "tmp"), 0700))
 	require.NoError(t, syscall.Mkfifo(path.Join(tmpdir, "stream-next"), 0600))
@@ -464,7 +464,7 @@ func subTestModulesDownload(t *testing.T, c *modulesDownloadTestCase) {
 
 	for n := range c.streamContents {
 		buf := bytes.NewBuffer([]byte(c.streamContents[n]))
-		err = download.downloadStream(buf, c.streamNames[n])
+		err = download.downloadStream(buf, c.streamNames[n], int64(buf.Len()))
 		if n < len(c.downloadErr) {
 			assertIsError(t, c.downloadErr[n], err)
 		} else {
@@ -41,6 +41,20 @@ case "$1" in
         esac
         exit 0
         ;;
+    moduleDownloadDrain|moduleDownloadDrainSlowly)
+        # Reads and discards every stream, optionally taking its time
+        # before moving on to the next one.
+        while name=$(cat stream-next); do
+            if [ -z "$name" ]; then
+                break
+            fi
+            cat $name > /dev/null
+            if [ "$1" = moduleDownloadDrainSlowly ]; then
+                sleep 0.5
+            fi
+        done
+        exit 0
+        ;;
     moduleDownloadHang)
         sleep 60
         exit 0
@@ -0,0 +1,397 @@
+// Copyright 2023 Northern.tech AS
+//
+//    Licensed under the Apache License, Version 2.0 (the "License");
+//    you may not use this file except in compliance with the License.
+//    You may obtain a copy of the License at
+//
+//        http://www.apache.org/licenses/LICENSE-2.0
+//
+//    Unless required by applicable law or agreed to in writing, software
+//    distributed under the License is distributed on an "AS IS" BASIS,
+//    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//    See the License for the specific language governing permissions and
+//    limitations under the License.
+
+package installer
+
+import (
+	"io"
+	"os"
+	"runtime"
+	"time"
+
+	"github.com/pkg/errors"
+	log "github.com/sirupsen/logrus"
+
+	"github.com/mendersoftware/mender-artifact/handlers"
+	"github.com/mendersoftware/mender/conf"
+	"github.com/mendersoftware/mender/utils"
+)
+
+// DefaultPayloadPipelineBuffers is the number of buffers of payload data
+// queued between the artifact reader and the payload writer, unless
+// configured. With a single CPU the stages cannot overlap, and payloads are
+// stored sequentially unless the buffers are configured.
+const DefaultPayloadPipelineBuffers = 16
+
+var errPayloadWriterDone = errors.New("payload writer stopped reading")
+
+// PayloadStats describes how one payload file was stored.
+type PayloadStats struct {
+	Name  string
+	Bytes int64
+	// Whether reading and writing overlapped.
+	Pipelined bool
+	// Total time to store the file.
+	Duration time.Duration
+	// Time spent reading the file from the artifact, which decompresses
+	// and hashes it.
+	ReadTime time.Duration
+	// Time spent in the update module or partition writer, other than
+	// waiting for data.
+	WriteTime time.Duration
+	// Time the reader waited for the writer to free a buffer.
+	ReadStall time.Duration
+	// Time the writer waited for the reader to fill a buffer.
+	WriteStall time.Duration
+}
+
+func throughput(bytes int64, d time.Duration) float64 {
+	if d <= 0 {
+		return 0
+	}
+	return float64(bytes) / d.Seconds()
+}
+
+// ReadThroughput returns the bytes per second of the decompress and verify
+// stage.
+func (s *PayloadStats) ReadThroughput() float64 {
+	return throughput(s.Bytes, s.ReadTime)
+}
+
+// WriteThroughput returns the bytes per second of the write stage.
+func (s *PayloadStats) WriteThroughput() float64 {
+	return throughput(s.Bytes, s.WriteTime)
+}
+
+// Throughput returns the end-to-end bytes per second.
+func (s *PayloadStats) Throughput() float64 {
+	return throughput(s.Bytes, s.Duration)
+}
+
+// payloadChunk is a buffer of payload data handed from the reader to the
+// writer. The last chunk has no buffer, and carries the error which ended the
+// read: io.EOF, or, notably, the checksum error of the artifact reader.
+type payloadChunk struct {
+	buf *[]byte
+	n   int
+	err error
+}
+
+// payloadPipe is a bounded queue of pooled buffers between the goroutine
+// reading the artifact, and the goroutine writing the payload. The writer
+// side is an io.Reader, and an io.WriterTo, so that io.Copy writes straight
+// out of the queued buffers.
+type payloadPipe struct {
+	chunks chan payloadChunk
+	// Closed when the writer stops reading.
+	done chan struct{}
+
+	// Reader side.
+	readTime  time.Duration
+	readStall time.Duration
+
+	// Writer side.
+	current    *payloadChunk
+	off        int
+	err        error
+	writeStall time.Duration
+}
+
+func newPayloadPipe(buffers int) *payloadPipe {
+	return &payloadPipe{
+		chunks: make(chan payloadChunk, buffers),
+		done:   make(chan struct{}),
+	}
+}
+
+// send queues 'c', unless the writer has stopped reading.
+func (p *payloadPipe) send(c payloadChunk) error {
+	select {
+	case p.chunks <- c:
+		return nil
+	default:
+	}
+	start := time.Now()
+	defer func() {
+		p.readStall += time.Since(start)
+	}()
+	select {
+	case p.chunks <- c:
+		return nil
+	case <-p.done:
+		if c.buf != nil {
+			streamBufferPool.Put(c.buf)
+		}
+		return errPayloadWriterDone
+	}
+}
+
+// fill reads 'r' into the queue until it ends, or the writer stops reading.
+// Either way the returned error is not nil.
+func (p *payloadPipe) fill(r io.Reader) error {
+	for {
+		buf := streamBufferPool.Get().(*[]byte)
+		b := *buf
+		n := 0
+		var err error
+		start := time.Now()
+		for n < len(b) && err == nil {
+			var m int
+			m, err = r.Read(b[n:])
+			n += m
+		}
+		p.readTime += time.Since(start)
+
+		if n > 0 {
+			if sendErr := p.send(payloadChunk{buf: buf, n: n}); sendErr != nil {
+				return sendErr
+			}
+		} else {
+			streamBufferPool.Put(buf)
+		}
+		if err != nil {
+			if sendErr := p.send(payloadChunk{err: err}); sendErr != nil {
+				return sendErr
+			}
+			return err
+		}
+	}
+}
+
+// next makes the next chunk current, and reports whether there is one.
+func (p *payloadPipe) next() bool {
+	if p.current != nil {
+		return true
+	}
+	if p.err != nil {
+		return false
+	}
+	var c payloadChunk
+	select {
+	case c = <-p.chunks:
+	default:
+		start := time.Now()
+		c = <-p.chunks
+		p.writeStall += time.Since(start)
+	}
+	if c.buf == nil {
+		p.err = c.err
+		return false
+	}
+	p.current = &c
+	p.off = 0
+	return true
+}
+
+func (p *payloadPipe) release() {
+	streamBufferPool.Put(p.current.buf)
+	p.current = nil
+}
+
+func (p *payloadPipe) Read(b []byte) (int, error) {
+	if !p.next() {
+		return 0, p.err
+	}
+	n := copy(b, (*p.current.buf)[p.off:p.current.n])
+	p.off += n
+	if p.off == p.current.n {
+		p.release()
+	}
+	return n, nil
+}
+
+func (p *payloadPipe) WriteTo(w io.Writer) (int64, error) {
+	var written int64
+	for p.next() {
+		n, err := w.Write((*p.current.buf)[p.off:p.current.n])
+		written += int64(n)
+		p.off += n
+		if err != nil {
+			return written, err
+		}
+		if p.off < p.current.n {
+			return written, io.ErrShortWrite
+		}
+		p.release()
+	}
+	if p.err == io.EOF {
+		return written, nil
+	}
+	return written, p.err
+}
+
+// closeRead is called by the writer once it is done. Queued buffers are
+// returned to the pool once the reader is done as well, by drain.
+func (p *payloadPipe) closeRead() {
+	if p.current != nil {
+		p.release()
+	}
+	close(p.done)
+}
+
+func (p *payloadPipe) drain() {
+	for {
+		select {
+		case c := <-p.chunks:
+			if c.buf != nil {
+				streamBufferPool.Put(c.buf)
+			}
+		default:
+			return
+		}
+	}
+}
+
+// timedReader measures the time spent reading 'r'.
+type timedReader struct {
+	r io.Reader
+	d time.Duration
+}
+
+func (t *timedReader) Read(b []byte) (int, error) {
+	start := time.Now()
+	n, err := t.r.Read(b)
+	t.d += time.Since(start)
+	return n, err
+}
+
+// payloadStorer wraps the UpdateStorer of a payload. Unless 'buffers' is
+// zero, it reads each file of the payload from the artifact on the calling
+// goroutine, which decompresses and hashes it, while the wrapped
+// UpdateStorer writes it on another. Either way it keeps the PayloadStats of
+// each file.
+type payloadStorer struct {
+	handlers.UpdateStorer
+	buffers int
+	stats   []PayloadStats
+}
+
+func (s *payloadStorer) StoreUpdate(r io.Reader, info os.FileInfo) error {
+	stats := PayloadStats{
+		Name:      info.Name(),
+		Pipelined: s.buffers > 0,
+	}
+	start := time.Now()
+	var err error
+	if s.buffers > 0 {
+		err = s.storePipelined(r, info, &stats)
+	} else {
+		tr := &timedReader{r: r}
+		err = s.UpdateStorer.StoreUpdate(tr, info)
+		stats.ReadTime = tr.d
+	}
+	stats.Duration = time.Since(start)
+	if stats.Pipelined {
+		stats.WriteTime = stats.Duration - stats.WriteStall
+	} else {
+		stats.WriteTime = stats.Duration - stats.ReadTime
+	}
+	if err == nil {
+		stats.Bytes = info.Size()
+		utils.Metrics.Add(utils.StageDecompressVerify, stats.Bytes, stats.ReadTime)
+		utils.Metrics.Add(utils.StageWrite, stats.Bytes, stats.WriteTime)
+		log.Debugf("Stored %s: %d bytes in %s, reading at %.1f MB/s, "+
+			"writing at %.1f MB/s", stats.Name, stats.Bytes, stats.Duration,
+			stats.ReadThroughput()/1e6, stats.WriteThroughput()/1e6)
+	}
+	s.stats = append(s.stats, stats)
+	return err
+}
+
+func (s *payloadStorer) storePipelined(
+	r io.Reader,
+	info os.FileInfo,
+	stats *PayloadStats,
+) error {
+	p := newPayloadPipe(s.buffers)
+	writeErr := make(chan error, 1)
+	go func() {
+		err := s.UpdateStorer.StoreUpdate(p, info)
+		p.closeRead()
+		writeErr <- err
+	}()
+
+	readErr := p.fill(r)
+	err := <-writeErr
+	p.drain()
+
+	stats.ReadTime = p.readTime
+	stats.ReadStall = p.readStall
+	stats.WriteStall = p.writeStall
+
+	if err != nil {
+		return err
+	}
+	// If the writer returned without reading everything, the artifact
+	// reader fails the checksum verification of the file, as it does
+	// when storing sequentially.
+	if readErr != io.EOF && readErr != errPayloadWriterDone {
+		return readErr
+	}
+	return nil
+}
+
+func (s *payloadStorer) FinishStoreUpdate() error {
+	err := s.UpdateStorer.FinishStoreUpdate()
+	var total PayloadStats
+	for _, stats := range s.stats {
+		total.Bytes += stats.Bytes
+		total.Duration += stats.Duration
+		total.ReadTime += stats.ReadTime
+		total.WriteTime += stats.WriteTime
+	}
+	if total.Bytes > 0 {
+		log.Infof("Stored %d bytes of payload in %s: read and verified at "+
+			"%.1f MB/s, written at %.1f MB/s", total.Bytes, total.Duration,
+			total.ReadThroughput()/1e6, total.WriteThroughput()/1e6)
+	}
+	return err
+}
+
+// payloadStorerProducer wraps the UpdateStorers of a producer in
+// payloadStorers.
+type payloadStorerProducer struct {
+	handlers.UpdateStorerProducer
+	buffers int
+}
+
+func newPayloadStorerProducer(
+	producer handlers.UpdateStorerProducer,
+	config conf.PayloadPipelineConfig,
+) handlers.UpdateStorerProducer {
+	buffers := config.Buffers
+	if config.Sequential {
+		buffers = 0
+	} else if buffers <= 0 {
+		buffers = 0
+		if runtime.GOMAXPROCS(0) > 1 {
+			buffers = DefaultPayloadPipelineBuffers
+		}
+	}
+	return &payloadStorerProducer{
+		UpdateStorerProducer: producer,
+		buffers:              buffers,
+	}
+}
+
+func (p *payloadStorerProducer) NewUpdateStorer(
+	updateType *string,
+	payloadNum int,
+) (handlers.UpdateStorer, error) {
+	us, err := p.UpdateStorerProducer.NewUpdateStorer(updateType, payloadNum)
+	if err != nil {
+		return nil, err
+	}
+	return &payloadStorer{UpdateStorer: us, buffers: p.buffers}, nil
+}
@@ -0,0 +1,308 @@
+// Copyright 2023 Northern.tech AS
+//
+//    Licensed under the Apache License, Version 2.0 (the "License");
+//    you may not use this file except in compliance with the License.
+//    You may obtain a copy of the License at
+//
+//        http://www.apache.org/licenses/LICENSE-2.0
+//
+//    Unless required by applicable law or agreed to in writing, software
+//    distributed under the License is distributed on an "AS IS" BASIS,
+//    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//    See the License for the specific language governing permissions and
+//    limitations under the License.
+
+package installer
+
+import (
+	"bytes"
+	"fmt"
+	"io"
+	"io/ioutil"
+	"math/rand"
+	"os"
+	"path"
+	"runtime"
+	"testing"
+	"time"
+
+	"github.com/pkg/errors"
+	log "github.com/sirupsen/logrus"
+	"github.com/stretchr/testify/assert"
+	"github.com/stretchr/testify/require"
+
+	"github.com/mendersoftware/mender-artifact/handlers"
+	"github.com/mendersoftware/mender/conf"
+	"github.com/mendersoftware/mender/tests"
+)
+
+// recordingDevice keeps what is stored, and the error which ended the read.
+type recordingDevice struct {
+	fDevice
+	data    bytes.Buffer
+	readErr error
+	// If not negative, stop reading after 'limit' bytes, and return
+	// 'storeErr'.
+	limit    int64
+	storeErr error
+	onlyRead bool
+}
+
+func newRecordingDevice() *recordingDevice {
+	return &recordingDevice{limit: -1}
+}
+
+func (d *recordingDevice) NewUpdateStorer(
+	updateType *string,
+	payload int,
+) (handlers.UpdateStorer, error) {
+	return d, nil
+}
+
+func (d *recordingDevice) StoreUpdate(r io.Reader, info os.FileInfo) error {
+	if d.onlyRead {
+		r = onlyReader{r}
+	}
+	if d.limit >= 0 {
+		_, d.readErr = io.CopyN(&d.data, r, d.limit)
+		return d.storeErr
+	}
+	_, d.readErr = io.Copy(&d.data, r)
+	return d.readErr
+}
+
+type failingReader struct {
+	err error
+}
+
+func (r failingReader) Read(b []byte) (int, error) {
+	return 0, r.err
+}
+
+// payloadTestData returns 'size' bytes which compress like a root file system
+// would: a quarter of random data, a quarter of text, and zeros.
+func payloadTestData(size int) []byte {
+	data := make([]byte, size)
+	rnd := rand.New(rand.NewSource(42))
+	quarter := size / 4
+	rnd.Read(data[:quarter])
+	for i := quarter; i < 2*quarter; {
+		i += copy(data[i:2*quarter], fmt.Sprintf("line %d: %x\n", i, rnd.Int31n(64)))
+	}
+	return data
+}
+
+func TestPayloadStorer(t *testing.T) {
+	data := streamTestData(5*streamBufferSize + 7)
+
+	for _, buffers := range []int{0, 1, 4} {
+		for _, size := range []int{0, 1, streamBufferSize + 1, len(data)} {
+			for _, onlyRead := range []bool{false, true} {
+				name := fmt.Sprintf("buffers=%d/size=%d/onlyRead=%v",
+					buffers, size, onlyRead)
+				t.Run(name, func(t *testing.T) {
+					dev := newRecordingDevice()
+					dev.onlyRead = onlyRead
+					s := &payloadStorer{UpdateStorer: dev, buffers: buffers}
+
+					err := s.StoreUpdate(bytes.NewReader(data[:size]),
+						&sizeOnlyFileInfo{int64(size)})
+					require.NoError(t, err)
+					assert.True(t, bytes.Equal(data[:size], dev.data.Bytes()))
+
+					require.Len(t, s.stats, 1)
+					assert.EqualValues(t, size, s.stats[0].Bytes)
+					assert.Equal(t, buffers > 0, s.stats[0].Pipelined)
+					assert.Positive(t, s.stats[0].Duration)
+				})
+			}
+		}
+	}
+
+	for _, buffers := range []int{0, 4} {
+		t.Run(fmt.Sprintf("read error/buffers=%d", buffers), func(t *testing.T) {
+			// Like a checksum mismatch: the writer must see the
+			// error instead of the end of the file.
+			readErr := errors.New("invalid checksum")
+			dev := newRecordingDevice()
+			s := &payloadStorer{UpdateStorer: dev, buffers: buffers}
+
+			err := s.StoreUpdate(io.MultiReader(bytes.NewReader(data),
+				failingReader{readErr}), &sizeOnlyFileInfo{int64(len(data))})
+			assert.Equal(t, readErr, err)
+			assert.Equal(t, readErr, dev.readErr)
+			assert.True(t, bytes.Equal(data, dev.data.Bytes()))
+		})
+
+		t.Run(fmt.Sprintf("write error/buffers=%d", buffers), func(t *testing.T) {
+			dev := newRecordingDevice()
+			dev.limit = 10
+			dev.storeErr = errors.New("disk full")
+			s := &payloadStorer{UpdateStorer: dev, buffers: buffers}
+
+			err := s.StoreUpdate(bytes.NewReader(data), &sizeOnlyFileInfo{int64(len(data))})
+			assert.EqualError(t, err, "disk full")
+			assert.Equal(t, 10, dev.data.Len())
+		})
+
+		t.Run(fmt.Sprintf("short write/buffers=%d", buffers), func(t *testing.T) {
+			// Leaves it to the artifact reader to find out that
+			// the file was not read to the end.
+			dev := newRecordingDevice()
+			dev.limit = 10
+			s := &payloadStorer{UpdateStorer: dev, buffers: buffers}
+
+			err := s.StoreUpdate(bytes.NewReader(data), &sizeOnlyFileInfo{int64(len(data))})
+			assert.NoError(t, err)
+		})
+	}
+}
+
+func TestInstallPipeline(t *testing.T) {
+	data := payloadTestData(3*streamBufferSize + 5)
+	depends := &tests.ArtifactDepends{
+		CompatibleDevices: []string{"vexpress-qemu"},
+	}
+
+	configs := map[string]conf.PayloadPipelineConfig{
+		"sequential":      {Sequential: true},
+		"default":         {},
+		"one buffer":      {Buffers: 1},
+		"sequential wins": {Buffers: 1, Sequential: true},
+	}
+	for name, config := range configs {
+		t.Run(name, func(t *testing.T) {
+			art, err := tests.CreateTestArtifactV3(string(data), "gzip", nil, depends,
+				nil, nil)
+			require.NoError(t, err)
+			dev := newRecordingDevice()
+
+			inst, payloads, err := ReadHeaders(art, "vexpress-qemu", nil, "",
+				&AllModules{DualRootfs: dev, Pipeline: config})
+			require.NoError(t, err)
+			require.Len(t, payloads, 1)
+			assert.Equal(t, dev, payloads[0])
+
+			require.NoError(t, inst.StorePayloads())
+			assert.True(t, bytes.Equal(data, dev.data.Bytes()))
+
+			stats := inst.PayloadStats()
+			require.Len(t, stats, 1)
+			assert.EqualValues(t, len(data), stats[0].Bytes)
+			pipelined := !config.Sequential &&
+				(config.Buffers > 0 || runtime.GOMAXPROCS(0) > 1)
+			assert.Equal(t, pipelined, stats[0].Pipelined)
+		})
+
+		t.Run(name+"/checksum mismatch", func(t *testing.T) {
+			art, err := tests.CreateTestArtifactV3(string(data), "none", nil, depends,
+				nil, nil)
+			require.NoError(t, err)
+			raw, err := ioutil.ReadAll(art)
+			require.NoError(t, err)
+			// The payload is stored as is, so changing it only
+			// breaks the checksum.
+			off := bytes.Index(raw, data[:64])
+			require.Positive(t, off)
+			raw[off+100] ^= 0xff
+
+			dev := newRecordingDevice()
+			_, err = Install(ioutil.NopCloser(bytes.NewReader(raw)), "vexpress-qemu",
+				nil, "", &AllModules{DualRootfs: dev, Pipeline: config})
+			require.Error(t, err)
+			assert.Contains(t, err.Error(), "invalid checksum")
+			// The storer got the error, and not the end of the file.
+			require.Error(t, dev.readErr)
+			assert.Contains(t, dev.readErr.Error(), "invalid checksum")
+		})
+	}
+}
+
+// BenchmarkInstall installs compressed rootfs artifacts to a file-backed
+// partition, with and without overlapping the decompress and verify stage
+// with the write stage. Besides the end-to-end time, it reports the
+// throughput of each stage.
+func BenchmarkInstall(b *testing.B) {
+	const size = 32 * 1024 * 1024
+
+	level := log.GetLevel()
+	log.SetLevel(log.WarnLevel)
+	defer log.SetLevel(level)
+
+	td, err := ioutil.TempDir("", "BenchmarkInstall")
+	require.NoError(b, err)
+	defer os.RemoveAll(td)
+	partPath := path.Join(td, "inactive")
+
+	oldSizeOf := BlockDeviceGetSizeOf
+	oldSectorSizeOf := BlockDeviceGetSectorSizeOf
+	BlockDeviceGetSizeOf = func(file *os.File) (uint64, error) { return size, nil }
+	BlockDeviceGetSectorSizeOf = func(file *os.File) (int, error) { return 512, nil }
+	defer func() {
+		BlockDeviceGetSizeOf = oldSizeOf
+		BlockDeviceGetSectorSizeOf = oldSectorSizeOf
+	}()
+	dev := &dualRootfsDeviceImpl{
+		partitions: &partitions{inactive: partPath},
+	}
+
+	data := string(payloadTestData(size))
+	depends := &tests.ArtifactDepends{
+		CompatibleDevices: []string{"vexpress-qemu"},
+	}
+
+	for _, compression := range []string{"none", "gzip", "lzma"} {
+		art, err := tests.CreateTestArtifactV3(data, compression, nil, depends, nil, nil)
+		require.NoError(b, err)
+		raw, err := ioutil.ReadAll(art)
+		require.NoError(b, err)
+
+		for _, sequential := range []bool{true, false} {
+			name := compression + "/pipelined"
+			if sequential {
+				name = compression + "/sequential"
+			}
+			b.Run(name, func(b *testing.B) {
+				b.SetBytes(size)
+				var total PayloadStats
+				for i := 0; i < b.N; i++ {
+					// A blank partition, so that every frame
+					// is written.
+					b.StopTimer()
+					part, err := os.Create(partPath)
+					require.NoError(b, err)
+					require.NoError(b, part.Truncate(size))
+					part.Close()
+					b.StartTimer()
+
+					inst, _, err := ReadHeaders(
+						ioutil.NopCloser(bytes.NewReader(raw)),
+						"vexpress-qemu", nil, "",
+						&AllModules{
+							DualRootfs: dev,
+							Pipeline: conf.PayloadPipelineConfig{
+								Buffers:    DefaultPayloadPipelineBuffers,
+								Sequential: sequential,
+							},
+						})
+					require.NoError(b, err)
+					require.NoError(b, inst.StorePayloads())
+
+					for _, stats := range inst.PayloadStats() {
+						total.Bytes += stats.Bytes
+						total.ReadTime += stats.ReadTime
+						total.WriteTime += stats.WriteTime
+						total.ReadStall += stats.ReadStall
+						total.WriteStall += stats.WriteStall
+					}
+				}
+				ms := func(d time.Duration) float64 {
+					return float64(d.Milliseconds()) / float64(b.N)
+				}
+				b.ReportMetric(total.ReadThroughput()/1e6, "read-MB/s")
+				b.ReportMetric(total.WriteThroughput()/1e6, "write-MB/s")
+				b.ReportMetric(ms(total.ReadStall+total.WriteStall), "stall-ms/op")
+			})
+		}
+	}
+}
@@ -0,0 +1,154 @@
+// Copyright 2023 Northern.tech AS
+//
+//    Licensed under the Apache License, Version 2.0 (the "License");
+//    you may not use this file except in compliance with the License.
+//    You may obtain a copy of the License at
+//
+//        http://www.apache.org/licenses/LICENSE-2.0
+//
+//    Unless required by applicable law or agreed to in writing, software
+//    distributed under the License is distributed on an "AS IS" BASIS,
+//    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//    See the License for the specific language governing permissions and
+//    limitations under the License.
+
+package installer
+
+import (
+	"fmt"
+	"io"
+	"io/ioutil"
+	"os"
+	"path"
+	"testing"
+	"time"
+
+	log "github.com/sirupsen/logrus"
+	"github.com/stretchr/testify/require"
+
+	"github.com/mendersoftware/mender/client"
+	cltest "github.com/mendersoftware/mender/client/test"
+	"github.com/mendersoftware/mender/conf"
+	"github.com/mendersoftware/mender/datastore"
+	"github.com/mendersoftware/mender/store"
+	"github.com/mendersoftware/mender/tests"
+	"github.com/mendersoftware/mender/utils"
+)
+
+// BenchmarkUpdatePipeline runs the whole path of a rootfs update: download
+// from the client test server, decompression and verification, writing to a
+// file backed partition, and committing the artifact to the store. Besides
+// the overall throughput, it reports the throughput of each stage, as counted
+// by utils.Metrics.
+func BenchmarkUpdatePipeline(b *testing.B) {
+	const size = 32 * 1024 * 1024
+
+	level := log.GetLevel()
+	log.SetLevel(log.WarnLevel)
+	defer log.SetLevel(level)
+
+	td, err := ioutil.TempDir("", "BenchmarkUpdatePipeline")
+	require.NoError(b, err)
+	defer os.RemoveAll(td)
+	partPath := path.Join(td, "inactive")
+
+	oldSizeOf := BlockDeviceGetSizeOf
+	oldSectorSizeOf := BlockDeviceGetSectorSizeOf
+	BlockDeviceGetSizeOf = func(file *os.File) (uint64, error) { return size, nil }
+	BlockDeviceGetSectorSizeOf = func(file *os.File) (int, error) { return 512, nil }
+	defer func() {
+		BlockDeviceGetSizeOf = oldSizeOf
+		BlockDeviceGetSectorSizeOf = oldSectorSizeOf
+	}()
+
+	dbStore := store.NewDBStore(td)
+	require.NotNil(b, dbStore)
+	defer dbStore.Close()
+
+	dev := &dualRootfsDeviceImpl{
+		partitions: &partitions{inactive: partPath},
+		indexStore: dbStore,
+	}
+
+	srv := cltest.NewClientTestServer()
+	defer srv.Close()
+	srv.UpdateDownload.RangeSupport = true
+	url := srv.URL + "/api/devices/v1/download"
+
+	api, err := client.NewApiClient(client.Config{})
+	require.NoError(b, err)
+
+	data := string(payloadTestData(size))
+	depends := &tests.ArtifactDepends{
+		CompatibleDevices: []string{"vexpress-qemu"},
+	}
+
+	for _, compression := range []string{"none", "gzip", "lzma"} {
+		art, err := tests.CreateTestArtifactV3(data, compression, nil, depends, nil, nil)
+		require.NoError(b, err)
+		srv.UpdateDownload.Data.Reset()
+		_, err = io.Copy(&srv.UpdateDownload.Data, art)
+		require.NoError(b, err)
+
+		b.Run(compression, func(b *testing.B) {
+			b.SetBytes(size)
+			var stages []*utils.UpdateMetricsReport
+			for i := 0; i < b.N; i++ {
+				// A blank partition, so that every frame is
+				// written.
+				b.StopTimer()
+				part, err := os.Create(partPath)
+				require.NoError(b, err)
+				require.NoError(b, part.Truncate(size))
+				part.Close()
+				utils.Metrics.Begin(fmt.Sprintf("%s-%d", compression, i))
+				b.StartTimer()
+
+				image, _, err := client.NewUpdate().FetchUpdate(api, url, time.Minute)
+				require.NoError(b, err)
+				inst, _, err := ReadHeaders(image, "vexpress-qemu", nil, "",
+					&AllModules{
+						DualRootfs: dev,
+						Pipeline: conf.PayloadPipelineConfig{
+							Buffers: DefaultPayloadPipelineBuffers,
+						},
+					})
+				require.NoError(b, err)
+				require.NoError(b, inst.StorePayloads())
+				image.Close()
+
+				err = dbStore.WriteTransaction(func(txn store.Transaction) error {
+					return datastore.CommitArtifactData(txn,
+						inst.GetArtifactName(), "", nil, nil)
+				})
+				require.NoError(b, err)
+
+				b.StopTimer()
+				stages = append(stages, utils.Metrics.Report())
+				b.StartTimer()
+			}
+
+			// Per stage throughput, over all iterations.
+			for _, name := range []string{"download", "decompress_verify", "write", "sync"} {
+				var bytes int64
+				var seconds float64
+				for _, report := range stages {
+					bytes += report.Stages[name].Bytes
+					seconds += report.Stages[name].Seconds
+				}
+				if seconds > 0 {
+					b.ReportMetric(float64(bytes)/seconds/1e6, name+"-MB/s")
+				}
+			}
+			var commits int64
+			var seconds float64
+			for _, report := range stages {
+				commits += report.Stages["store_commit"].Count
+				seconds += report.Stages["store_commit"].Seconds
+			}
+			if commits > 0 {
+				b.ReportMetric(seconds*1e3/float64(commits), "ms/commit")
+			}
+		})
+	}
+}
@@ -17,8 +17,11 @@ import (
 	"io/ioutil"
 	"os"
 	"path"
+	"sort"
 	"strings"
+	"sync"
 	"syscall"
+	"time"
 
 	"github.com/pkg/errors"
 	log "github.com/sirupsen/logrus"
@@ -30,18 +33,48 @@ import (
 
 const (
 	inventoryToolPrefix = "mender-inventory-"
+
+	// DefaultToolConcurrency is the number of inventory tools run at the
+	// same time, unless configured.
+	DefaultToolConcurrency = 4
+	// DefaultToolTimeout is the time after which an inventory tool is
+	// killed, unless configured.
+	DefaultToolTimeout = 5 * time.Minute
 )
 
-func NewInventoryDataRunner(scriptsDir string) InventoryDataRunner {
+// NewInventoryDataRunner returns a runner of the inventory tools in
+// scriptsDir, which runs up to 'concurrency' tools at once, and kills the ones
+// running for longer than 'timeout'. Zero values select the defaults.
+func NewInventoryDataRunner(
+	scriptsDir string,
+	concurrency int,
+	timeout time.Duration,
+) InventoryDataRunner {
+	if concurrency <= 0 {
+		concurrency = DefaultToolConcurrency
+	}
+	if timeout <= 0 {
+		timeout = DefaultToolTimeout
+	}
 	return InventoryDataRunner{
 		scriptsDir,
 		&system.OsCalls{},
+		concurrency,
+		timeout,
 	}
 }
 
 type InventoryDataRunner struct {
-	dir string
-	cmd system.Commander
+	dir         string
+	cmd         system.Commander
+	concurrency int
+	timeout     time.Duration
+}
+
+// toolResult is the output of one inventory tool, or nil if it failed.
+type toolResult struct {
+	data    map[string][]string
+	runtime time.Duration
 }
 
 func listRunnable(dpath string) ([]string, error) {
@@ -74,35 +107,96 @@ func (id *InventoryDataRunner) Get() (client.InventoryData, error) {
 		return nil, errors.Wrapf(err, "failed to list tools for inventory data")
 	}
 
+	start := time.Now()
+	results := make([]toolResult, len(tools))
+	slots := make(chan struct{}, id.concurrency)
+	var wg sync.WaitGroup
+	for i, t := range tools {
+		slots <- struct{}{}
+		wg.Add(1)
+		go func(i int, t string) {
+			defer func() {
+				<-slots
+				wg.Done()
+			}()
+			toolStart := time.Now()
+			results[i].data = id.runTool(t)
+			results[i].runtime = time.Since(toolStart)
+		}(i, t)
+	}
+	wg.Wait()
+
+	// Merge in the order of the tools, not the order they finished, so
+	// that multi-valued attributes are always in the same order.
 	idec := NewInventoryDataDecoder()
-	for _, t := range tools {
-		cmd := id.cmd.Command(t)
-		out, err := cmd.StdoutPipe()
-		if err != nil {
-			log.Errorf("Failed to open stdout for inventory tool %s: %v", t, err)
-			continue
+	slowest := -1
+	for i, r := range results {
+		log.Debugf("Inventory tool %s ran for %s", tools[i], r.runtime)
+		if slowest < 0 || r.runtime > results[slowest].runtime {
+			slowest = i
 		}
-
-		if err := cmd.Start(); err != nil {
-			log.Errorf("Inventory tool %s failed with status: %v", t, err)
-			continue
+		if r.data != nil {
+			idec.AppendFromRaw(r.data)
 		}
+	}
+	if slowest >= 0 {
+		log.Infof("Ran %d inventory tools in %s, the slowest was %s (%s)",
+			len(tools), time.Since(start), path.Base(tools[slowest]),
+			results[slowest].runtime)
+	}
+	return idec.GetInventoryData(), nil
+}
 
-		p := utils.KeyValParser{}
-		var parseErr error
-		if parseErr = p.Parse(out); parseErr != nil {
-			log.Warnf("Inventory tool %s returned unparsable output: %v", t, parseErr)
-		}
+// runTool runs the inventory tool 't', and returns its parsed output, or nil
+// if it failed.
+func (id *InventoryDataRunner) runTool(t string) map[string][]string {
+	cmd := id.cmd.Command(t)
+	out, err := cmd.StdoutPipe()
+	if err != nil {
+		log.Errorf("Failed to open stdout for inventory tool %s: %v", t, err)
+		return nil
+	}
 
-		if err := cmd.Wait(); err != nil {
-			log.Warnf("Inventory tool %s wait failed: %v", t, err)
-		}
+	// Run the tool in its own process group, so that it can be killed
+	// along with its children, without killing Mender.
+	cmd.SysProcAttr = &syscall.SysProcAttr{Setpgid: true}
 
-		if parseErr == nil {
-			idec.AppendFromRaw(p.Collect())
-		}
+	if err := cmd.Start(); err != nil {
+		log.Errorf("Inventory tool %s failed with status: %v", t, err)
+		return nil
 	}
-	return idec.GetInventoryData(), nil
+
+	timedOut := false
+	var timeoutLock sync.Mutex
+	timer := time.AfterFunc(id.timeout, func() {
+		timeoutLock.Lock()
+		timedOut = true
+		timeoutLock.Unlock()
+		_ = syscall.Kill(-cmd.Process.Pid, syscall.SIGKILL)
+	})
+
+	p := utils.KeyValParser{}
+	var parseErr error
+	if parseErr = p.Parse(out); parseErr != nil {
+		log.Warnf("Inventory tool %s returned unparsable output: %v", t, parseErr)
+	}
+
+	err = cmd.Wait()
+	timer.Stop()
+	timeoutLock.Lock()
+	defer timeoutLock.Unlock()
+	if timedOut {
+		log.Errorf("Inventory tool %s timed out after %s, ignoring its output",
+			t, id.timeout)
+		return nil
+	} else if err != nil {
+		log.Warnf("Inventory tool %s wait failed: %v", t, err)
+	}
+
+	if parseErr != nil {
+		return nil
+	}
+	return p.Collect()
 }
 
 type InventoryDataDecoder struct {
@@ -123,6 +217,9 @@ func (id *InventoryDataDecoder) GetInventoryData() client.InventoryData {
 	for _, v := range id.data {
 		idata = append(idata, v)
 	}
+	sort.Slice(idata, func(i, j int) bool {
+		return idata[i].Name < idata[j].Name
+	})
 	return idata
 }
 
@@ -14,10 +14,12 @@
 package inventory
 
 import (
+	"fmt"
 	"io/ioutil"
 	"os"
 	"path"
 	"testing"
+	"time"
 
 	"github.com/mendersoftware/mender/client"
 	"github.com/stretchr/testify/assert"
@@ -80,10 +82,60 @@ func TestInventoryDataParseError(t *testing.T) {
 	fd.Write([]byte("#!/bin/sh\necho bogus\n"))
 	fd.Close()
 
-	inventory := NewInventoryDataRunner(tmpDir)
+	inventory := NewInventoryDataRunner(tmpDir, 0, 0)
 	data, err := inventory.Get()
 	// Does not return individial errors, only logging, but should result in
 	// empty inventory data.
 	assert.NoError(t, err)
 	assert.Equal(t, 0, len(data))
 }
+
+func writeInventoryTool(t *testing.T, dir, name, script string) {
+	err := ioutil.WriteFile(path.Join(dir, "mender-inventory-"+name),
+		[]byte("#!/bin/sh\n"+script+"\n"), 0755)
+	require.NoError(t, err)
+}
+
+func TestInventoryDataRunnerConcurrent(t *testing.T) {
+	tmpDir, err := ioutil.TempDir("", "")
+	require.NoError(t, err)
+	defer os.RemoveAll(tmpDir)
+
+	// The first tools finish last, but their values come first.
+	for i, name := range []string{"a", "b", "c", "d"} {
+		writeInventoryTool(t, tmpDir, name,
+			fmt.Sprintf("sleep 0.%d\necho multi=%s\necho %s=%d", 8-2*i, name, name, i))
+	}
+
+	inventory := NewInventoryDataRunner(tmpDir, 4, time.Minute)
+	start := time.Now()
+	data, err := inventory.Get()
+	require.NoError(t, err)
+	assert.Less(t, int64(time.Since(start)), int64(1500*time.Millisecond),
+		"the tools must run concurrently")
+
+	assert.Equal(t, client.InventoryData{
+		{Name: "a", Value: "0"},
+		{Name: "b", Value: "1"},
+		{Name: "c", Value: "2"},
+		{Name: "d", Value: "3"},
+		{Name: "multi", Value: []string{"a", "b", "c", "d"}},
+	}, data)
+}
+
+func TestInventoryDataRunnerTimeout(t *testing.T) {
+	tmpDir, err := ioutil.TempDir("", "")
+	require.NoError(t, err)
+	defer os.RemoveAll(tmpDir)
+
+	writeInventoryTool(t, tmpDir, "fast", "echo fast=yes")
+	// The child keeps stdout open, so it must be killed too.
+	writeInventoryTool(t, tmpDir, "slow", "echo slow=yes\nsleep 30 &\nsleep 30")
+
+	inventory := NewInventoryDataRunner(tmpDir, 1, 300*time.Millisecond)
+	start := time.Now()
+	data, err := inventory.Get()
+	require.NoError(t, err)
+	assert.Less(t, int64(time.Since(start)), int64(10*time.Second))
+	assert.Equal(t, client.InventoryData{{Name: "fast", Value: "yes"}}, data)
+}
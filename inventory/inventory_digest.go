@@ -0,0 +1,130 @@
+// Copyright 2023 Northern.tech AS
+//
+//    Licensed under the Apache License, Version 2.0 (the "License");
+//    you may not use this file except in compliance with the License.
+//    You may obtain a copy of the License at
+//
+//        http://www.apache.org/licenses/LICENSE-2.0
+//
+//    Unless required by applicable law or agreed to in writing, software
+//    distributed under the License is distributed on an "AS IS" BASIS,
+//    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//    See the License for the specific language governing permissions and
+//    limitations under the License.
+package inventory
+
+import (
+	"crypto/sha256"
+	"encoding/hex"
+	"encoding/json"
+	"os"
+	"sort"
+	"time"
+
+	"github.com/pkg/errors"
+	log "github.com/sirupsen/logrus"
+
+	"github.com/mendersoftware/mender/client"
+	"github.com/mendersoftware/mender/datastore"
+	"github.com/mendersoftware/mender/store"
+)
+
+// SubmittedInventory describes an inventory submitted to the server, by its
+// digest, and the digest of each attribute.
+type SubmittedInventory struct {
+	Digest     string            `json:"digest"`
+	Attributes map[string]string `json:"attributes"`
+	// When the whole inventory was last submitted.
+	Submitted time.Time `json:"submitted"`
+	// The server it was submitted to, and the device it was submitted
+	// for, as identified by the auth token.
+	ServerURL string `json:"server_url"`
+	DeviceID  string `json:"device_id"`
+}
+
+// SubmittedTo reports whether the inventory was submitted to 'serverURL' for
+// 'deviceID'. It never was to an unknown server or device.
+func (si *SubmittedInventory) SubmittedTo(serverURL, deviceID string) bool {
+	return serverURL != "" && deviceID != "" &&
+		si.ServerURL == serverURL && si.DeviceID == deviceID
+}
+
+func attributeDigest(value interface{}) string {
+	data, err := json.Marshal(value)
+	if err != nil {
+		// Never equal to a real digest, so the attribute is always
+		// submitted.
+		return ""
+	}
+	sum := sha256.Sum256(data)
+	return hex.EncodeToString(sum[:])
+}
+
+// NewSubmittedInventory computes the digests of 'data'.
+func NewSubmittedInventory(data client.InventoryData) *SubmittedInventory {
+	si := &SubmittedInventory{
+		Attributes: make(map[string]string, len(data)),
+	}
+	names := make([]string, 0, len(data))
+	for _, attr := range data {
+		si.Attributes[attr.Name] = attributeDigest(attr.Value)
+		names = append(names, attr.Name)
+	}
+	sort.Strings(names)
+
+	h := sha256.New()
+	for _, name := range names {
+		// Both are hex or JSON strings, and cannot contain newlines.
+		_, _ = h.Write([]byte(name + "\n" + si.Attributes[name] + "\n"))
+	}
+	si.Digest = hex.EncodeToString(h.Sum(nil))
+	return si
+}
+
+// Changes returns the attributes of 'data' which differ from the submitted
+// ones. 'complete' is false if attributes were removed, and cannot be
+// removed from the server by submitting the changes alone.
+func (si *SubmittedInventory) Changes(
+	data client.InventoryData,
+) (changes client.InventoryData, complete bool) {
+	present := 0
+	for _, attr := range data {
+		digest, ok := si.Attributes[attr.Name]
+		if ok {
+			present++
+		}
+		if !ok || digest != attributeDigest(attr.Value) {
+			changes = append(changes, attr)
+		}
+	}
+	return changes, present == len(si.Attributes)
+}
+
+// LoadSubmittedInventory returns the description of the inventory last
+// submitted, or nil if there is none.
+func LoadSubmittedInventory(s store.Store) *SubmittedInventory {
+	data, err := s.ReadAll(datastore.SubmittedInventoryKey)
+	if err != nil {
+		if !os.IsNotExist(err) {
+			log.Warnf("Failed to read the last submitted inventory: %v", err)
+		}
+		return nil
+	}
+	var si SubmittedInventory
+	if err = json.Unmarshal(data, &si); err != nil || si.Attributes == nil {
+		log.Warnf("Ignoring invalid record of the last submitted inventory")
+		return nil
+	}
+	return &si
+}
+
+// Store persists the description of the submitted inventory. It is
+// committed with the next group commit: if it is lost, the changes are
+// merely submitted again.
+func (si *SubmittedInventory) Store(s store.Store) error {
+	data, err := json.Marshal(si)
+	if err != nil {
+		return errors.Wrap(err, "failed to encode the submitted inventory")
+	}
+	return store.WriteAllDeferred(s, datastore.SubmittedInventoryKey, data)
+}
@@ -0,0 +1,82 @@
+// Copyright 2023 Northern.tech AS
+//
+//    Licensed under the Apache License, Version 2.0 (the "License");
+//    you may not use this file except in compliance with the License.
+//    You may obtain a copy of the License at
+//
+//        http://www.apache.org/licenses/LICENSE-2.0
+//
+//    Unless required by applicable law or agreed to in writing, software
+//    distributed under the License is distributed on an "AS IS" BASIS,
+//    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//    See the License for the specific language governing permissions and
+//    limitations under the License.
+package inventory
+
+import (
+	"testing"
+	"time"
+
+	"github.com/stretchr/testify/assert"
+	"github.com/stretchr/testify/require"
+
+	"github.com/mendersoftware/mender/client"
+	"github.com/mendersoftware/mender/datastore"
+	"github.com/mendersoftware/mender/store"
+)
+
+func TestSubmittedInventory(t *testing.T) {
+	data := client.InventoryData{
+		{Name: "foo", Value: "bar"},
+		{Name: "multi", Value: []string{"a", "b"}},
+	}
+	si := NewSubmittedInventory(data)
+
+	reordered := client.InventoryData{data[1], data[0]}
+	assert.Equal(t, si.Digest, NewSubmittedInventory(reordered).Digest)
+
+	changes, complete := si.Changes(reordered)
+	assert.Empty(t, changes)
+	assert.True(t, complete)
+
+	changed := client.InventoryData{
+		{Name: "foo", Value: "bar"},
+		{Name: "multi", Value: []string{"b", "a"}},
+		{Name: "new", Value: "value"},
+	}
+	assert.NotEqual(t, si.Digest, NewSubmittedInventory(changed).Digest)
+	changes, complete = si.Changes(changed)
+	assert.Equal(t, changed[1:], changes)
+	assert.True(t, complete)
+
+	changes, complete = si.Changes(data[:1])
+	assert.Empty(t, changes)
+	assert.False(t, complete, "removed attributes require a complete submit")
+
+	// A value which turns into a list is a change.
+	changes, _ = si.Changes(client.InventoryData{{Name: "foo", Value: []string{"bar"}}})
+	assert.Len(t, changes, 1)
+}
+
+func TestSubmittedInventoryStore(t *testing.T) {
+	s := store.NewMemStore()
+	assert.Nil(t, LoadSubmittedInventory(s))
+
+	si := NewSubmittedInventory(client.InventoryData{{Name: "foo", Value: "bar"}})
+	si.Submitted = time.Unix(1234, 0).UTC()
+	si.ServerURL = "https://mender.io"
+	si.DeviceID = "device-1"
+	require.NoError(t, si.Store(s))
+	loaded := LoadSubmittedInventory(s)
+	assert.Equal(t, si, loaded)
+
+	assert.True(t, loaded.SubmittedTo("https://mender.io", "device-1"))
+	assert.False(t, loaded.SubmittedTo("https://other.io", "device-1"))
+	assert.False(t, loaded.SubmittedTo("https://mender.io", "device-2"))
+	assert.False(t, (&SubmittedInventory{}).SubmittedTo("", ""))
+
+	require.NoError(t, s.WriteAll(datastore.SubmittedInventoryKey, []byte("{}")))
+	assert.Nil(t, LoadSubmittedInventory(s))
+	require.NoError(t, s.WriteAll(datastore.SubmittedInventoryKey, []byte("garbage")))
+	assert.Nil(t, LoadSubmittedInventory(s))
+}
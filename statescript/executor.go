@@ -31,6 +31,7 @@ import (
 
 	"github.com/mendersoftware/mender/client"
 	"github.com/mendersoftware/mender/system"
+	"github.com/mendersoftware/mender/utils"
 )
 
 const (
@@ -234,9 +235,13 @@ func execute(name string, timeout time.Duration) error {
 	// new PGID for the executed script and its children.
 	cmd.SysProcAttr = &syscall.SysProcAttr{Setpgid: true}
 
+	start := time.Now()
 	if err := cmd.Start(); err != nil {
 		return err
 	}
+	defer func() {
+		utils.Metrics.AddSince(utils.StageStateScript, 0, start)
+	}()
 
 	timer := time.AfterFunc(timeout, func() {
 		// In addition to kill a single process we are sending SIGKILL to
@@ -19,10 +19,15 @@ import (
 	"io/ioutil"
 	"os"
 	"path"
+	"sync"
+	"sync/atomic"
+	"time"
 
 	"github.com/bmatsuo/lmdb-go/lmdb"
 	"github.com/pkg/errors"
 	log "github.com/sirupsen/logrus"
+
+	"github.com/mendersoftware/mender/utils"
 )
 
 const (
@@ -37,6 +42,28 @@ var (
 // Implements `Store` interface.
 type DBStore struct {
 	env *lmdb.Env
+
+	// Number of committed write transactions.
+	commits uint64
+
+	// Serializes commits, and closing the store.
+	commitLock sync.Mutex
+
+	// Protects the fields below.
+	pendingLock sync.Mutex
+	// Deferred writes, not committed yet.
+	pending map[string]*deferredWrite
+	// Zero if writes are never deferred.
+	groupCommitDelay time.Duration
+	// Commits the deferred writes when it fires.
+	groupCommitTimer *time.Timer
+}
+
+// deferredWrite is a write, or a removal, of one entry, waiting for the next
+// commit.
+type deferredWrite struct {
+	data   []byte
+	remove bool
 }
 
 type DBStoreWrite struct {
@@ -78,7 +105,36 @@ func NewDBStore(dirpath string) *DBStore {
 	}
 }
 
+// EnableGroupCommit makes deferred writes wait up to 'delay' for a commit, so
+// that they are committed together with each other, or with the next write
+// transaction. Each commit syncs the database to storage, which is what
+// dominates the cost of a write. With a zero 'delay', writes are never
+// deferred.
+func (db *DBStore) EnableGroupCommit(delay time.Duration) error {
+	db.pendingLock.Lock()
+	db.groupCommitDelay = delay
+	db.pendingLock.Unlock()
+
+	if delay <= 0 {
+		return db.Flush()
+	}
+	return nil
+}
+
+// Commits returns the number of write transactions committed so far. Unless
+// LmdbNoSync is set, each of them synced the database to storage once.
+func (db *DBStore) Commits() uint64 {
+	return atomic.LoadUint64(&db.commits)
+}
+
 func (db *DBStore) Close() error {
+	if err := db.Flush(); err != nil {
+		log.Errorf("Failed to commit deferred writes before closing the DB: %v", err)
+	}
+
+	db.commitLock.Lock()
+	defer db.commitLock.Unlock()
+
 	if db.env != nil {
 		if err := db.env.Close(); err != nil {
 			return errors.Wrapf(err, "failed to close DB")
@@ -102,6 +158,18 @@ func (db *DBStore) ReadAll(name string) ([]byte, error) {
 	return buf, err
 }
 
+// ReadLent calls lendFunc with the contents of entry 'name', straight from
+// the memory map of the database, without copying them. See LendingReader.
+func (db *DBStore) ReadLent(name string, lendFunc func(data []byte) error) error {
+	if db.env == nil {
+		return ErrDBStoreNotInitialized
+	}
+
+	return db.ReadTransaction(func(txn Transaction) error {
+		return txn.(*dbTransaction).ReadLent(name, lendFunc)
+	})
+}
+
 func (db *DBStore) WriteAll(name string, data []byte) error {
 	if db.env == nil {
 		return ErrDBStoreNotInitialized
@@ -122,6 +190,57 @@ func (db *DBStore) Remove(name string) error {
 	})
 }
 
+// WriteAllDeferred writes 'data' to entry 'name', but leaves the commit to
+// the group commit, unless it is disabled. See DeferredWriter.
+func (db *DBStore) WriteAllDeferred(name string, data []byte) error {
+	return db.deferWrite(name, &deferredWrite{data: append([]byte{}, data...)})
+}
+
+// RemoveDeferred removes entry 'name', but leaves the commit to the group
+// commit, unless it is disabled. See DeferredWriter.
+func (db *DBStore) RemoveDeferred(name string) error {
+	return db.deferWrite(name, &deferredWrite{remove: true})
+}
+
+func (db *DBStore) deferWrite(name string, w *deferredWrite) error {
+	if db.env == nil {
+		return ErrDBStoreNotInitialized
+	}
+
+	db.pendingLock.Lock()
+	if db.groupCommitDelay <= 0 {
+		db.pendingLock.Unlock()
+		if w.remove {
+			return db.Remove(name)
+		}
+		return db.WriteAll(name, w.data)
+	}
+	if db.pending == nil {
+		db.pending = make(map[string]*deferredWrite)
+	}
+	db.pending[name] = w
+	db.scheduleGroupCommit()
+	db.pendingLock.Unlock()
+	return nil
+}
+
+// scheduleGroupCommit starts the group commit timer, unless it is running
+// already. Must be called with pendingLock held.
+func (db *DBStore) scheduleGroupCommit() {
+	if db.groupCommitTimer == nil && len(db.pending) > 0 && db.groupCommitDelay > 0 {
+		db.groupCommitTimer = time.AfterFunc(db.groupCommitDelay, func() {
+			if err := db.Flush(); err != nil {
+				log.Errorf("Failed to commit deferred writes to the DB: %v", err)
+			}
+		})
+	}
+}
+
+// Flush commits all deferred writes now.
+func (db *DBStore) Flush() error {
+	return db.commit(nil)
+}
+
 func (db *DBStore) OpenRead(name string) (io.ReadCloser, error) {
 	b, err := db.ReadAll(name)
 	if err != nil {
@@ -151,8 +270,45 @@ func (dbw *DBStoreWrite) Commit() error {
 	return dbw.dbs.WriteAll(dbw.name, dbw.data.Bytes())
 }
 
+// WriteTransaction commits the deferred writes along with the transaction,
+// so they cost no extra sync.
 func (db *DBStore) WriteTransaction(txnFunc func(txn Transaction) error) error {
-	return db.env.Update(func(lmdbTxn *lmdb.Txn) error {
+	return db.commit(txnFunc)
+}
+
+// commit runs txnFunc, if any, in a write transaction which also commits all
+// deferred writes.
+func (db *DBStore) commit(txnFunc func(txn Transaction) error) error {
+	db.commitLock.Lock()
+	defer db.commitLock.Unlock()
+
+	if db.env == nil {
+		if txnFunc == nil {
+			return nil
+		}
+		return ErrDBStoreNotInitialized
+	}
+
+	// The deferred writes stay visible to readers until they are
+	// committed, so take a copy.
+	db.pendingLock.Lock()
+	pending := make(map[string]*deferredWrite, len(db.pending))
+	for name, w := range db.pending {
+		pending[name] = w
+	}
+	if db.groupCommitTimer != nil {
+		db.groupCommitTimer.Stop()
+		db.groupCommitTimer = nil
+	}
+	db.pendingLock.Unlock()
+
+	if txnFunc == nil && len(pending) == 0 {
+		return nil
+	}
+
+	start := time.Now()
+	var written int64
+	err := db.env.Update(func(lmdbTxn *lmdb.Txn) error {
 		dbi, err := lmdbTxn.OpenRoot(0)
 		if err != nil {
 			return err
@@ -161,19 +317,68 @@ func (db *DBStore) WriteTransaction(txnFunc func(txn Transaction) error) error {
 			txn: lmdbTxn,
 			dbi: dbi,
 		}
+		// Deferred writes go first, so that the transaction sees, and
+		// overrides, them.
+		for name, w := range pending {
+			if w.remove {
+				err = txn.Remove(name)
+			} else {
+				err = txn.WriteAll(name, w.data)
+			}
+			if err != nil {
+				return err
+			}
+		}
+		defer func() {
+			written = txn.written
+		}()
+		if txnFunc == nil {
+			return nil
+		}
 		return txnFunc(txn)
 	})
+	utils.Metrics.AddSince(utils.StageStoreCommit, written, start)
+
+	db.pendingLock.Lock()
+	if err == nil {
+		atomic.AddUint64(&db.commits, 1)
+		for name, w := range pending {
+			// Unless it was written again meanwhile.
+			if db.pending[name] == w {
+				delete(db.pending, name)
+			}
+		}
+	}
+	// Writes deferred meanwhile, or not committed because of an error,
+	// are committed later.
+	db.scheduleGroupCommit()
+	db.pendingLock.Unlock()
+
+	return err
 }
 
+// ReadTransaction sees the deferred writes, like reads outside of
+// transactions do.
 func (db *DBStore) ReadTransaction(txnFunc func(txn Transaction) error) error {
+	var pending map[string]*deferredWrite
+	db.pendingLock.Lock()
+	if len(db.pending) > 0 {
+		pending = make(map[string]*deferredWrite, len(db.pending))
+		for name, w := range db.pending {
+			pending[name] = w
+		}
+	}
+	db.pendingLock.Unlock()
+
 	return db.env.View(func(lmdbTxn *lmdb.Txn) error {
 		dbi, err := lmdbTxn.OpenRoot(0)
 		if err != nil {
 			return err
 		}
 		txn := &dbTransaction{
-			txn: lmdbTxn,
-			dbi: dbi,
+			txn:     lmdbTxn,
+			dbi:     dbi,
+			pending: pending,
 		}
 		return txnFunc(txn)
 	})
@@ -182,22 +387,51 @@ func (db *DBStore) ReadTransaction(txnFunc func(txn Transaction) error) error {
 type dbTransaction struct {
 	txn *lmdb.Txn
 	dbi lmdb.DBI
+	// Deferred writes, which read transactions see on top of the
+	// database.
+	pending map[string]*deferredWrite
+	// Bytes written by the transaction.
+	written int64
 }
 
 func (txn *dbTransaction) WriteAll(name string, data []byte) error {
+	txn.written += int64(len(data))
 	return txn.txn.Put(txn.dbi, []byte(name), data, 0)
 }
 
 func (txn *dbTransaction) ReadAll(name string) ([]byte, error) {
+	var data []byte
+	err := txn.ReadLent(name, func(lent []byte) error {
+		data = append([]byte{}, lent...)
+		return nil
+	})
+	return data, err
+}
+
+// ReadLent calls lendFunc with the contents of entry 'name', straight from
+// the memory map of the database. See LendingReader.
+func (txn *dbTransaction) ReadLent(name string, lendFunc func(data []byte) error) error {
+	if w, ok := txn.pending[name]; ok {
+		if w.remove {
+			return os.ErrNotExist
+		}
+		return lendFunc(w.data)
+	}
+
+	rawRead := txn.txn.RawRead
+	txn.txn.RawRead = true
 	data, err := txn.txn.Get(txn.dbi, []byte(name))
+	txn.txn.RawRead = rawRead
 
 	// conform to semantics of store read operations and return
 	// os.ErrNotExist if the entry was not found
 	if lmdb.IsNotFound(err) {
-		return nil, os.ErrNotExist
+		return os.ErrNotExist
+	} else if err != nil {
+		return err
 	}
 
-	return data, err
+	return lendFunc(data)
 }
 
 func (txn *dbTransaction) Remove(name string) error {
@@ -19,8 +19,11 @@ import (
 	"os"
 	"path"
 	"testing"
+	"time"
 
+	"github.com/pkg/errors"
 	"github.com/stretchr/testify/assert"
+	"github.com/stretchr/testify/require"
 )
 
 func TestDBStore(t *testing.T) {
@@ -104,3 +107,131 @@ func TestDBStore(t *testing.T) {
 	err = d.Remove("bar")
 	assert.NoError(t, err)
 }
+
+func TestDBStoreGroupCommit(t *testing.T) {
+	tmppath, err := ioutil.TempDir("", "mendertest-dbstore-")
+	require.NoError(t, err)
+	defer os.RemoveAll(tmppath)
+
+	d := NewDBStore(tmppath)
+	require.NotNil(t, d)
+	defer func() {
+		d.Close()
+	}()
+
+	// Disabled: deferred writes are committed right away.
+	require.NoError(t, d.WriteAllDeferred("foo", []byte("foo-0")))
+	assert.EqualValues(t, 1, d.Commits())
+
+	require.NoError(t, d.EnableGroupCommit(time.Hour))
+
+	// Deferred writes are visible, but not committed.
+	data := []byte("foo-1")
+	require.NoError(t, d.WriteAllDeferred("foo", data))
+	data[4] = 'x'
+	require.NoError(t, d.WriteAllDeferred("bar", []byte("bar-1")))
+	require.NoError(t, d.RemoveDeferred("bar"))
+	require.NoError(t, d.WriteAllDeferred("baz", []byte("baz-1")))
+	assert.EqualValues(t, 1, d.Commits())
+
+	rdata, err := d.ReadAll("foo")
+	assert.NoError(t, err)
+	assert.Equal(t, []byte("foo-1"), rdata)
+	_, err = d.ReadAll("bar")
+	assert.True(t, os.IsNotExist(err))
+	err = d.ReadTransaction(func(txn Transaction) error {
+		rdata, err := txn.ReadAll("baz")
+		assert.Equal(t, []byte("baz-1"), rdata)
+		return err
+	})
+	assert.NoError(t, err)
+
+	// A failed transaction does not lose them.
+	err = d.WriteTransaction(func(txn Transaction) error {
+		return errors.New("aborted")
+	})
+	assert.EqualError(t, err, "aborted")
+
+	// They are committed along with the next transaction, which sees
+	// them.
+	err = d.WriteTransaction(func(txn Transaction) error {
+		rdata, err := txn.ReadAll("foo")
+		assert.Equal(t, []byte("foo-1"), rdata)
+		if err != nil {
+			return err
+		}
+		return txn.WriteAll("baz", []byte("baz-2"))
+	})
+	assert.NoError(t, err)
+	assert.EqualValues(t, 2, d.Commits())
+
+	// Nothing left to commit.
+	assert.NoError(t, d.Flush())
+	assert.EqualValues(t, 2, d.Commits())
+
+	// The deadline commits them as well.
+	require.NoError(t, d.EnableGroupCommit(10*time.Millisecond))
+	require.NoError(t, d.WriteAllDeferred("foo", []byte("foo-2")))
+	require.NoError(t, d.WriteAllDeferred("bar", []byte("bar-2")))
+	assert.Eventually(t, func() bool {
+		return d.Commits() == 3
+	}, 5*time.Second, 10*time.Millisecond)
+
+	// And closing the store.
+	require.NoError(t, d.EnableGroupCommit(time.Hour))
+	require.NoError(t, d.RemoveDeferred("foo"))
+	require.NoError(t, d.Close())
+
+	d = NewDBStore(tmppath)
+	require.NotNil(t, d)
+	_, err = d.ReadAll("foo")
+	assert.True(t, os.IsNotExist(err))
+	for name, expected := range map[string]string{"bar": "bar-2", "baz": "baz-2"} {
+		rdata, err := d.ReadAll(name)
+		assert.NoError(t, err)
+		assert.Equal(t, []byte(expected), rdata)
+	}
+}
+
+func TestDBStoreReadLent(t *testing.T) {
+	tmppath, err := ioutil.TempDir("", "mendertest-dbstore-")
+	require.NoError(t, err)
+	defer os.RemoveAll(tmppath)
+
+	d := NewDBStore(tmppath)
+	require.NotNil(t, d)
+	defer d.Close()
+
+	require.NoError(t, d.WriteAll("foo", []byte("foo")))
+	require.NoError(t, d.EnableGroupCommit(time.Hour))
+	require.NoError(t, d.WriteAllDeferred("bar", []byte("bar")))
+
+	for _, s := range []Store{d, NewMemStore()} {
+		if _, ok := s.(*MemStore); ok {
+			require.NoError(t, s.WriteAll("foo", []byte("foo")))
+			require.NoError(t, s.WriteAll("bar", []byte("bar")))
+		}
+
+		for _, name := range []string{"foo", "bar"} {
+			err = ReadLent(s, name, func(data []byte) error {
+				assert.Equal(t, []byte(name), data)
+				return nil
+			})
+			assert.NoError(t, err)
+		}
+
+		err = s.WriteTransaction(func(txn Transaction) error {
+			return ReadLent(txn, "foo", func(data []byte) error {
+				assert.Equal(t, []byte("foo"), data)
+				return errors.New("lent")
+			})
+		})
+		assert.EqualError(t, err, "lent")
+
+		err = ReadLent(s, "baz", func(data []byte) error {
+			t.Fatal("called for a missing entry")
+			return nil
+		})
+		assert.True(t, os.IsNotExist(err))
+	}
+}
@@ -66,3 +66,59 @@ type Store interface {
 	// Same as above, for read transactions.
 	ReadTransaction(txnFunc func(txn Transaction) error) error
 }
+
+// DeferredWriter is implemented by stores which can defer the commit of
+// writes that need not be durable right away, and commit several of them
+// together. Deferred writes are visible to reads immediately, but may be lost
+// if the device loses power before they are committed. They are committed
+// after a short delay, along with the next write transaction, or on Flush,
+// whichever comes first.
+type DeferredWriter interface {
+	// write all of data to entry 'name', committing it later
+	WriteAllDeferred(name string, data []byte) error
+	// remove an entry, committing it later
+	RemoveDeferred(name string) error
+	// commit all deferred writes now
+	Flush() error
+}
+
+// LendingReader is implemented by stores and transactions which can lend
+// the contents of an entry to the caller without copying them.
+type LendingReader interface {
+	// Calls lendFunc with the contents of entry 'name'. The data is only
+	// valid until lendFunc returns, and must not be modified. Errors
+	// returned by lendFunc are returned as is.
+	ReadLent(name string, lendFunc func(data []byte) error) error
+}
+
+// WriteAllDeferred writes 'data' to entry 'name' of 's', deferring the commit
+// if 's' supports it. Only for data that may be lost on power loss.
+func WriteAllDeferred(s Store, name string, data []byte) error {
+	if dw, ok := s.(DeferredWriter); ok {
+		return dw.WriteAllDeferred(name, data)
+	}
+	return s.WriteAll(name, data)
+}
+
+// RemoveDeferred removes entry 'name' of 's', deferring the commit if 's'
+// supports it. Only for entries that may reappear on power loss.
+func RemoveDeferred(s Store, name string) error {
+	if dw, ok := s.(DeferredWriter); ok {
+		return dw.RemoveDeferred(name)
+	}
+	return s.Remove(name)
+}
+
+// ReadLent calls lendFunc with the contents of entry 'name' of 'txn', which
+// may be a Store as well. The data is only valid until lendFunc returns, and
+// must not be modified. It is copied only if 'txn' cannot lend it.
+func ReadLent(txn Transaction, name string, lendFunc func(data []byte) error) error {
+	if lr, ok := txn.(LendingReader); ok {
+		return lr.ReadLent(name, lendFunc)
+	}
+	data, err := txn.ReadAll(name)
+	if err != nil {
+		return err
+	}
+	return lendFunc(data)
+}
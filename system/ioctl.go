@@ -29,8 +29,9 @@ import (
 
 const (
 	// ioctl magics from <linux/fs.h>
-	IOCTL_FIFREEZE_MAGIC uint = 0xC0045877 // _IOWR('X', 119, int)
-	IOCTL_FITHAW_MAGIC   uint = 0xC0045878 // _IOWR('X', 120, int)
+	IOCTL_FIFREEZE_MAGIC   uint = 0xC0045877 // _IOWR('X', 119, int)
+	IOCTL_FITHAW_MAGIC     uint = 0xC0045878 // _IOWR('X', 120, int)
+	IOCTL_BLKZEROOUT_MAGIC uint = 0x127F     // _IO(0x12, 127)
 )
 
 var (
@@ -310,3 +311,22 @@ func ThawFS(fd int) error {
 	}
 	return nil
 }
+
+// ZeroOutBlockDeviceRange zeroes the 'length' bytes starting at 'offset' of a
+// block-device (BLKZEROOUT). Unlike BLKDISCARD, the range is guaranteed to
+// read back as zeros; the kernel unmaps it where the device supports that, and
+// writes zeros otherwise. Both must be aligned to the logical sector size of
+// the device.
+func ZeroOutBlockDeviceRange(file *os.File, offset, length uint64) error {
+	rng := [2]uint64{offset, length}
+	// May take a long time on large ranges, so let the scheduler run
+	// other goroutines meanwhile.
+	_, _, errno := sys.Syscall(
+		uintptr(unix.SYS_IOCTL), file.Fd(),
+		uintptr(IOCTL_BLKZEROOUT_MAGIC),
+		uintptr(unsafe.Pointer(&rng)))
+	if errno != 0 {
+		return errno
+	}
+	return nil
+}
@@ -33,6 +33,7 @@ type stat unix.Stat_t
 type SysLinux interface {
 	Stat(string, *stat) error
 	RawSyscall(uintptr, uintptr, uintptr, uintptr) (uintptr, uintptr, unix.Errno)
+	Syscall(uintptr, uintptr, uintptr, uintptr) (uintptr, uintptr, unix.Errno)
 	IoctlSetInt(int, uint, int) error
 	OpenMountInfo() (io.ReadCloser, error)
 	DeviceFromID([2]uint32) (string, error)
@@ -49,6 +50,10 @@ func (l *linux) RawSyscall(req, p1, p2, p3 uintptr) (uintptr, uintptr, unix.Errn
 	return unix.RawSyscall(req, p1, p2, p3)
 }
 
+func (l *linux) Syscall(req, p1, p2, p3 uintptr) (uintptr, uintptr, unix.Errno) {
+	return unix.Syscall(req, p1, p2, p3)
+}
+
 func (l *linux) IoctlSetInt(fd int, req uint, value int) error {
 	return unix.IoctlSetInt(fd, req, value)
 }
@@ -141,6 +141,35 @@ func TestSetUbiUpdateVolume(t *testing.T) {
 	assert.EqualError(t, err, unix.ENOTTY.Error())
 }
 
+func TestZeroOutBlockDeviceRange(t *testing.T) {
+	testFile, err := ioutil.TempFile("", "test")
+	if err != nil {
+		t.Fatal("Failed to initialize test tempfile")
+		return
+	}
+	defer func() {
+		testFile.Close()
+		os.Remove(testFile.Name())
+	}()
+	Msys.eno = 0
+	Msys.On("Syscall", uintptr(unix.SYS_IOCTL), testFile.Fd(),
+		uintptr(IOCTL_BLKZEROOUT_MAGIC),
+		mock.MatchedBy(func(ptr uintptr) bool {
+			var p *[2]uint64 = (*[2]uint64)(unsafe.Pointer(ptr))
+			return p[0] == 4096 && p[1] == 8192
+		})).
+		Return(0, 0, unix.Errno(0))
+
+	err = ZeroOutBlockDeviceRange(testFile, 4096, 8192)
+	assert.NoError(t, err)
+
+	// See note at RawSyscall regarding Errno
+	Msys.eno = unix.EOPNOTSUPP
+	err = ZeroOutBlockDeviceRange(testFile, 4096, 8192)
+	assert.EqualError(t, err, unix.EOPNOTSUPP.Error())
+	Msys.eno = 0
+}
+
 func TestFreezeFs(t *testing.T) {
 	tmpFile, err := ioutil.TempFile("", "test")
 	if err != nil {
@@ -238,6 +267,12 @@ func (m *SysMock) RawSyscall(req, p1, p2, p3 uintptr) (uintptr, uintptr, unix.Er
 	return r0, r1, r2
 }
 
+func (m *SysMock) Syscall(req, p1, p2, p3 uintptr) (uintptr, uintptr, unix.Errno) {
+	m.Called(req, p1, p2, p3)
+	// See note at RawSyscall regarding Errno
+	return 0, 0, Msys.eno
+}
+
 func (m *SysMock) IoctlSetInt(fd int, req uint, value int) error {
 	ret := m.Called(fd, req, value)
 
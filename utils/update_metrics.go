@@ -0,0 +1,226 @@
+// Copyright 2023 Northern.tech AS
+//
+//    Licensed under the Apache License, Version 2.0 (the "License");
+//    you may not use this file except in compliance with the License.
+//    You may obtain a copy of the License at
+//
+//        http://www.apache.org/licenses/LICENSE-2.0
+//
+//    Unless required by applicable law or agreed to in writing, software
+//    distributed under the License is distributed on an "AS IS" BASIS,
+//    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//    See the License for the specific language governing permissions and
+//    limitations under the License.
+
+package utils
+
+import (
+	"encoding/json"
+	"io"
+	"sync"
+	"sync/atomic"
+	"time"
+)
+
+// UpdateStage is a stage of the update path which is instrumented.
+type UpdateStage int
+
+const (
+	// Reading the artifact from the server.
+	StageDownload UpdateStage = iota
+	// Reading payloads out of the artifact. The artifact reader
+	// decompresses and hashes them in one pass, so this covers both
+	// decompression and checksum verification.
+	StageDecompressVerify
+	// Writing payloads to the update module, or the inactive partition.
+	StageWrite
+	// Syncing the inactive partition.
+	StageSync
+	// Committing write transactions to the state store.
+	StageStoreCommit
+	// Running state scripts.
+	StageStateScript
+
+	numUpdateStages
+)
+
+var updateStageNames = [numUpdateStages]string{
+	StageDownload:         "download",
+	StageDecompressVerify: "decompress_verify",
+	StageWrite:            "write",
+	StageSync:             "sync",
+	StageStoreCommit:      "store_commit",
+	StageStateScript:      "state_script",
+}
+
+func (s UpdateStage) String() string {
+	return updateStageNames[s]
+}
+
+type updateStageCounter struct {
+	bytes int64
+	count int64
+	nanos int64
+}
+
+// UpdateMetrics counts the bytes and the time spent in each UpdateStage of
+// a deployment. Stages may overlap, or be nested: for instance, the time
+// spent waiting for the download is part of StageDecompressVerify as well.
+// Nothing is counted outside of a deployment, that is before Begin, or after
+// End.
+type UpdateMetrics struct {
+	// First, so that the counters are 64-bit aligned for the atomic
+	// operations on 32-bit platforms.
+	stages [numUpdateStages]updateStageCounter
+	// Non-zero between Begin and End.
+	active int32
+
+	lock         sync.Mutex
+	deploymentID string
+	started      time.Time
+	finished     time.Time
+}
+
+// Metrics is the UpdateMetrics of the current, or last, deployment.
+var Metrics = &UpdateMetrics{}
+
+// Add records 'bytes' processed in 'd' by 'stage', if a deployment is being
+// counted.
+func (m *UpdateMetrics) Add(stage UpdateStage, bytes int64, d time.Duration) {
+	if atomic.LoadInt32(&m.active) == 0 {
+		return
+	}
+	c := &m.stages[stage]
+	atomic.AddInt64(&c.bytes, bytes)
+	atomic.AddInt64(&c.count, 1)
+	atomic.AddInt64(&c.nanos, int64(d))
+}
+
+// AddSince records 'bytes' processed by 'stage' since 'start'.
+func (m *UpdateMetrics) AddSince(stage UpdateStage, bytes int64, start time.Time) {
+	m.Add(stage, bytes, time.Since(start))
+}
+
+// Begin starts counting for the deployment 'deploymentID', unless it is the
+// one being counted already.
+func (m *UpdateMetrics) Begin(deploymentID string) {
+	m.lock.Lock()
+	defer m.lock.Unlock()
+	if deploymentID == m.deploymentID && atomic.LoadInt32(&m.active) != 0 {
+		return
+	}
+	m.deploymentID = deploymentID
+	m.started = time.Now()
+	m.finished = time.Time{}
+	for i := range m.stages {
+		c := &m.stages[i]
+		atomic.StoreInt64(&c.bytes, 0)
+		atomic.StoreInt64(&c.count, 0)
+		atomic.StoreInt64(&c.nanos, 0)
+	}
+	atomic.StoreInt32(&m.active, 1)
+}
+
+// End stops counting at the end of the deployment, so that the report keeps
+// the metrics of that deployment until the next Begin.
+func (m *UpdateMetrics) End() {
+	m.lock.Lock()
+	defer m.lock.Unlock()
+	if atomic.SwapInt32(&m.active, 0) != 0 {
+		m.finished = time.Now()
+	}
+}
+
+// UpdateStageReport is the part of an UpdateMetricsReport for one stage.
+type UpdateStageReport struct {
+	Bytes          int64   `json:"bytes"`
+	Count          int64   `json:"count"`
+	Seconds        float64 `json:"seconds"`
+	BytesPerSecond float64 `json:"bytes_per_second,omitempty"`
+}
+
+// UpdateMetricsReport is the JSON report of UpdateMetrics.
+type UpdateMetricsReport struct {
+	DeploymentID string    `json:"deployment_id"`
+	Started      time.Time `json:"started"`
+	// Nil while the deployment is in progress.
+	Finished       *time.Time                   `json:"finished,omitempty"`
+	ElapsedSeconds float64                      `json:"elapsed_seconds"`
+	Stages         map[string]UpdateStageReport `json:"stages"`
+}
+
+// Report returns the metrics counted so far.
+func (m *UpdateMetrics) Report() *UpdateMetricsReport {
+	m.lock.Lock()
+	report := &UpdateMetricsReport{
+		DeploymentID: m.deploymentID,
+		Started:      m.started,
+		Stages:       make(map[string]UpdateStageReport, numUpdateStages),
+	}
+	if atomic.LoadInt32(&m.active) != 0 {
+		report.ElapsedSeconds = time.Since(m.started).Seconds()
+	} else if !m.finished.IsZero() {
+		finished := m.finished
+		report.Finished = &finished
+		report.ElapsedSeconds = finished.Sub(m.started).Seconds()
+	}
+	m.lock.Unlock()
+
+	for i := range m.stages {
+		c := &m.stages[i]
+		stage := UpdateStageReport{
+			Bytes:   atomic.LoadInt64(&c.bytes),
+			Count:   atomic.LoadInt64(&c.count),
+			Seconds: time.Duration(atomic.LoadInt64(&c.nanos)).Seconds(),
+		}
+		if stage.Seconds > 0 {
+			stage.BytesPerSecond = float64(stage.Bytes) / stage.Seconds
+		}
+		report.Stages[UpdateStage(i).String()] = stage
+	}
+	return report
+}
+
+// Restore continues counting from 'report', which was saved by a previous
+// run of the client, for instance before rebooting into the update. If the
+// deployment of the report had finished, it only reports it.
+func (m *UpdateMetrics) Restore(report *UpdateMetricsReport) {
+	m.lock.Lock()
+	defer m.lock.Unlock()
+	m.deploymentID = report.DeploymentID
+	m.started = report.Started
+	if report.Finished != nil {
+		m.finished = *report.Finished
+		atomic.StoreInt32(&m.active, 0)
+	} else {
+		m.finished = time.Time{}
+		atomic.StoreInt32(&m.active, 1)
+	}
+	for i := range m.stages {
+		stage := report.Stages[UpdateStage(i).String()]
+		c := &m.stages[i]
+		atomic.StoreInt64(&c.bytes, stage.Bytes)
+		atomic.StoreInt64(&c.count, stage.Count)
+		atomic.StoreInt64(&c.nanos, int64(stage.Seconds*float64(time.Second)))
+	}
+}
+
+// MarshalJSON marshals the Report.
+func (m *UpdateMetrics) MarshalJSON() ([]byte, error) {
+	return json.Marshal(m.Report())
+}
+
+// MeteredReader counts the bytes read from a reader, and the time spent
+// reading them, as one UpdateStage.
+type MeteredReader struct {
+	io.ReadCloser
+	Stage   UpdateStage
+	Metrics *UpdateMetrics
+}
+
+func (r *MeteredReader) Read(buf []byte) (int, error) {
+	start := time.Now()
+	n, err := r.ReadCloser.Read(buf)
+	r.Metrics.AddSince(r.Stage, int64(n), start)
+	return n, err
+}
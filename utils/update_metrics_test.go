@@ -0,0 +1,137 @@
+// Copyright 2023 Northern.tech AS
+//
+//    Licensed under the Apache License, Version 2.0 (the "License");
+//    you may not use this file except in compliance with the License.
+//    You may obtain a copy of the License at
+//
+//        http://www.apache.org/licenses/LICENSE-2.0
+//
+//    Unless required by applicable law or agreed to in writing, software
+//    distributed under the License is distributed on an "AS IS" BASIS,
+//    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//    See the License for the specific language governing permissions and
+//    limitations under the License.
+
+package utils
+
+import (
+	"encoding/json"
+	"io/ioutil"
+	"strings"
+	"testing"
+	"time"
+
+	"github.com/stretchr/testify/assert"
+	"github.com/stretchr/testify/require"
+)
+
+func TestUpdateMetrics(t *testing.T) {
+	m := &UpdateMetrics{}
+	m.Begin("deployment-1")
+	m.Add(StageWrite, 1000, time.Second)
+	m.Add(StageWrite, 1000, time.Second)
+	m.Add(StageStoreCommit, 10, time.Millisecond)
+
+	report := m.Report()
+	assert.Equal(t, "deployment-1", report.DeploymentID)
+	assert.Len(t, report.Stages, int(numUpdateStages))
+	assert.Equal(t, UpdateStageReport{
+		Bytes:          2000,
+		Count:          2,
+		Seconds:        2,
+		BytesPerSecond: 1000,
+	}, report.Stages["write"])
+	assert.Equal(t, int64(1), report.Stages["store_commit"].Count)
+	assert.Equal(t, UpdateStageReport{}, report.Stages["download"])
+
+	// The same deployment keeps counting...
+	m.Begin("deployment-1")
+	assert.Equal(t, int64(2000), m.Report().Stages["write"].Bytes)
+
+	// ...and a new one starts from zero.
+	m.Begin("deployment-2")
+	report = m.Report()
+	assert.Equal(t, "deployment-2", report.DeploymentID)
+	assert.Equal(t, UpdateStageReport{}, report.Stages["write"])
+}
+
+func TestUpdateMetricsEnd(t *testing.T) {
+	m := &UpdateMetrics{}
+	// Nothing is counted outside of a deployment.
+	m.Add(StageStoreCommit, 10, time.Millisecond)
+	assert.Equal(t, UpdateStageReport{}, m.Report().Stages["store_commit"])
+
+	m.Begin("deployment-1")
+	m.Add(StageStoreCommit, 10, time.Millisecond)
+	assert.Nil(t, m.Report().Finished)
+	m.End()
+	m.Add(StageStoreCommit, 10, time.Millisecond)
+
+	report := m.Report()
+	assert.Equal(t, "deployment-1", report.DeploymentID)
+	assert.Equal(t, int64(1), report.Stages["store_commit"].Count)
+	require.NotNil(t, report.Finished)
+	assert.Equal(t, report.Finished.Sub(report.Started).Seconds(), report.ElapsedSeconds)
+	time.Sleep(time.Millisecond)
+	assert.Equal(t, report.ElapsedSeconds, m.Report().ElapsedSeconds)
+
+	// A finished deployment is counted again from zero.
+	m.Begin("deployment-1")
+	report = m.Report()
+	assert.Nil(t, report.Finished)
+	assert.Equal(t, UpdateStageReport{}, report.Stages["store_commit"])
+}
+
+func TestUpdateMetricsRestore(t *testing.T) {
+	m := &UpdateMetrics{}
+	m.Begin("deployment-1")
+	m.Add(StageDownload, 4096, 2*time.Second)
+	m.Add(StageSync, 4096, time.Second)
+
+	data, err := json.Marshal(m)
+	require.NoError(t, err)
+
+	var report UpdateMetricsReport
+	require.NoError(t, json.Unmarshal(data, &report))
+
+	restored := &UpdateMetrics{}
+	restored.Restore(&report)
+	restored.Add(StageDownload, 4096, 2*time.Second)
+
+	report = *restored.Report()
+	assert.Equal(t, "deployment-1", report.DeploymentID)
+	assert.Equal(t, UpdateStageReport{
+		Bytes:          8192,
+		Count:          2,
+		Seconds:        4,
+		BytesPerSecond: 2048,
+	}, report.Stages["download"])
+	assert.Equal(t, int64(4096), report.Stages["sync"].Bytes)
+
+	// A finished deployment is only reported.
+	restored.End()
+	report = *restored.Report()
+	restored = &UpdateMetrics{}
+	restored.Restore(&report)
+	restored.Add(StageDownload, 4096, 2*time.Second)
+	assert.Equal(t, int64(8192), restored.Report().Stages["download"].Bytes)
+	assert.Equal(t, report.Finished.Unix(), restored.Report().Finished.Unix())
+}
+
+func TestMeteredReader(t *testing.T) {
+	m := &UpdateMetrics{}
+	m.Begin("deployment-1")
+	r := &MeteredReader{
+		ReadCloser: ioutil.NopCloser(strings.NewReader("0123456789")),
+		Stage:      StageDownload,
+		Metrics:    m,
+	}
+	data, err := ioutil.ReadAll(r)
+	require.NoError(t, err)
+	assert.Equal(t, "0123456789", string(data))
+	assert.NoError(t, r.Close())
+
+	report := m.Report()
+	assert.Equal(t, int64(10), report.Stages["download"].Bytes)
+	assert.NotZero(t, report.Stages["download"].Count)
+}